@@ -0,0 +1,473 @@
+"""
+The Manager without the window, for scripts and fleets of controllers.
+
+    python cli.py info COM7
+    python cli.py dump COM7 rig.json
+    python cli.py apply rig.json COM7 COM8 COM9
+    python cli.py bench COM7 --count 500 --stream 5
+    python cli.py monitor COM7 --seconds 30
+
+Results go to stdout as JSON, anything for people goes to stderr.
+"""
+import argparse
+import json
+import struct
+import sys
+import time
+
+import serial
+
+import mk
+
+
+def log(*args):
+    print(*args, file=sys.stderr)
+
+
+def connect(port, baudrate):
+    """
+    :return: ``mk.Link`` on the newest protocol the controller knows
+    """
+    controller = serial.Serial(port=port, baudrate=baudrate, timeout=.1)
+    while controller.in_waiting:
+        controller.read(controller.in_waiting)
+
+    link = mk.Link(controller)
+    link.handshake()
+    return link
+
+
+def percentiles(samples):
+    """
+    :return: ``dict`` of the usual suspects, in ms
+    """
+    if not samples:
+        return {'count': 0}
+
+    samples = sorted(samples)
+    pick = lambda f: samples[min(len(samples) - 1, int(f * len(samples)))]
+    return {
+        'count': len(samples),
+        'min': samples[0] * 1000,
+        'p50': pick(0.50) * 1000,
+        'p99': pick(0.99) * 1000,
+        'max': samples[-1] * 1000,
+    }
+
+
+# --------------------------------------------------------------------
+# -- Configurations
+# --------------------------------------------------------------------
+
+def read_layout(link, timeout):
+    """
+    The controller's layout with every interface's preferences. Remote
+    modules don't come with theirs, we ask for those one at a time.
+
+    :return: ``list[list[dict]]`` or None if the controller didn't answer
+    """
+    if link.version < 2:
+        log('Dumping needs protocol v2')
+        return None
+
+    link.request(mk.DumpAll, bytes(1))
+    command, _ = link.wait_for(mk.DumpAll, timeout)
+    if command is None:
+        return None
+
+    commanders = []
+    for c, interfaces in enumerate(mk.parse_dump(command.payload)):
+        items = []
+        for i, (type_, prefs) in enumerate(interfaces):
+            remote = not prefs
+            if remote:
+                prefs = get_preferences(link, c, i, timeout)
+
+            items.append({
+                'type': mk.TypeNames.get(type_, str(type_)),
+                'type_id': type_,
+                'remote': remote,
+                'raw': prefs.hex() if prefs is not None else None,
+            })
+
+            parameters = decode_parameters(type_, prefs)
+            if parameters is not None:
+                items[-1]['parameters'] = parameters
+
+        commanders.append(items)
+
+    return commanders
+
+
+def get_preferences(link, commander, index, timeout):
+    """
+    :return: ``bytes`` parameter type and parameters, None if nothing came
+    """
+    link.request(mk.GetPreferences, struct.pack('BB', commander, index))
+
+    deadline = time.monotonic() + timeout
+    while time.monotonic() < deadline:
+        command, _ = link.wait_for(mk.GetPreferences, deadline - time.monotonic())
+        if command is None:
+            break
+
+        data = command.payload
+        if len(data) >= 2 and data[0] == commander and data[1] == index:
+            # Just the header when the module couldn't answer
+            return bytes(data[2:]) or None
+
+    return None
+
+
+def decode_parameters(type_, prefs):
+    """
+    :return: ``dict`` of named parameters for the types we have a
+        structure for, None otherwise
+    """
+    cls = mk.ParameterTypes.get(type_)
+    if cls is None or not prefs or len(prefs) < 2:
+        return None
+
+    try:
+        parameters = cls(prefs[2:])
+    except struct.error:
+        return None
+
+    return {
+        name: getattr(parameters, name)
+        for name, attr in vars(cls).items()
+        if isinstance(attr, mk._unit)
+    }
+
+
+def encode_parameters(item):
+    """
+    The preferences to send for an interface from a configuration.
+    Named parameters win over the raw bytes so files can be edited
+    by hand.
+
+    :return: ``bytes`` or None
+    """
+    cls = mk.ParameterTypes.get(item['type_id'])
+    if cls is not None and 'parameters' in item:
+        values = [
+            item['parameters'][name]
+            for name, attr in vars(cls).items()
+            if isinstance(attr, mk._unit)
+        ]
+        return struct.pack('<H' + cls.format(), item['type_id'], *values)
+
+    if item.get('raw'):
+        return bytes.fromhex(item['raw'])
+    return None
+
+
+def same_layout(ours, theirs):
+    """
+    :return: ``bool`` True when both have the same interface types in
+        the same places
+    """
+    types = lambda layout: [[i['type_id'] for i in c] for c in layout]
+    return types(ours) == types(theirs)
+
+
+def record(commander, index, prefs):
+    # commander | index | size | parameters...
+    return struct.pack('BBB', commander, index, len(prefs)) + prefs
+
+
+def apply_configuration(link, config, timeout):
+    """
+    Local interfaces go in one mk.SetAll (all or nothing), remote
+    ones are set one at a time through the controller.
+
+    :return: ``dict`` result
+    """
+    current = read_layout(link, timeout)
+    if current is None:
+        return {'ok': False, 'error': 'no layout'}
+
+    if not same_layout(config['commanders'], current):
+        return {'ok': False, 'error': 'layout differs'}
+
+    bulk = b''
+    remote = []
+    for c, items in enumerate(config['commanders']):
+        for i, item in enumerate(items):
+            prefs = encode_parameters(item)
+            if prefs is None:
+                continue
+
+            if current[c][i]['remote']:
+                remote.append(record(c, i, prefs))
+            else:
+                bulk += record(c, i, prefs)
+
+    result = {'ok': True, 'applied': 0, 'remote': len(remote)}
+
+    if bulk:
+        link.request(mk.SetAll, bulk)
+        command, _ = link.wait_for(mk.SetAll, timeout)
+        if command is None:
+            return {'ok': False, 'error': 'no answer to SetAll'}
+
+        status, applied, offset = struct.unpack('<BBH', command.payload)
+        result['applied'] = applied
+        if status:
+            result.update(ok=False, error=f'rejected at byte {offset}')
+            return result
+
+    for payload in remote:
+        link.request(mk.SetPreferences, payload)
+
+    return result
+
+
+def command_info(args):
+    results = {}
+    for port in args.ports:
+        link = connect(port, args.baud)
+        layout = read_layout(link, args.timeout)
+        results[port] = {
+            'protocol': link.version,
+            'commanders': [
+                [{'type': i['type'], 'remote': i['remote']} for i in items]
+                for items in layout or []
+            ],
+        }
+        link.serial.close()
+    return results
+
+
+def command_dump(args):
+    link = connect(args.port, args.baud)
+    layout = read_layout(link, args.timeout)
+    link.serial.close()
+
+    if layout is None:
+        return {'ok': False, 'error': 'no layout'}
+
+    with open(args.file, 'w') as f:
+        json.dump({'protocol': link.version, 'commanders': layout}, f, indent=2)
+
+    return {
+        'ok': True,
+        'file': args.file,
+        'interfaces': sum(len(c) for c in layout),
+    }
+
+
+def command_apply(args):
+    with open(args.file) as f:
+        config = json.load(f)
+
+    results = {}
+    for port in args.ports:
+        link = connect(port, args.baud)
+        results[port] = apply_configuration(link, config, args.timeout)
+        link.serial.close()
+
+        log(f'{port}: {"ok" if results[port]["ok"] else results[port]["error"]}')
+
+    return results
+
+
+# --------------------------------------------------------------------
+# -- Benchmarks
+# --------------------------------------------------------------------
+
+BenchCommands = {
+    'probes': (mk.GetProbes, bytes(1)),
+    'dump': (mk.DumpAll, bytes(1)),
+}
+
+
+def round_trips(link, command_id, payload, count, timeout):
+    """
+    Request, wait for the frame that acks it, repeat
+
+    :return: ``tuple(list[float], int)`` seconds for each answer and
+        how many never came
+    """
+    samples = []
+    missed = 0
+
+    for _ in range(count):
+        started = time.perf_counter()
+        seq = link.request(command_id, payload)
+
+        deadline = time.monotonic() + timeout
+        answered = False
+        while not answered and time.monotonic() < deadline:
+            for command in link.read():
+                if command.id == command_id and command.ack == seq:
+                    answered = True
+
+        if answered:
+            samples.append(time.perf_counter() - started)
+        else:
+            missed += 1
+
+    return samples, missed
+
+
+def stream(link, seconds, interval):
+    """
+    Telemetry frames as fast as asked for, counting what arrives
+
+    :return: ``dict``
+    """
+    errors = link.decoder.errors
+    frames = 0
+    total = 0
+    gaps = []
+    last = None
+
+    link.request(mk.Telemetry, mk.TelemetryFrame.request(interval))
+    started = time.monotonic()
+    while time.monotonic() - started < seconds:
+        for command in link.read():
+            if command.id != mk.Telemetry:
+                continue
+
+            now = time.perf_counter()
+            if last is not None:
+                gaps.append(now - last)
+            last = now
+
+            frames += 1
+            total += command.size
+
+    link.request(mk.Telemetry, mk.TelemetryFrame.request(0))
+    elapsed = time.monotonic() - started
+
+    return {
+        'frames': frames,
+        'frames_per_second': frames / elapsed,
+        'bytes_per_second': total / elapsed,
+        'frame_gap': percentiles(gaps),
+        'errors': link.decoder.errors - errors,
+    }
+
+
+def command_bench(args):
+    link = connect(args.port, args.baud)
+    if link.version < 2:
+        link.serial.close()
+        return {'ok': False, 'error': 'benchmarks need protocol v2'}
+
+    command_id, payload = BenchCommands[args.command]
+
+    # Start the probes over so they only cover this run
+    link.request(mk.GetProbes, b'\x01')
+    link.wait_for(mk.GetProbes, args.timeout)
+
+    samples, missed = round_trips(link, command_id, payload, args.count, args.timeout)
+    result = {
+        'ok': True,
+        'protocol': link.version,
+        'round_trip': dict(percentiles(samples), command=args.command, missed=missed),
+    }
+
+    if args.stream > 0:
+        result['stream'] = stream(link, args.stream, args.interval)
+
+    link.request(mk.GetProbes, bytes(1))
+    command, _ = link.wait_for(mk.GetProbes, args.timeout)
+    if command is not None:
+        result['probes'] = mk.ProbeReport(command.payload).summary()
+
+    link.serial.close()
+    return result
+
+
+def command_monitor(args):
+    """
+    Mirror the controller's MIDI for a while and report rates and
+    queue latencies, overall and for each source
+    """
+    link = connect(args.port, args.baud)
+    if link.version < 2:
+        link.serial.close()
+        return {'ok': False, 'error': 'the monitor needs protocol v2'}
+
+    stats = mk.MonitorStats()
+    frames = 0
+    missing = False
+
+    link.request(mk.Monitor, mk.MonitorFrame.request(True))
+    started = time.monotonic()
+    while time.monotonic() - started < args.seconds:
+        for command in link.read():
+            if command.id != mk.Monitor:
+                continue
+
+            # An empty answer, built without the monitor
+            missing = missing or not command.payload
+            stats.add(mk.MonitorFrame(command.payload))
+            frames += 1
+
+    link.request(mk.Monitor, mk.MonitorFrame.request(False))
+    link.serial.close()
+
+    if missing:
+        return {'ok': False, 'error': 'the controller was built without the monitor'}
+
+    summary = stats.summary()
+    summary['sources'] = {f'0x{s:02x}': n for s, n in summary['sources'].items()}
+    return dict(summary, ok=True, frames=frames)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().split('\n')[0])
+    parser.add_argument('--baud', type=int, default=9600)
+    parser.add_argument('--timeout', type=float, default=1.0,
+                        help='seconds to wait for each answer')
+    sub = parser.add_subparsers(dest='action', required=True)
+
+    info = sub.add_parser('info', help='layout of each controller')
+    info.add_argument('ports', nargs='+')
+    info.set_defaults(run=command_info)
+
+    dump = sub.add_parser('dump', help='save a configuration')
+    dump.add_argument('port')
+    dump.add_argument('file')
+    dump.set_defaults(run=command_dump)
+
+    apply = sub.add_parser('apply', help='load a configuration onto controllers')
+    apply.add_argument('file')
+    apply.add_argument('ports', nargs='+')
+    apply.set_defaults(run=command_apply)
+
+    bench = sub.add_parser('bench', help='round trip and streaming numbers')
+    bench.add_argument('port')
+    bench.add_argument('--command', choices=sorted(BenchCommands), default='probes')
+    bench.add_argument('--count', type=int, default=100)
+    bench.add_argument('--stream', type=float, default=0,
+                       help='seconds of telemetry to take afterwards')
+    bench.add_argument('--interval', type=int, default=10,
+                       help='ms between telemetry frames')
+    bench.set_defaults(run=command_bench)
+
+    monitor = sub.add_parser('monitor', help='rates and latencies of the MIDI sent')
+    monitor.add_argument('port')
+    monitor.add_argument('--seconds', type=float, default=10)
+    monitor.set_defaults(run=command_monitor)
+
+    args = parser.parse_args()
+
+    try:
+        result = args.run(args)
+    except serial.SerialException as err:
+        result = {'ok': False, 'error': str(err)}
+
+    json.dump(result, sys.stdout, indent=2)
+    print()
+
+    if isinstance(result, dict) and 'ok' in result:
+        return 0 if result['ok'] else 1
+    return 0 if all(r.get('ok', True) for r in result.values()) else 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -15,14 +15,17 @@ class MidiInterface(QtCore.QObject):
     Aligns with an mk::_AbstractMidiInterface on the mk::MidiCommander
     """
     preferencesLoaded = QtCore.Signal()
+    edited = QtCore.Signal(object) # MidiInterface
     
     def __init__(self, commander, index, type):
         super().__init__()
         self._command = commander
         self._index = index
         self._type = type
+        self._remote = False
 
         self._parameters = None
+        self._synced = None # What the controller has, as far as we know
         self._parameter_class = None
         if type in mk.ParameterTypes:
             self._parameter_class = mk.ParameterTypes[type]
@@ -56,6 +59,14 @@ class MidiInterface(QtCore.QObject):
     def command(self):
         return self._command
 
+    @property
+    def remote(self):
+        """
+        True for interfaces on a module, the controller can only pass
+        whole preferences on to those
+        """
+        return self._remote
+
     @property
     def index(self):
         return self._index
@@ -78,15 +89,75 @@ class MidiInterface(QtCore.QObject):
 
         [ parameter_type, data... ]
         """
-        if not self._parameter_class:
-            return
+        if self.load_preferences(payload):
+            self.preferencesLoaded.emit()
+
 
-        param_type, = struct.unpack('H', payload[:2])
+    def load_preferences(self, payload):
+        """
+        Unpack the preferences without letting anyone know. Used
+        when we get them before the UI exists.
+
+        :return: ``bool`` True if we understood the payload
+        """
+        if not self._parameter_class or len(payload) < 2:
+            return False
+
+        param_type, = struct.unpack('<H', payload[:2])
         if param_type not in mk.ParameterTypes:
-            return
+            return False
 
         self._parameters = self._parameter_class(payload[2:])
-        self.preferencesLoaded.emit()
+        self._synced = self.parameter_bytes()
+        return True
+
+
+    def profile(self):
+        """
+        :return: ``dict`` what a profile keeps of us
+        """
+        raw = None
+        if self._parameters is not None:
+            raw = self.parameter_bytes().hex()
+        return {'type': self._type, 'remote': self._remote, 'raw': raw}
+
+
+    def parameter_bytes(self):
+        """
+        :return: ``bytes`` parameter type and parameters, the way the
+            controller holds them
+        """
+        return struct.pack('<H', self._type) + self._parameters.pack()
+
+
+    def patch(self):
+        """
+        What's changed since the controller last heard from us, as
+        one run of bytes from the first changed field to the last so
+        related values (a pot's low and high) land together. Counts
+        as sent.
+
+        :return: ``tuple(int, bytes)`` offset into the parameter bytes
+            and the new bytes, None if nothing changed
+        """
+        if self._parameters is None or self._synced is None:
+            return None
+
+        current = self.parameter_bytes()
+        changed = [
+            (offset + 2, size)
+            for _, offset, size in self._parameter_class.fields()
+            if current[offset + 2:offset + 2 + size]
+                != self._synced[offset + 2:offset + 2 + size]
+        ]
+        if not changed:
+            return None
+
+        start = changed[0][0]
+        end = changed[-1][0] + changed[-1][1]
+
+        self._synced = current
+        return start, current[start:end]
 
 
     def parameter_payload(self):
@@ -119,6 +190,7 @@ class MidiInterface(QtCore.QObject):
 
         print (payload)
 
+        self._synced = self.parameter_bytes()
         return struct.pack(
             full_format, *payload
         )
@@ -158,28 +230,84 @@ class MidiLayout(QtCore.QObject):
     MidiController preferences widget.
     """
     @classmethod
-    def initialize(cls, controller):
+    def from_dump(cls, payload):
         """
-        Initialize a layout structure based on the input
-        controller
+        Build the layout from a mk.DumpAll payload. The interfaces
+        come with their preferences already loaded.
 
-        :param controller: serial.Serial
+        :param payload: ``bytes``
         :return: :class:`MidiLayout`
         """
-        mk.request(controller, mk.GetLayout, bytes(1))
+        layout = cls(b'')
 
-        # Wait a moment for a response
-        time.sleep(0.05)
+        for i, interfaces in enumerate(mk.parse_dump(payload)):
+            types = [type_ for type_, _ in interfaces]
 
-        while controller.in_waiting:
-            # Wait for it!
-            if controller.read()[0] == mk.StartFlag:
-                break
-        
-        return cls(controller)
+            commander = MidiCommander(i, len(types), types)
+            for interface, (_, prefs) in zip(commander.interfaces, interfaces):
+                # Modules leave theirs out
+                interface._remote = not prefs
+                interface.load_preferences(prefs)
+
+            layout._commanders.append(commander)
+
+        return layout
+
+
+    @classmethod
+    def from_profile(cls, profile):
+        """
+        Build the layout from what we remembered of the controller
 
+        :param profile: ``dict`` from :class:`profiles.ProfileCache`
+        :return: :class:`MidiLayout`
+        """
+        layout = cls(b'')
+
+        for i, items in enumerate(profile['commanders']):
+            types = [item['type'] for item in items]
+
+            commander = MidiCommander(i, len(types), types)
+            for interface, item in zip(commander.interfaces, items):
+                interface._remote = item['remote']
+                if item['raw']:
+                    interface.load_preferences(bytes.fromhex(item['raw']))
+
+            layout._commanders.append(commander)
+
+        return layout
+
+
+    def to_profile(self):
+        """
+        :return: ``list[list[dict]]`` every interface, for
+            :meth:`profiles.ProfileCache.save`
+        """
+        return [
+            [interface.profile() for interface in commander.interfaces]
+            for commander in self._commanders
+        ]
 
-    def __init__(self, controller):
+
+    def update_from_dump(self, payload):
+        """
+        Take the local preferences from a mk.DumpAll payload. Only the
+        interfaces that differ from what we have let anyone know.
+        """
+        for commander, interfaces in zip(self._commanders, mk.parse_dump(payload)):
+            for interface, (_, prefs) in zip(commander.interfaces, interfaces):
+                if not prefs:
+                    continue
+
+                current = None
+                if interface.parameters is not None:
+                    current = interface.parameter_bytes()
+
+                if current != prefs:
+                    interface.process_preferences(prefs)
+
+
+    def __init__(self, payload):
         self._commanders = []
 
         # First byte will be the number of commanders
@@ -187,19 +315,17 @@ class MidiLayout(QtCore.QObject):
         # number of interfaces, and each byte after
         # is the interface type id.
 
-        if controller.read()[0] != mk.GetLayout:
+        if not payload:
             return
 
-        count = controller.read()[0]
+        count = payload[0]
 
-        offset = 0
+        offset = 1
         for i in range(count):
 
-            item_count = controller.read()[0]
-            items = []
-
-            for item_index in range(item_count):
-                items.append(controller.read()[0])
+            item_count = payload[offset]
+            items = list(payload[offset + 1:offset + 1 + item_count])
+            offset += 1 + item_count
 
             self._commanders.append(MidiCommander(
                 i,
@@ -213,12 +339,36 @@ class MidiLayout(QtCore.QObject):
         return self._commanders
 
 
+    def bulk_payload(self):
+        """
+        Every loaded interface's preferences in one mk.SetAll payload
+
+        :return: ``bytes``
+        """
+        payload = b''
+        for commander in self._commanders:
+            for interface in commander.interfaces:
+                if interface.parameters is None:
+                    continue
+                payload += interface.parameter_payload()
+        return payload
+
+
     def __str__(self):
         return "MidiController({})".format(
             ', '.join(str(c) for c in self._commanders)
         )
 
 
+    @QtCore.Slot(list)
+    def process_commands(self, commands):
+        """
+        A batch of commands from the protocol, in the order they came
+        """
+        for command in commands:
+            self.process_command(command)
+
+
     @QtCore.Slot(Command)
     def process_command(self, command):
         """
@@ -241,9 +391,253 @@ class MidiLayout(QtCore.QObject):
             command = self._commanders[data[0]]
             interface = command.interfaces[data[1]]
 
-            # All subsiquent data is the preference buffer
-            interface.process_preferences(data[2:])
+            # All subsiquent data is the preference buffer. None
+            # means the module couldn't answer.
+            if len(data) > 2:
+                interface.process_preferences(data[2:])
+            else:
+                print(f'[PREFERENCES]: None from {interface}')
+
+        elif command.id == mk.SetPreferences:
+
+            # Only sent back when a module didn't take them
+            data = command.payload
+            print(f'[PREFERENCES]: Not set on commander {data[0]} interface {data[1]}')
+
+        elif command.id == mk.SetAll:
+
+            status, applied, offset = struct.unpack('<BBH', command.payload)
+            if status:
+                print(f'[SET ALL]: Rejected at byte {offset}')
+            else:
+                print(f'[SET ALL]: Applied {applied} interfaces')
 
         elif command.id == mk.Message:
 
             print('[MESSAGE]: ', command.payload.decode('utf-8'))
+
+        elif command.id == mk.Log:
+
+            for message in mk.LogTable.default().decode(command.payload):
+                print('[LOG]: ', message)
+
+
+class LayoutDiscovery(QtCore.QObject):
+    """
+    Finds out what's on the other end of a MidiKitiProtocol without
+    blocking: handshake, layout, then the preferences that didn't come
+    with it. Each step waits only as long as the controller takes to
+    answer (up to a timeout, with retries) and the layout is handed
+    over as soon as it's known so the window can fill in as
+    preferences arrive.
+
+    With a ProfileCache a controller we've seen before is shown as we
+    left it straight away. Its local preferences are only fetched if
+    they've changed since, its modules' are always asked again.
+    """
+    layoutFound = QtCore.Signal(object) # MidiLayout
+    finished = QtCore.Signal()
+    failed = QtCore.Signal(str)
+
+    # Preference requests out at once. Remote ones are tunnelled
+    # through the controller's small queue.
+    InFlight = 4
+
+    def __init__(self, protocol, cache=None, parent=None):
+        super().__init__(parent)
+        self._protocol = protocol
+        self._cache = cache
+        self._hashes = None # (layout, preferences) from mk.Profile
+        self._cached = False
+        self._layout = None
+        self._waiting = []
+        self._in_flight = 0
+
+    @property
+    def layout(self):
+        return self._layout
+
+    def start(self):
+        # A controller that doesn't know Hello never answers, we
+        # carry on with v1
+        self._protocol.call(
+            mk.Hello, b'',
+            on_reply=lambda command: self._request_layout(),
+            on_timeout=self._request_layout,
+            timeout=0.25,
+            retries=1
+        )
+
+    def _request_layout(self):
+        if self._protocol.link.version < 2:
+            self._request_v1_layout()
+        elif self._cache is not None:
+            # Older controllers don't know mk.Profile, they get dumped
+            self._protocol.call(
+                mk.Profile, b'',
+                on_reply=self._profiled,
+                on_timeout=self._request_dump,
+                timeout=0.25,
+                retries=1
+            )
+        else:
+            self._request_dump()
+
+    def _profiled(self, command):
+        self._hashes = mk.parse_profile(command.payload)
+        profile = self._cache.load(self._hashes[0])
+        if profile is None:
+            self._request_dump()
+            return
+
+        self._cached = True
+
+        # Local preferences changed from somewhere else, all of them
+        # come in one round trip
+        if profile['preferences'] != self._hashes[1]:
+            self._in_flight += 1
+            self._protocol.call(
+                mk.DumpAll, bytes(1),
+                on_reply=self._refreshed,
+                on_timeout=lambda: self._refreshed(None),
+                timeout=1.0
+            )
+
+        self._found(MidiLayout.from_profile(profile))
+
+    def _refreshed(self, command):
+        self._in_flight -= 1
+        if command is not None:
+            self._layout.update_from_dump(command.payload)
+        self._next()
+
+    def _request_dump(self):
+        # Everything in one round trip
+        self._protocol.call(
+            mk.DumpAll, bytes(1),
+            on_reply=lambda command: self._found(MidiLayout.from_dump(command.payload)),
+            on_timeout=self._request_v1_layout,
+            timeout=1.0
+        )
+
+    def _request_v1_layout(self):
+        self._protocol.call(
+            mk.GetLayout, bytes(1),
+            on_reply=lambda command: self._found(MidiLayout(command.payload)),
+            on_timeout=lambda: self.failed.emit('The controller never sent its layout'),
+            timeout=1.0
+        )
+
+    def _found(self, layout):
+        self._layout = layout
+        self.layoutFound.emit(layout)
+
+        # Remembered module preferences are shown but asked for again,
+        # the layout hash doesn't cover them
+        self._waiting = [
+            interface
+            for commander in layout.commanders
+            for interface in commander.interfaces
+            if interface.parameters is None
+                or (self._cached and interface.remote)
+        ]
+        self._next()
+
+    def _next(self):
+        while self._waiting and self._in_flight < self.InFlight:
+            interface = self._waiting.pop(0)
+            self._in_flight += 1
+
+            header = interface.header()
+            self._protocol.call(
+                mk.GetPreferences, header,
+                on_reply=lambda command, i=interface: self._loaded(i, command),
+                on_timeout=lambda i=interface: self._loaded(i, None),
+                match=lambda command, h=header: command.payload[:2] == h
+            )
+
+        if not self._waiting and not self._in_flight:
+            self._save()
+            self.finished.emit()
+
+    def _save(self):
+        if self._cache is None or self._hashes is None:
+            return
+
+        layout_hash, preferences_hash = self._hashes
+        self._cache.save(layout_hash, preferences_hash, self._layout.to_profile())
+
+    def _loaded(self, interface, command):
+        self._in_flight -= 1
+
+        if command is None or len(command.payload) <= 2:
+            print(f'[LAYOUT]: No preferences from {interface}')
+        else:
+            interface.process_preferences(command.payload[2:])
+
+        self._next()
+
+
+class PatchQueue(QtCore.QObject):
+    """
+    Edits on their way to the controller. Widgets say what they've
+    touched and every so often whatever has changed goes out together,
+    only the fields that changed, so dragging a spinner doesn't crowd
+    out the telemetry sharing the link.
+    """
+    request = QtCore.Signal(int, bytes)
+
+    # ms between sends, edits in the meantime are folded together
+    Interval = 50
+
+    # Fits the smallest controller's receive buffer with the frame
+    # around it
+    FrameSize = 48
+
+    def __init__(self, link, parent=None):
+        super().__init__(parent)
+        self._link = link
+        self._dirty = []
+
+        self._timer = QtCore.QTimer(self)
+        self._timer.setSingleShot(True)
+        self._timer.setInterval(self.Interval)
+        self._timer.timeout.connect(self.flush)
+
+    @QtCore.Slot(object)
+    def add(self, interface):
+        if interface not in self._dirty:
+            self._dirty.append(interface)
+
+        if not self._timer.isActive():
+            self._timer.start()
+
+    @QtCore.Slot()
+    def flush(self):
+        self._timer.stop()
+        dirty, self._dirty = self._dirty, []
+
+        frame = b''
+        for interface in dirty:
+            # Older controllers and modules only take the whole thing
+            if self._link.version < 2 or interface.remote:
+                payload = interface.parameter_payload()
+                if payload:
+                    self.request.emit(mk.SetPreferences, payload)
+                continue
+
+            patch = interface.patch()
+            if patch is None:
+                continue
+
+            # commander | index | offset | size | bytes...
+            offset, data = patch
+            record = interface.header() + struct.pack('BB', offset, len(data)) + data
+
+            if len(frame) + len(record) > self.FrameSize:
+                self.request.emit(mk.PatchPreferences, frame)
+                frame = b''
+            frame += record
+
+        if frame:
+            self.request.emit(mk.PatchPreferences, frame)
@@ -1,4 +1,7 @@
+import binascii
 import os
+import re
+import time
 import struct
 
 OCTAVE_ID = 0xF1
@@ -9,11 +12,28 @@ KEY_EVENT_ID = 1
 POT_EVENT_ID = 2
 BUTTON_EVENT_ID = 2
 
+ProtocolVersion = 2
+
 StartFlag = 0xFF
 GetLayout = 0x01
 GetPreferences = 0x02
 SetPreferences = 0x03
 Message = 0x04
+Hello = 0x05
+DumpAll = 0x06
+SetAll = 0x07
+GetProbes = 0x08
+Telemetry = 0x09
+Log = 0x0A
+Recorder = 0x0B
+Trace = 0x0C
+PatchPreferences = 0x0D
+Monitor = 0x0E
+Profile = 0x0F
+
+# version | seq | ack | id | size (16)
+HeaderFormat = '<BBBBH'
+HeaderSize = struct.calcsize(HeaderFormat)
 
 TypeNames = {
     OCTAVE_ID: 'Octave',
@@ -21,22 +41,794 @@ TypeNames = {
     BUTTON_ID: 'Button'
 }
 
-def request(serial, command, payload):
+class Command(object):
     """
-    Submit a request to the given serial
+    Mirror the mk::Commmand structure to handle packets of
+    variable size. These are then tranlated to the correct
+    object type based on the id
+    """
+    def __init__(self, id=None, payload=None, seq=0, ack=0):
+        # The id of the command (e.g. mk.GetPreferences)
+        self.id = id
+
+        # The payload itself (in bytes)
+        self.payload = payload
+
+        # Protocol v2 sequence number of the frame and the
+        # sequence number of the request it answers (0 if none)
+        self.seq = seq
+        self.ack = ack
+
+    @property
+    def size(self):
+        """
+        The total size of the payload
+        """
+        return len(self.payload or b'')
+
+
+def crc16(data, crc=0xFFFF):
+    """
+    CRC-16/CCITT-FALSE, matching mk::crc16. binascii has it in C
+    (as the XMODEM CRC, which only differs in where it starts).
+    """
+    return binascii.crc_hqx(data, crc)
+
+
+def cobs_encode(data):
+    """
+    :return: ``bytes`` - data with every zero removed (no delimiter)
+    """
+    out = bytearray()
+    block = bytearray()
+
+    for byte in data:
+        if byte == 0:
+            out.append(len(block) + 1)
+            out += block
+            block.clear()
+            continue
+
+        block.append(byte)
+        if len(block) == 254:
+            out.append(0xFF)
+            out += block
+            block.clear()
+
+    out.append(len(block) + 1)
+    out += block
+    return bytes(out)
+
+
+def cobs_decode(data):
+    """
+    :return: ``bytes`` or None if the block is malformed
+    """
+    out = bytearray()
+    index = 0
+
+    while index < len(data):
+        code = data[index]
+        index += 1
+        if code == 0 or index + code - 1 > len(data):
+            return None
+
+        out += data[index:index + code - 1]
+        index += code - 1
+
+        if code != 0xFF and index < len(data):
+            out.append(0)
+
+    return bytes(out)
+
+
+def encode_frame(command, payload, version=1, seq=0, ack=0):
+    """
+    Frame a command for the wire
+
+    :param command: ``int`` command id
+    :param payload: ``bytes`` | ``int``
+    :param version: ``int`` protocol version to frame for
+    :return: ``bytes``
     """
     if isinstance(payload, int):
         payload = struct.pack('B', payload)
 
-    request = struct.pack(
-        ('B' * 3) + f'{len(payload)}s',
-        StartFlag,
-        command,
-        len(payload),
-        payload
+    if version < 2:
+        return struct.pack(
+            ('B' * 3) + f'{len(payload)}s',
+            StartFlag,
+            command,
+            len(payload),
+            payload
+        )
+
+    body = struct.pack(
+        HeaderFormat, version, seq, ack, command, len(payload)
+    ) + payload
+    body += struct.pack('<H', crc16(body))
+
+    return cobs_encode(body) + b'\x00'
+
+
+def request(serial, command, payload, version=1, seq=0):
+    """
+    Submit a request to the given serial
+    """
+    serial.write(encode_frame(command, payload, version, seq))
+
+
+class FrameDecoder(object):
+    """
+    Incremental decoder for the bytes coming from a mk::SerialLink.
+    Feed it whatever arrives and it hands back complete commands.
+    Frames are sliced out from a read position, the buffer is only
+    trimmed once per feed.
+    """
+    def __init__(self):
+        self.version = 1
+        self.errors = 0
+
+        self._buffer = bytearray()
+        self._pos = 0
+        self._last_seq = 0
+
+    def reset(self, version=1):
+        self.version = version
+        self._buffer.clear()
+        self._pos = 0
+        self._last_seq = 0
+
+    def feed(self, data):
+        """
+        :param data: ``bytes``
+        :return: ``list[Command]``
+        """
+        self._buffer += data
+        commands = []
+
+        while self._pos < len(self._buffer):
+            if self.version < 2:
+                command = self._next_v1()
+            else:
+                command = self._next_v2()
+
+            if command is None:
+                break
+
+            if command is False:
+                continue # Dropped a bad frame
+
+            if command.id == Hello and self.version < 2:
+                # Everything after the handshake is in the
+                # negotiated version
+                if command.payload and command.payload[0] >= 2:
+                    self.version = command.payload[0]
+                    self._last_seq = 0
+
+            commands.append(command)
+
+        del self._buffer[:self._pos]
+        self._pos = 0
+        return commands
+
+    def _next_v1(self):
+        start = self._buffer.find(StartFlag, self._pos)
+        if start < 0:
+            self._pos = len(self._buffer)
+            return None
+        self._pos = start
+
+        if len(self._buffer) - start < 3:
+            return None
+
+        command_id = self._buffer[start + 1]
+        size = self._buffer[start + 2]
+
+        if command_id == GetLayout:
+            # Version 1 sends the commander count in place of the
+            # size. Walk the layout to find the end of it.
+            end = start + 3
+            for _ in range(size):
+                if end >= len(self._buffer):
+                    return None
+                end += 1 + self._buffer[end]
+
+            if end > len(self._buffer):
+                return None
+
+            payload = bytes([size]) + bytes(self._buffer[start + 3:end])
+        else:
+            end = start + 3 + size
+            if end > len(self._buffer):
+                return None
+            payload = bytes(self._buffer[start + 3:end])
+
+        self._pos = end
+        return Command(command_id, payload)
+
+    def _next_v2(self):
+        end = self._buffer.find(0, self._pos)
+        if end < 0:
+            return None
+
+        block = bytes(self._buffer[self._pos:end])
+
+        if block[:2] == bytes([StartFlag, Hello]):
+            # A v1 Hello can show up at any frame boundary, read
+            # it again as v1
+            self.version = 1
+            return False
+
+        self._pos = end + 1
+
+        if not block:
+            return False
+
+        body = cobs_decode(block)
+        if body is None or len(body) < HeaderSize + 2:
+            self.errors += 1
+            return False
+
+        crc, = struct.unpack('<H', body[-2:])
+        body = body[:-2]
+        version, seq, ack, command_id, size = struct.unpack(
+            HeaderFormat, body[:HeaderSize]
+        )
+
+        if crc != crc16(body) or size != len(body) - HeaderSize:
+            self.errors += 1
+            return False
+
+        if self._last_seq and seq != (self._last_seq % 255) + 1:
+            self.errors += 1
+        self._last_seq = seq
+
+        return Command(command_id, body[HeaderSize:], seq, ack)
+
+
+class Link(object):
+    """
+    Framed access to a controller over a serial.Serial. This keeps
+    track of the negotiated protocol version and our sequence
+    numbers.
+    """
+    def __init__(self, serial):
+        self.serial = serial
+        self.decoder = FrameDecoder()
+        self._seq = 0
+
+    @property
+    def version(self):
+        return self.decoder.version
+
+    def next_seq(self):
+        self._seq = (self._seq % 255) + 1
+        return self._seq
+
+    def request(self, command, payload):
+        """
+        Send a command to the controller
+
+        :return: ``int`` the sequence number used (0 for v1)
+        """
+        seq = self.next_seq() if self.version >= 2 else 0
+        request(self.serial, command, payload, self.version, seq)
+        return seq
+
+    def read(self):
+        """
+        :return: ``list[Command]`` everything that's complete
+        """
+        data = self.serial.read(self.serial.in_waiting or 1)
+        if not data:
+            return []
+        return self.decoder.feed(data)
+
+    def wait_for(self, command_id, timeout=1.0):
+        """
+        Block until a command with the given id shows up. Anything
+        else received in the meantime is returned alongside it.
+
+        :return: ``tuple(Command|None, list[Command])``
+        """
+        others = []
+        deadline = time.monotonic() + timeout
+
+        while time.monotonic() < deadline:
+            for command in self.read():
+                if command.id == command_id:
+                    return command, others
+                others.append(command)
+
+        return None, others
+
+    def handshake(self, timeout=0.25):
+        """
+        Ask the controller for protocol v2. A controller that doesn't
+        know about Hello never answers and we carry on with v1.
+
+        :return: ``int`` the protocol version in use
+        """
+        self.hello()
+        self.wait_for(Hello, timeout)
+        self._seq = 0
+        return self.version
+
+    def hello(self):
+        """
+        Send the Hello of a handshake without waiting for the answer.
+        The decoder moves to the new version when it comes.
+
+        :return: ``int`` 0, Hello always goes out as v1
+        """
+        self.decoder.reset()
+        self._seq = 0
+
+        # The leading zero ends any half-sent v2 frame so the Hello
+        # lands on a frame boundary
+        self.serial.write(
+            b'\x00' + encode_frame(Hello, ProtocolVersion)
+        )
+        return 0
+
+
+def parse_dump(payload):
+    """
+    Split a mk.DumpAll payload up
+
+    :return: ``list[list[tuple(int, bytes)]]`` for each commander, the
+        type and preferences of each interface. Remote modules leave
+        their preferences empty.
+    """
+    commanders = []
+    if not payload:
+        return commanders
+
+    offset = 1
+    for _ in range(payload[0]):
+        count = payload[offset]
+        offset += 1
+
+        interfaces = []
+        for _ in range(count):
+            type_, size = payload[offset], payload[offset + 1]
+            offset += 2
+
+            interfaces.append((type_, bytes(payload[offset:offset + size])))
+            offset += size
+
+        commanders.append(interfaces)
+
+    return commanders
+
+
+def parse_profile(payload):
+    """
+    :return: ``tuple(int, int)`` the layout and preferences hashes from
+        a mk.Profile answer
+    """
+    return struct.unpack('<II', payload[:8])
+
+
+# In mk::ProbeId order
+ProbeNames = [
+    'loop',
+    'shift_in',
+    'keys',
+    'pot',
+    'poll',
+    'serial',
+    'usb_out',
+    'usb_in',
+]
+
+
+class ProbeReport(object):
+    """
+    The histograms from a mk.GetProbes reply. Bucket i of a probe
+    counts samples of [2^i, 2^(i+1)) ticks.
+    """
+    def __init__(self, payload):
+        self.ticks_per_us = 1
+        self.probes = {}
+
+        if len(payload) < 4:
+            return # Built without probes
+
+        self.ticks_per_us, count, buckets = struct.unpack(
+            '<HBB', payload[:4]
+        )
+
+        fmt = '<II{}H'.format(buckets)
+        size = struct.calcsize(fmt)
+
+        offset = 4
+        for i in range(count):
+            values = struct.unpack(fmt, payload[offset:offset + size])
+            offset += size
+
+            name = ProbeNames[i] if i < len(ProbeNames) else str(i)
+            self.probes[name] = {
+                'count': values[0],
+                'max': values[1],
+                'buckets': list(values[2:]),
+            }
+
+    def percentile(self, name, fraction):
+        """
+        :return: ``float`` upper bound (us) of the bucket holding
+            the given fraction of a probe's samples
+        """
+        buckets = self.probes[name]['buckets']
+        total = sum(buckets)
+        if not total:
+            return 0.0
+
+        seen = 0
+        for i, count in enumerate(buckets):
+            seen += count
+            if seen >= total * fraction:
+                return (2 ** (i + 1)) / self.ticks_per_us
+        return (2 ** len(buckets)) / self.ticks_per_us
+
+    def summary(self):
+        """
+        :return: ``dict`` count, p50, p99 and max (us) for each probe
+        """
+        return {
+            name: {
+                'count': probe['count'],
+                'p50': self.percentile(name, 0.50),
+                'p99': self.percentile(name, 0.99),
+                'max': probe['max'] / self.ticks_per_us,
+            }
+            for name, probe in self.probes.items()
+        }
+
+
+class RecorderDump(object):
+    """
+    The flight recorder ring from a mk.Recorder dump. Times are in
+    microseconds, relative to the first entry.
+    """
+    # RecordKind
+    Edge = 1
+    Event = 2
+    Usb = 3
+    Trigger = 4
+
+    # RecorderOp, the first byte of a mk.Recorder request
+    Dump = 0
+    Arm = 1
+    Freeze = 2
+
+    TriggerNames = {
+        0: 'none',
+        1: 'host',
+        2: 'stuck_note',
+        3: 'overflow',
+    }
+
+    HeaderFormat = '<HHBBB'
+    EntryFormat = '<IB7s'
+
+    def __init__(self, payload):
+        self.ticks_per_us = 1
+        self.trigger = 'none'
+        self.trigger_arg = 0
+        self.frozen = False
+
+        # (time us, kind, data bytes)
+        self.entries = []
+
+        header = struct.calcsize(self.HeaderFormat)
+        if len(payload) < header:
+            return # Built without the recorder
+
+        self.ticks_per_us, count, trigger, self.trigger_arg, frozen = \
+            struct.unpack(self.HeaderFormat, payload[:header])
+        self.trigger = self.TriggerNames.get(trigger, str(trigger))
+        self.frozen = bool(frozen)
+
+        size = struct.calcsize(self.EntryFormat)
+        start = None
+        for i in range(count):
+            offset = header + i * size
+            ticks, kind, data = struct.unpack(
+                self.EntryFormat, payload[offset:offset + size]
+            )
+            if start is None:
+                start = ticks
+
+            # Ticks wrap, differences don't mind
+            time = ((ticks - start) & 0xFFFFFFFF) / self.ticks_per_us
+            self.entries.append((time, kind, data))
+
+    @staticmethod
+    def request(op):
+        """
+        :return: ``bytes`` payload for mk.Recorder
+        """
+        return struct.pack('<B', op)
+
+    def latencies(self):
+        """
+        Follow each key press from the shift register edge to the
+        note-on that went out over USB. Presses come out in the order
+        they went in, so they're matched first in, first out.
+
+        :return: ``list`` of dict note, edge_us, event_us, usb_us,
+            total_us
+        """
+        last_edge = {}
+        presses = []
+        notes = []
+
+        for time, kind, data in self.entries:
+            if kind == self.Edge:
+                last_edge[data[0]] = time
+
+            elif kind == self.Event and data[0] == KEY_EVENT_ID:
+                # type | address | key | velocity | pressed
+                if data[4]:
+                    presses.append((last_edge.get(data[1], time), time))
+
+            elif kind == self.Usb and (data[0] & 0xF0) == 0x90 and data[2]:
+                if not presses:
+                    continue # Pressed before the ring starts
+                edge, event = presses.pop(0)
+                notes.append({
+                    'note': data[1],
+                    'edge_us': edge,
+                    'event_us': event,
+                    'usb_us': time,
+                    'total_us': time - edge,
+                })
+
+        return notes
+
+
+# Written ahead of the records in a trace file (see mk_trace.h)
+TraceMagic = b'MKTR'
+TraceVersion = 2
+
+
+class TelemetryFrame(object):
+    """
+    A mk::TelemetryFrame pushed by the controller every interval
+    once asked for with mk.Telemetry
+    """
+    Format = '<HHHIIIIHHBBHHBBHIIIH'
+    Fields = (
+        'interval', 'loops', 'loop_max', 'scan', 'poll', 'usb',
+        'serial', 'poll_max', 'events', 'events_high', 'pool_high',
+        'dropped', 'rx_errors', 'modules', 'connections', 'missed',
+        'busy_high', 'busy_normal', 'busy_low', 'late_max'
     )
 
-    serial.write(request)
+    def __init__(self, payload):
+        # Older firmware stops short of missed or the task times
+        size = struct.calcsize(self.Format)
+        payload = bytes(payload[:size]).ljust(size, b'\0')
+
+        values = struct.unpack(self.Format, payload)
+        for name, value in zip(self.Fields, values):
+            setattr(self, name, value)
+
+    @staticmethod
+    def request(interval_ms):
+        """
+        :return: ``bytes`` payload for mk.Telemetry, 0 stops frames
+        """
+        return struct.pack('<H', interval_ms)
+
+    def _share(self, us):
+        """
+        :return: ``float`` percent of the interval spent
+        """
+        if not self.interval:
+            return 0.0
+        return 100.0 * us / (self.interval * 1000.0)
+
+    @property
+    def loop_rate(self):
+        """ Runtime passes per second """
+        return self.loops * 1000.0 / max(self.interval, 1)
+
+    @property
+    def events_per_second(self):
+        return self.events * 1000.0 / max(self.interval, 1)
+
+    @property
+    def scan_share(self):
+        return self._share(self.scan)
+
+    @property
+    def poll_share(self):
+        return self._share(self.poll)
+
+    @property
+    def usb_share(self):
+        return self._share(self.usb)
+
+    @property
+    def serial_share(self):
+        return self._share(self.serial)
+
+    @property
+    def busy_shares(self):
+        """
+        :return: ``tuple(high, normal, low)`` percent of the interval
+            the scheduler spent in tasks of each priority
+        """
+        return (
+            self._share(self.busy_high),
+            self._share(self.busy_normal),
+            self._share(self.busy_low),
+        )
+
+
+class MonitorFrame(object):
+    """
+    A mk.Monitor frame, the MIDI the controller sent since the last
+    one. Each record is (time us, latency us, source, status, data1,
+    data2). Latency is how long the event sat pooled on the
+    controller, it tops out at 65535.
+    """
+    HeaderFormat = '<H'
+    RecordFormat = '<IHBBBB'
+    RecordSize = struct.calcsize(RecordFormat)
+
+    def __init__(self, payload):
+        self.lost = 0
+        self.records = []
+
+        header = struct.calcsize(self.HeaderFormat)
+        if len(payload) < header:
+            return # Built without the monitor
+
+        self.lost, = struct.unpack(self.HeaderFormat, payload[:header])
+
+        for offset in range(header, len(payload) - self.RecordSize + 1, self.RecordSize):
+            self.records.append(struct.unpack(
+                self.RecordFormat, payload[offset:offset + self.RecordSize]
+            ))
+
+    @staticmethod
+    def request(on):
+        """
+        :return: ``bytes`` payload for mk.Monitor
+        """
+        return struct.pack('<B', 1 if on else 0)
+
+
+class MonitorStats(object):
+    """
+    Rates and latencies over a run of mk.MonitorFrame records, overall
+    and for each source (commander address)
+    """
+    def __init__(self):
+        self.clear()
+
+    def clear(self):
+        self.lost = 0
+        self._first = None
+        self._last = None
+        self._latencies = {} # source -> list[us]
+
+    def add(self, frame):
+        self.lost += frame.lost
+        for time, latency, source, _, _, _ in frame.records:
+            if self._first is None:
+                self._first = time
+            self._last = time
+            self._latencies.setdefault(source, []).append(latency)
+
+    @property
+    def seconds(self):
+        """ Device time the records cover """
+        if self._first is None:
+            return 0.0
+        return ((self._last - self._first) & 0xFFFFFFFF) / 1e6
+
+    @staticmethod
+    def _summary(latencies, seconds):
+        latencies = sorted(latencies)
+        pick = lambda f: latencies[min(len(latencies) - 1, int(f * len(latencies)))]
+        return {
+            'events': len(latencies),
+            'per_second': len(latencies) / seconds if seconds else 0.0,
+            'p50_us': pick(0.50),
+            'p99_us': pick(0.99),
+            'max_us': latencies[-1],
+        }
+
+    def summary(self):
+        """
+        :return: ``dict`` with the overall numbers and a ``sources``
+            dict of the same for each source
+        """
+        everything = [l for ls in self._latencies.values() for l in ls]
+        if not everything:
+            return {'events': 0, 'lost': self.lost, 'sources': {}}
+
+        seconds = self.seconds
+        result = self._summary(everything, seconds)
+        result['lost'] = self.lost
+        result['sources'] = {
+            source: self._summary(latencies, seconds)
+            for source, latencies in sorted(self._latencies.items())
+        }
+        return result
+
+
+class LogTable(object):
+    """
+    Turns mk.Log records (id | arg | arg) back into the messages
+    listed in the firmware's mk_log.def
+    """
+    RecordFormat = '<HHH'
+    RecordSize = struct.calcsize(RecordFormat)
+
+    DefaultPath = os.path.join(
+        os.path.dirname(os.path.abspath(__file__)),
+        '..', '..', 'lib', 'MidiKiti', 'mk_log.def'
+    )
+
+    _Entry = re.compile(
+        r'^\s*MK_LOG_MESSAGE\(\s*(\w+)\s*,\s*(\d+)\s*,\s*"(.*)"\s*\)'
+    )
+
+    def __init__(self, path=None):
+        # id -> (name, format)
+        self.messages = {}
+
+        with open(path or self.DefaultPath, 'r') as f:
+            for line in f:
+                match = self._Entry.match(line)
+                if match:
+                    name, id_, format_ = match.groups()
+                    self.messages[int(id_)] = (name, format_)
+
+    _default = None
+
+    @classmethod
+    def default(cls):
+        """
+        :return: ``LogTable`` for the firmware in this checkout
+        """
+        if cls._default is None:
+            cls._default = cls()
+        return cls._default
+
+    def records(self, payload):
+        """
+        :return: ``list`` of (id, args) in the order they were logged
+        """
+        count = len(payload) // self.RecordSize
+        return [
+            (values[0], values[1:])
+            for values in struct.iter_unpack(
+                self.RecordFormat, payload[:count * self.RecordSize]
+            )
+        ]
+
+    def format(self, id_, args):
+        if id_ not in self.messages:
+            return f'Unknown log message {id_} {args}'
+
+        _, format_ = self.messages[id_]
+        try:
+            return format_.format(*args)
+        except (IndexError, ValueError):
+            return f'{format_} {args}'
+
+    def decode(self, payload):
+        """
+        :return: ``list`` of message strings
+        """
+        return [self.format(*r) for r in self.records(payload)]
 
 
 class _unit:
@@ -95,6 +887,35 @@ class _Struct:
         return fmt
 
 
+    @classmethod
+    def fields(cls):
+        """
+        Where each value sits in the packed structure, not counting
+        the parameter type in front of it
+
+        :return: ``list[tuple(str, int, int)]`` name, offset and size
+        """
+        fields = []
+        offset = 0
+        for name, attr in vars(cls).items():
+            if isinstance(attr, _unit):
+                size = struct.calcsize('<' + attr.key)
+                fields.append((name, offset, size))
+                offset += size
+        return fields
+
+
+    def pack(self):
+        """
+        :return: ``bytes`` the values the way the firmware holds them
+        """
+        return struct.pack('<' + self.format(), *(
+            getattr(self, name)
+            for name, attr in vars(self.__class__).items()
+            if isinstance(attr, _unit)
+        ))
+
+
 class PotParameters(_Struct):
     """
     Parameters for a pot
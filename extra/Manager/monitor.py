@@ -0,0 +1,156 @@
+from PySide6 import QtWidgets, QtCore
+Qt = QtCore.Qt
+
+import mk
+from telemetry import TelemetryPlot
+
+
+class MonitorPanel(QtWidgets.QWidget):
+    """
+    Live view of the MIDI the controller sends, from its mk.Monitor
+    frames. Every refresh shows how many events went out, how long
+    they waited on the controller and the same for each source, so a
+    module falling behind under load stands out.
+    """
+    request = QtCore.Signal(int, bytes)
+
+    # ms between refreshes, each covers what came in since the last
+    Refresh = 500
+
+    Columns = ['Source', 'Events/s', 'p50 us', 'p99 us', 'Max us']
+
+    def __init__(self, parent=None):
+        super().__init__(parent)
+
+        self._stats = mk.MonitorStats()
+        self._total = 0
+        self._lost = 0
+
+        layout = QtWidgets.QVBoxLayout()
+        header = QtWidgets.QHBoxLayout()
+
+        self._enabled = QtWidgets.QCheckBox("Monitor")
+        self._enabled.toggled.connect(self._send_enabled)
+        header.addWidget(self._enabled)
+
+        header.addStretch()
+
+        self._status = QtWidgets.QLabel()
+        header.addWidget(self._status)
+
+        layout.addLayout(header)
+
+        self._rate = TelemetryPlot("Events", "/s")
+        self._rate.add_series('sent', '#81c784')
+        self._rate.add_series('lost', '#e57373')
+        layout.addWidget(self._rate)
+
+        self._latency = TelemetryPlot("Queue latency", "us")
+        self._latency.add_series('p50', '#4fc3f7')
+        self._latency.add_series('p99', '#ffb74d')
+        self._latency.add_series('max', '#e57373')
+        layout.addWidget(self._latency)
+
+        self._sources = QtWidgets.QTableWidget(0, len(self.Columns))
+        self._sources.setHorizontalHeaderLabels(self.Columns)
+        self._sources.verticalHeader().setVisible(False)
+        self._sources.horizontalHeader().setSectionResizeMode(
+            QtWidgets.QHeaderView.Stretch
+        )
+        self._sources.setEditTriggers(QtWidgets.QAbstractItemView.NoEditTriggers)
+        layout.addWidget(self._sources)
+
+        self.setLayout(layout)
+
+        self._timer = QtCore.QTimer(self)
+        self._timer.setInterval(self.Refresh)
+        self._timer.timeout.connect(self._refresh)
+
+    @QtCore.Slot()
+    def _send_enabled(self, *args):
+        on = self._enabled.isChecked()
+        if on:
+            self._stats.clear()
+            self._total = 0
+            self._lost = 0
+            for plot in (self._rate, self._latency):
+                plot.clear()
+            self._sources.setRowCount(0)
+            self._timer.start()
+        else:
+            self._timer.stop()
+
+        self.request.emit(mk.Monitor, mk.MonitorFrame.request(on))
+
+    def stop(self):
+        """
+        Turn the mirror off. The controller forgets when it restarts.
+        """
+        self._enabled.setChecked(False)
+
+    @QtCore.Slot(list)
+    def process_commands(self, commands):
+        """
+        A batch from the protocol. Frames are only counted here, the
+        view catches up on the next refresh.
+        """
+        for command in commands:
+            if command.id == mk.Monitor:
+                self._stats.add(mk.MonitorFrame(command.payload))
+
+    @QtCore.Slot()
+    def _refresh(self):
+        summary = self._stats.summary()
+        self._stats.clear()
+
+        seconds = self.Refresh / 1000.0
+        self._total += summary['events']
+        self._lost += summary['lost']
+
+        self._rate.push('sent', summary['events'] / seconds)
+        self._rate.push('lost', summary['lost'] / seconds)
+        self._latency.push('p50', summary.get('p50_us', 0))
+        self._latency.push('p99', summary.get('p99_us', 0))
+        self._latency.push('max', summary.get('max_us', 0))
+
+        for plot in (self._rate, self._latency):
+            plot.update()
+
+        # Sources stay listed once seen, quiet ones drop to zero
+        for source, numbers in summary['sources'].items():
+            row = self._row(source)
+            values = [
+                numbers['events'] / seconds,
+                numbers['p50_us'],
+                numbers['p99_us'],
+                numbers['max_us'],
+            ]
+            for column, value in enumerate(values, 1):
+                self._sources.item(row, column).setText(f'{value:.0f}')
+
+        seen = set(summary['sources'])
+        for row in range(self._sources.rowCount()):
+            if self._sources.item(row, 0).data(Qt.UserRole) not in seen:
+                for column in range(1, len(self.Columns)):
+                    self._sources.item(row, column).setText('0')
+
+        self._status.setText(f'{self._total} events | lost {self._lost}')
+
+    def _row(self, source):
+        """
+        :return: ``int`` the table row for source, added if it's new
+        """
+        for row in range(self._sources.rowCount()):
+            if self._sources.item(row, 0).data(Qt.UserRole) == source:
+                return row
+
+        row = self._sources.rowCount()
+        self._sources.insertRow(row)
+
+        item = QtWidgets.QTableWidgetItem(f'0x{source:02x}')
+        item.setData(Qt.UserRole, source)
+        self._sources.setItem(row, 0, item)
+        for column in range(1, len(self.Columns)):
+            self._sources.setItem(row, column, QtWidgets.QTableWidgetItem('0'))
+
+        return row
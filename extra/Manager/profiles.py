@@ -0,0 +1,67 @@
+"""
+What the Manager remembers about controllers it has seen, so the
+window can fill in as soon as one is plugged back in.
+
+A profile is saved for each layout hash (what mk.Profile answers
+with, the same hash the firmware keeps its snapshots under) along
+with the hash of the local preferences at the time. Both matching
+means nothing local has changed since.
+"""
+import json
+import os
+
+
+class ProfileCache(object):
+    """
+    One JSON file a profile:
+
+        {
+            "layout": 305419896,
+            "preferences": 2271560481,
+            "commanders": [[{"type": 242, "remote": false, "raw": "f200..."}]]
+        }
+    """
+    DefaultPath = os.path.join(os.path.expanduser('~'), '.midikiti', 'profiles')
+
+    def __init__(self, path=None):
+        self._path = path or self.DefaultPath
+
+    def _file(self, layout_hash):
+        return os.path.join(self._path, f'{layout_hash:08x}.json')
+
+    def load(self, layout_hash):
+        """
+        :return: ``dict`` the profile, None if we've not seen the
+            layout before (or the file is no good)
+        """
+        try:
+            with open(self._file(layout_hash)) as f:
+                profile = json.load(f)
+        except (OSError, ValueError):
+            return None
+
+        if profile.get('layout') != layout_hash:
+            return None
+        return profile
+
+    def save(self, layout_hash, preferences_hash, commanders):
+        """
+        :param commanders: ``list[list[dict]]`` from
+            :meth:`MidiLayout.to_profile`
+        """
+        profile = {
+            'layout': layout_hash,
+            'preferences': preferences_hash,
+            'commanders': commanders,
+        }
+
+        try:
+            os.makedirs(self._path, exist_ok=True)
+
+            # Written aside and moved over so a crash can't leave half a file
+            path = self._file(layout_hash)
+            with open(path + '.tmp', 'w') as f:
+                json.dump(profile, f, indent=2)
+            os.replace(path + '.tmp', path)
+        except OSError as err:
+            print(f'[PROFILE]: Not saved, {err}')
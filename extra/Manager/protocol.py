@@ -1,3 +1,5 @@
+import threading
+
 from PySide6 import QtCore
 Qt = QtCore.Qt
 
@@ -5,108 +7,178 @@ import serial
 import serial.threaded
 
 import mk
+from mk import Command
+
+
+class _FrameReader(serial.threaded.Protocol):
+    """
+    Runs on the serial.threaded.ReaderThread. Whatever the port hands
+    us goes straight through the link's decoder.
+    """
+    def __init__(self, protocol):
+        self._protocol = protocol
+
+    def data_received(self, data):
+        commands = self._protocol.link.decoder.feed(data)
+        if commands:
+            self._protocol._post(commands)
+
+    def connection_lost(self, exc):
+        self._protocol._lost(exc)
+
 
-class Command(object):
+class _Pending(object):
     """
-    Mirror the mk::Commmand structure to handle packets of
-    variable size. These are then tranlated to the correct
-    object type based on the id
+    A request waiting on its answer
     """
-    def __init__(self):
-        # The id of the command (e.g. mk.GetPreferences)
-        self.id = None
+    def __init__(self, command, payload, on_reply, on_timeout, retries, match):
+        self.command = command
+        self.payload = payload
+        self.on_reply = on_reply
+        self.on_timeout = on_timeout
+        self.retries = retries
+        self.match = match
+        self.seq = 0
+        self.timer = None
 
-        # The total size of the payload
-        self.size = None
+    def answered_by(self, command):
+        if command.id != self.command:
+            return False
 
-        # The payload itself (in bytes)
-        self.payload = None
+        # v2 answers carry our sequence number, v1 ones only the id
+        if self.seq and command.ack != self.seq:
+            return False
+
+        return self.match is None or self.match(command)
 
 
 class MidiKitiProtocol(QtCore.QObject):
     """
-    Class designed to be run on a thread to handle transmitting data
-    and then handling it on the main thread via a connection
+    Reads from the controller on a thread of its own and hands the
+    commands over to the main thread in batches. However fast they
+    arrive there's at most one batch waiting on the event loop, the
+    next one is everything that came in while it waited.
     """
-    received = QtCore.Signal(Command)
+    received = QtCore.Signal(list) # list[Command], oldest first
+    lost = QtCore.Signal(str)
 
-    def __init__(self, controller, lock, parent=None):
-        super().__init__(parent)
-        self._lock = lock
-        self._controller = controller
-        self._command = None
+    _ready = QtCore.Signal()
 
-        self._buffer = []
-        self._payload_index = 0
- 
+    def __init__(self, link, parent=None):
+        super().__init__(parent)
+        self.link = link
         self.error = None
 
-    @QtCore.Slot()
-    def execute(self):
+        self._pending = []
+        self._pending_lock = threading.Lock()
+        self._write_lock = threading.Lock()
+        self._reader = None
+        self._calls = []
+
+        self._ready.connect(self._flush, Qt.QueuedConnection)
+
+    def start(self):
         """
-        The primary runtime of the thread. This is where we
-        receive data and transmit that over a the received()
-        signal.
+        Start reading. Anything the link hasn't handed out yet (from
+        the handshake) is kept.
         """
-        data = None
-
-        # Critical Section
-        with self._lock:
-            if not self._controller.is_open:
-                return # We've closed the controller!
-            
-            # Read everything into our buffer. We have a 
-            # proper computer, so we're not worried about
-            # overflow here.
-            try:
-                data = self._controller.read(
-                    self._controller.in_waiting or 1
-                )
-            except serial.SerialException as err:
-                self.error = err
-                return
-
-        if not data:
-            # If we're not doing anything on the line
-            # give ourselves a heartbeat to avoid over
-            # tapping. 10ms should do it.
-            QtCore.QThread.msleep(10)
-
-        for byte in data:
-
-            if self._command is None:
-                if byte == mk.StartFlag:
-                    self._command = Command()
-                    self._command.id = mk.StartFlag
-                    self._command.size = mk.StartFlag
-            
-            elif self._command.id == mk.StartFlag:
-                self._command.id = byte
-
-            elif self._command.size == mk.StartFlag:
-                self._command.size = byte
+        self._reader = serial.threaded.ReaderThread(
+            self.link.serial,
+            lambda: _FrameReader(self)
+        )
+        self._reader.start()
 
-            else:
-                self._buffer.append(byte)
-                self._payload_index += 1
+    def stop(self):
+        """
+        Stop reading and close the port
+        """
+        if self._reader:
+            self._reader.close()
+            self._reader = None
+
+        for pending in list(self._calls):
+            self._finish(pending)
+
+    def _post(self, commands):
+        # Reader thread
+        with self._pending_lock:
+            waiting = bool(self._pending)
+            self._pending.extend(commands)
 
-                if self._payload_index >= self._command.size:
-                    
-                    # We've obtained a complete command.
-                    self._command.payload = bytes(self._buffer)
-                    self.received.emit(self._command)
+        if not waiting:
+            self._ready.emit()
 
-                    self._command = None
-                    self._buffer = []
-                    self._payload_index = 0
+    def _lost(self, exc):
+        # Reader thread
+        if exc is not None:
+            self.error = exc
+            self.lost.emit(str(exc))
 
-        # If we're here, we want to queue up this process for
-        # the another pass in the event loop. This allows us
-        # to process other connections (e.g. request(...))
-        # while repeating this process. This also makes
-        # cleanup quite trivial as well
-        QtCore.QTimer.singleShot(0, self.execute)
+    @QtCore.Slot()
+    def _flush(self):
+        with self._pending_lock:
+            commands, self._pending = self._pending, []
+
+        # Answers to call()s go to whoever asked, not to received
+        if self._calls:
+            commands = [c for c in commands if not self._answer(c)]
 
+        if commands:
+            self.received.emit(commands)
+
+    def call(self, command, payload, on_reply, on_timeout=None,
+             timeout=0.5, retries=2, match=None):
+        """
+        Send a request and hand its answer to on_reply(Command), all
+        on the main thread. A request that isn't answered in time is
+        sent again, retries times, before on_timeout() is called.
+
+        :param match: ``callable(Command) -> bool`` for telling apart
+            answers a v1 controller sends without a sequence number
+        """
+        pending = _Pending(command, payload, on_reply, on_timeout, retries, match)
+
+        pending.timer = QtCore.QTimer(self)
+        pending.timer.setSingleShot(True)
+        pending.timer.setInterval(int(timeout * 1000))
+        pending.timer.timeout.connect(lambda: self._expired(pending))
+
+        self._calls.append(pending)
+        self._send(pending)
+
+    def _send(self, pending):
+        with self._write_lock:
+            if pending.command == mk.Hello:
+                pending.seq = self.link.hello()
+            else:
+                pending.seq = self.link.request(pending.command, pending.payload)
+        pending.timer.start()
+
+    def _answer(self, command):
+        for pending in self._calls:
+            if pending.answered_by(command):
+                self._finish(pending)
+                pending.on_reply(command)
+                return True
+        return False
+
+    def _expired(self, pending):
+        if pending not in self._calls:
+            return
+
+        if pending.retries > 0:
+            pending.retries -= 1
+            self._send(pending)
+            return
+
+        self._finish(pending)
+        if pending.on_timeout:
+            pending.on_timeout()
+
+    def _finish(self, pending):
+        pending.timer.stop()
+        pending.timer.deleteLater()
+        self._calls.remove(pending)
 
     @QtCore.Slot(int, bytes)
     def request(self, command, payload):
@@ -116,7 +188,10 @@ class MidiKitiProtocol(QtCore.QObject):
         us from a synchronous response cycle but makes for
         much nicer scale of functionality.
         """
-        with self._lock:
-            mk.request(self._controller, command, payload)
+        if self.error is not None:
+            return # The port's gone, we're waiting to reconnect
+
+        with self._write_lock:
+            self.link.request(command, payload)
 
         print (" >> Req: ", command, payload)
@@ -0,0 +1,293 @@
+from PySide6 import QtWidgets, QtCore, QtGui
+Qt = QtCore.Qt
+
+import collections
+
+import mk
+from mk import Command
+
+# How many frames each plot keeps
+HistoryLength = 240
+
+
+class TelemetryPlot(QtWidgets.QWidget):
+    """
+    A small strip chart. Each series is a line scaled to the plot's
+    range (or the largest value seen when it has none).
+    """
+    def __init__(self, title, unit, maximum=None, parent=None):
+        super().__init__(parent)
+        self._title = title
+        self._unit = unit
+        self._maximum = maximum
+
+        # name -> (color, deque)
+        self._series = collections.OrderedDict()
+
+        self.setMinimumHeight(110)
+        self.setSizePolicy(
+            QtWidgets.QSizePolicy.MinimumExpanding,
+            QtWidgets.QSizePolicy.Preferred
+        )
+
+    def add_series(self, name, color):
+        self._series[name] = (
+            QtGui.QColor(color),
+            collections.deque(maxlen=HistoryLength)
+        )
+
+    def push(self, name, value):
+        self._series[name][1].append(value)
+
+    def clear(self):
+        for _, values in self._series.values():
+            values.clear()
+        self.update()
+
+    def _top(self):
+        if self._maximum is not None:
+            return self._maximum
+
+        top = 0
+        for _, values in self._series.values():
+            if values:
+                top = max(top, max(values))
+        return top or 1
+
+    def paintEvent(self, event):
+        painter = QtGui.QPainter(self)
+        painter.setRenderHint(QtGui.QPainter.Antialiasing)
+
+        rect = self.rect().adjusted(4, 18, -4, -4)
+        painter.fillRect(self.rect(), QtGui.QColor(15, 15, 15))
+
+        # Grid
+        painter.setPen(QtGui.QPen(QtGui.QColor(45, 45, 45), 1))
+        for i in range(1, 4):
+            y = rect.top() + rect.height() * i / 4.0
+            painter.drawLine(
+                QtCore.QPointF(rect.left(), y),
+                QtCore.QPointF(rect.right(), y)
+            )
+
+        top = self._top()
+        step = rect.width() / float(HistoryLength - 1)
+
+        # Title, scale and the latest value of each series
+        painter.setPen(QtGui.QColor(200, 200, 200))
+        painter.drawText(
+            4, 13, f'{self._title} (0 - {top:.0f} {self._unit})'
+        )
+
+        x = rect.right()
+        for name, (color, values) in reversed(self._series.items()):
+            latest = values[-1] if values else 0
+            text = f'{name} {latest:.1f}'
+            width = painter.fontMetrics().horizontalAdvance(text)
+            x -= width + 10
+            painter.setPen(color)
+            painter.drawText(x, 13, text)
+
+        for color, values in self._series.values():
+            if len(values) < 2:
+                continue
+
+            # Newest on the right
+            start = HistoryLength - len(values)
+            path = QtGui.QPainterPath()
+            for i, value in enumerate(values):
+                point = QtCore.QPointF(
+                    rect.left() + (start + i) * step,
+                    rect.bottom() - rect.height() * min(value / top, 1.0)
+                )
+                if i == 0:
+                    path.moveTo(point)
+                else:
+                    path.lineTo(point)
+
+            painter.setPen(QtGui.QPen(color, 1.5))
+            painter.drawPath(path)
+
+        painter.end()
+
+
+class TelemetryPanel(QtWidgets.QWidget):
+    """
+    Live view of the controller's mk.Telemetry frames. Split into
+    where the time goes (scan, bus, usb) and what's flowing through.
+    """
+    request = QtCore.Signal(int, bytes)
+
+    Intervals = [100, 250, 500, 1000]
+
+    def __init__(self, parent=None):
+        super().__init__(parent)
+
+        layout = QtWidgets.QVBoxLayout()
+        header = QtWidgets.QHBoxLayout()
+
+        self._enabled = QtWidgets.QCheckBox("Telemetry")
+        self._enabled.toggled.connect(self._send_interval)
+        header.addWidget(self._enabled)
+
+        self._interval = QtWidgets.QComboBox()
+        for interval in self.Intervals:
+            self._interval.addItem(f'{interval} ms', interval)
+        self._interval.setCurrentIndex(1)
+        self._interval.currentIndexChanged.connect(self._send_interval)
+        header.addWidget(self._interval)
+
+        self._dump = QtWidgets.QPushButton("Dump Recorder")
+        self._dump.clicked.connect(self._dump_recorder)
+        header.addWidget(self._dump)
+
+        header.addStretch()
+
+        self._status = QtWidgets.QLabel()
+        header.addWidget(self._status)
+
+        layout.addLayout(header)
+
+        self._time = TelemetryPlot("Time", "%", maximum=100)
+        self._time.add_series('scan', '#4fc3f7')
+        self._time.add_series('bus', '#ffb74d')
+        self._time.add_series('usb', '#81c784')
+        self._time.add_series('serial', '#ba68c8')
+        layout.addWidget(self._time)
+
+        self._loop = TelemetryPlot("Loop", "us")
+        self._loop.add_series('period', '#4fc3f7')
+        self._loop.add_series('longest', '#e57373')
+        self._loop.add_series('poll max', '#ffb74d')
+        layout.addWidget(self._loop)
+
+        self._flow = TelemetryPlot("Events", "")
+        self._flow.add_series('per sec', '#81c784')
+        self._flow.add_series('pass high', '#ffb74d')
+        self._flow.add_series('pool high', '#e57373')
+        layout.addWidget(self._flow)
+
+        self._tasks = TelemetryPlot("Tasks", "%", maximum=100)
+        self._tasks.add_series('high', '#e57373')
+        self._tasks.add_series('normal', '#ffb74d')
+        self._tasks.add_series('low', '#4fc3f7')
+        layout.addWidget(self._tasks)
+
+        self.setLayout(layout)
+
+    @QtCore.Slot()
+    def _send_interval(self, *args):
+        interval = 0
+        if self._enabled.isChecked():
+            interval = self._interval.currentData()
+        else:
+            for plot in (self._time, self._loop, self._flow, self._tasks):
+                plot.clear()
+
+        self.request.emit(
+            mk.Telemetry,
+            mk.TelemetryFrame.request(interval)
+        )
+
+    @QtCore.Slot()
+    def _dump_recorder(self):
+        self.request.emit(
+            mk.Recorder,
+            mk.RecorderDump.request(mk.RecorderDump.Dump)
+        )
+
+    def _show_recorder(self, dump):
+        """
+        Print what the flight recorder caught and start it again
+        """
+        if not dump.entries:
+            print('[RECORDER]: Nothing recorded')
+            return
+
+        print(
+            f'[RECORDER]: {len(dump.entries)} entries over '
+            f'{dump.entries[-1][0]:.0f} us, trigger {dump.trigger} '
+            f'({dump.trigger_arg})'
+        )
+        for note in dump.latencies():
+            print(
+                f'[RECORDER]:   note {note["note"]} at '
+                f'{note["edge_us"]:.0f} us, edge to event '
+                f'{note["event_us"] - note["edge_us"]:.1f} us, '
+                f'edge to usb {note["total_us"]:.1f} us'
+            )
+
+        self.request.emit(
+            mk.Recorder,
+            mk.RecorderDump.request(mk.RecorderDump.Arm)
+        )
+
+    def stop(self):
+        """
+        Turn frames off. The controller forgets when it restarts.
+        """
+        self._enabled.setChecked(False)
+
+    @QtCore.Slot(list)
+    def process_commands(self, commands):
+        """
+        A batch from the protocol. The plots redraw once for however
+        many frames it had.
+        """
+        updated = False
+        for command in commands:
+            updated = self._take(command) or updated
+
+        if updated:
+            self._redraw()
+
+    @QtCore.Slot(Command)
+    def process_command(self, command):
+        if self._take(command):
+            self._redraw()
+
+    def _redraw(self):
+        for plot in (self._time, self._loop, self._flow, self._tasks):
+            plot.update()
+
+    def _take(self, command):
+        """
+        :return: ``bool`` True when it was a telemetry frame
+        """
+        if command.id == mk.Recorder:
+            self._show_recorder(mk.RecorderDump(command.payload))
+            return False
+
+        if command.id != mk.Telemetry:
+            return False
+
+        frame = mk.TelemetryFrame(command.payload)
+
+        self._time.push('scan', frame.scan_share)
+        self._time.push('bus', frame.poll_share)
+        self._time.push('usb', frame.usb_share)
+        self._time.push('serial', frame.serial_share)
+
+        period = 1000000.0 / frame.loop_rate if frame.loops else 0
+        self._loop.push('period', period)
+        self._loop.push('longest', frame.loop_max)
+        self._loop.push('poll max', frame.poll_max)
+
+        self._flow.push('per sec', frame.events_per_second)
+        self._flow.push('pass high', frame.events_high)
+        self._flow.push('pool high', frame.pool_high)
+
+        high, normal, low = frame.busy_shares
+        self._tasks.push('high', high)
+        self._tasks.push('normal', normal)
+        self._tasks.push('low', low)
+
+        self._status.setText(
+            f'{frame.loop_rate:.0f} loops/s | '
+            f'modules {frame.modules}/{frame.connections} | '
+            f'dropped {frame.dropped} | '
+            f'serial errors {frame.rx_errors} | '
+            f'missed deadlines {frame.missed} | '
+            f'latest start {frame.late_max} us'
+        )
+        return True
@@ -0,0 +1,85 @@
+"""
+Record an input trace from a controller built with -D MK_TRACING=1.
+
+    python trace.py COM7 trills.mktr --seconds 30
+
+Play it back with the native build (src/host/Replay.cpp).
+"""
+import argparse
+import struct
+import sys
+import time
+
+import serial
+
+import mk
+
+
+def record(port, path, seconds=None):
+    controller = serial.Serial(port=port, baudrate=9600, timeout=.1)
+    link = mk.Link(controller)
+
+    if link.handshake() < 2:
+        print('Tracing needs protocol v2', file=sys.stderr)
+        return 1
+
+    log = mk.LogTable.default()
+    frames = 0
+    lost = 0
+
+    with open(path, 'wb') as f:
+        f.write(mk.TraceMagic + struct.pack('<B', mk.TraceVersion))
+
+        link.request(mk.Trace, struct.pack('<B', 1))
+        started = time.monotonic()
+
+        try:
+            while seconds is None or time.monotonic() - started < seconds:
+                for command in link.read():
+                    if command.id == mk.Log:
+                        for message in log.decode(command.payload):
+                            print('[LOG]: ', message)
+                        continue
+
+                    if command.id != mk.Trace:
+                        continue
+
+                    if len(command.payload) < 2:
+                        print('Controller was built without tracing',
+                              file=sys.stderr)
+                        return 1
+
+                    lost += struct.unpack('<H', command.payload[:2])[0]
+                    f.write(command.payload[2:])
+                    frames += 1
+        except KeyboardInterrupt:
+            pass
+        finally:
+            link.request(mk.Trace, struct.pack('<B', 0))
+
+            # The last records go out just ahead of the log saying
+            # tracing stopped
+            for command in link.wait_for(mk.Log, 0.25)[1]:
+                if command.id == mk.Trace and len(command.payload) >= 2:
+                    lost += struct.unpack('<H', command.payload[:2])[0]
+                    f.write(command.payload[2:])
+                    frames += 1
+
+    print(f'{frames} frames written to {path}')
+    if lost:
+        print(f"{lost} records were lost, the replay won't match the device")
+    return 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().split('\n')[0])
+    parser.add_argument('port')
+    parser.add_argument('output')
+    parser.add_argument('--seconds', type=float, default=None,
+                        help='stop after this long (default: Ctrl-C)')
+    args = parser.parse_args()
+    return record(args.port, args.output, args.seconds)
+
+
+if __name__ == '__main__':
+    sys.exit(main())
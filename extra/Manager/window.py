@@ -3,12 +3,16 @@ Qt = QtCore.Qt
 
 import struct
 import serial
-import threading
 import serial.tools.list_ports
 
 import mk
 from protocol import Command, MidiKitiProtocol
+from telemetry import TelemetryPanel
+from monitor import MonitorPanel
+from profiles import ProfileCache
 from interfaces import (
+    LayoutDiscovery,
+    PatchQueue,
     MidiLayout,
     MidiInterface,
     MidiCommander
@@ -80,6 +84,9 @@ class PreferenceValue(QtWidgets.QWidget):
             value
         )
 
+        # Goes out with the next batch of edits
+        self._interface.edited.emit(self._interface)
+
     def poll_value(self):
         self._widget.blockSignals(True)
 
@@ -166,6 +173,10 @@ class MidiPreferencesWidget(QtWidgets.QWidget):
 
         self.setLayout(layout)
 
+        if self._interface.parameters is not None:
+            # Came in with the layout
+            self._fill_in_preferences()
+
     
     @property
     def interface(self):
@@ -255,12 +266,22 @@ class ManagerWindow(QtWidgets.QMainWindow):
         # -- Variables
 
         self._controller = None      # type: serial.Serial
+        self._link = None            # type: mk.Link
         self._protocol = None        # type: MidiKitiProtocol
-        self._protocol_thread = None # type: QtCore.QThread
-        self._protocol_lock = threading.Lock()
+        self._discovery = None       # type: LayoutDiscovery
+        self._patches = None         # type: PatchQueue
+        self._midi_layout = None     # type: MidiLayout
 
         self._interface_widgets = []
 
+        # Controllers we've seen before show up straight away
+        self._profiles = ProfileCache()
+
+        # A port that went away (USB blip) is tried again until it's back
+        self._reconnect = QtCore.QTimer(self)
+        self._reconnect.setInterval(1000)
+        self._reconnect.timeout.connect(self._try_reconnect)
+
         # -- Interface Setup
 
         w = QtWidgets.QWidget()
@@ -273,6 +294,10 @@ class ManagerWindow(QtWidgets.QMainWindow):
 
         self._com_select.setMinimumWidth(250)
 
+        self._save_all = QtWidgets.QPushButton("Save All")
+        self._save_all.clicked.connect(self._update_all_preferences)
+        header.addWidget(self._save_all)
+
         layout.addLayout(header)
 
         self._scroll = QtWidgets.QScrollArea()
@@ -301,6 +326,26 @@ class ManagerWindow(QtWidgets.QMainWindow):
 
         self.setCentralWidget(w)
 
+        # Live performance numbers, off until asked for
+        self._telemetry = TelemetryPanel()
+        self._telemetry.request.connect(self.request)
+        self._telemetry.setEnabled(False)
+
+        dock = QtWidgets.QDockWidget("Performance")
+        dock.setWidget(self._telemetry)
+        self.addDockWidget(Qt.BottomDockWidgetArea, dock)
+
+        # What the controller sends over USB, also off until asked for
+        self._monitor = MonitorPanel()
+        self._monitor.request.connect(self.request)
+        self._monitor.setEnabled(False)
+
+        monitor_dock = QtWidgets.QDockWidget("Monitor")
+        monitor_dock.setWidget(self._monitor)
+        self.addDockWidget(Qt.BottomDockWidgetArea, monitor_dock)
+        self.tabifyDockWidget(dock, monitor_dock)
+        dock.raise_()
+
         # Fetch the list of ports
         ports = serial.tools.list_ports.comports()
         for port_info in ports:
@@ -326,23 +371,34 @@ class ManagerWindow(QtWidgets.QMainWindow):
 
     @QtCore.Slot(int)
     def _com_selected(self, index):
+        self._reconnect.stop()
         port_info = self._com_select.itemData(index)
 
         if not port_info:
             return
 
         if self._controller:
-            with self._protocol_lock:
-                self._controller.close()
-            self._controller = None
-
-            # Cleanup any existing objects
-            self._protocol_thread.quit()
+            self._telemetry.stop()
+            self._telemetry.setEnabled(False)
+            self._monitor.stop()
+            self._monitor.setEnabled(False)
+
+            # Stops the reader and closes the port
+            self.request.disconnect(self._protocol.request)
+            self._protocol.stop()
             self._protocol.deleteLater()
-            self._protocol_thread.deleteLater()
+            self._discovery.deleteLater()
+            self._patches.deleteLater()
 
-            self._protocol_thread = None
+            self._controller = None
             self._protocol = None
+            self._discovery = None
+            self._patches = None
+            self._midi_layout = None
+
+            for widget in self._interface_widgets:
+                widget.deleteLater()
+            self._interface_widgets = []
 
         try:
             self._controller = serial.Serial(
@@ -354,56 +410,101 @@ class ManagerWindow(QtWidgets.QMainWindow):
             print (str(err))
             return
 
-        while self._controller.in_waiting:
-            # Flush out anything in the queue
-            self._controller.read()
+        # Anything left over from before we opened it
+        self._controller.reset_input_buffer()
+
+        # Spin up the Protocol and its reader. Start your listening
+        # engines!
+        self._link = mk.Link(self._controller)
+        self._protocol = MidiKitiProtocol(self._link)
 
-        # synchronously query the layout of the controller
-        self._midi_layout = MidiLayout.initialize(
-            self._controller
+        # Controller -> This, a batch at a time
+        self._protocol.received.connect(self._process_commands)
+        self._protocol.received.connect(
+            self._telemetry.process_commands
+        )
+        self._protocol.received.connect(
+            self._monitor.process_commands
         )
 
-        for commander in self._midi_layout.commanders:
+        self._protocol.lost.connect(self._port_lost)
+
+        # This -> Controller
+        self.request.connect(self._protocol.request)
+
+        # Edits, batched up and cut down to what changed
+        self._patches = PatchQueue(self._link)
+        self._patches.request.connect(self.request)
+
+        # Handshake, layout and preferences as the controller answers,
+        # the widgets show up once we know the layout and fill in
+        # after that
+        self._discovery = LayoutDiscovery(self._protocol, self._profiles)
+        self._discovery.layoutFound.connect(self._layout_found)
+        self._discovery.failed.connect(self._connection_lost)
+
+        # The Hello goes out (and the decoder is reset) before the
+        # reader starts feeding it
+        self._discovery.start()
+        self._protocol.start()
+
+
+    @QtCore.Slot(object)
+    def _layout_found(self, layout):
+        self._midi_layout = layout
+
+        for commander in layout.commanders:
             for interface in commander.interfaces:
                 w = MidiPreferencesWidget(interface, self)
                 self._layout_area.insertWidget(0, w)
                 self._interface_widgets.append(w)
 
-        # Spin up the Protocol and thread. Start your listening
-        # engines!
-        self._protocol = MidiKitiProtocol(
-            self._controller,
-            self._protocol_lock
-        )
-        self._protocol_thread = QtCore.QThread()
-        self._protocol.moveToThread(self._protocol_thread)
-        self._protocol_thread.started.connect(
-            self._protocol.execute,
-        )
+                interface.edited.connect(self._patches.add)
 
-        # Controller -> This
-        self._protocol.received.connect(
-            self._midi_layout.process_command,
-            Qt.QueuedConnection
-        )
+        self._telemetry.setEnabled(True)
+        self._monitor.setEnabled(True)
 
-        # This -> Controller
-        self.request.connect(
-            self._protocol.request,
-            Qt.QueuedConnection
-        )
 
-        self._protocol_thread.start()
+    @QtCore.Slot(list)
+    def _process_commands(self, commands):
+        if self._midi_layout:
+            self._midi_layout.process_commands(commands)
 
-        # Request each interface's parameters
-        for widget in self._interface_widgets:
-            interface = widget.interface
 
-            payload = interface.header()
-            self.request.emit(
-                mk.GetPreferences,
-                payload
-            )
+    @QtCore.Slot()
+    def _update_all_preferences(self):
+        """
+        Send every interface's preferences in one transaction
+        """
+        if not self._link or self._link.version < 2:
+            for widget in self._interface_widgets:
+                widget._update_preferences()
+            return
+
+        if not self._midi_layout:
+            return
+
+        payload = self._midi_layout.bulk_payload()
+        if payload:
+            self.request.emit(mk.SetAll, payload)
+
+
+    @QtCore.Slot(str)
+    def _port_lost(self, error):
+        self._connection_lost(error)
+        self._reconnect.start()
+
+    @QtCore.Slot()
+    def _try_reconnect(self):
+        self._com_selected(self._com_select.currentIndex())
+        if not self._protocol:
+            self._reconnect.start()
+
+    @QtCore.Slot(str)
+    def _connection_lost(self, error):
+        print (f'Lost the controller: {error}')
+        self._telemetry.setEnabled(False)
+        self._monitor.setEnabled(False)
 
 
     @QtCore.Slot()
@@ -411,12 +512,5 @@ class ManagerWindow(QtWidgets.QMainWindow):
         """
         Make sure we shut things down nicely
         """
-        with self._protocol_lock:
-            if self._controller and self._controller.is_open:
-                self._controller.close()
-        
-        if self._protocol_thread:
-            self._protocol_thread.quit()
-
-            # Wait up to 1s
-            self._protocol_thread.wait(1000)
+        if self._protocol:
+            self._protocol.stop()
@@ -0,0 +1,147 @@
+"""
+PlatformIO pre-build script that prints the RAM budget of every
+fixed-capacity container in MidiKiti for the env being built.
+
+Capacities come from lib/MidiKiti/mk_config.h, with any -D overrides
+from the env's build_flags applied on top. Add it to an env with:
+
+    extra_scripts = pre:extra/scripts/ram_budget.py
+
+Setting -D MK_RAM_BUDGET=<bytes> fails the build if a controller with
+one of every container would go over.
+"""
+import os
+import re
+
+Import('env')
+
+CONFIG = os.path.join(
+    env.subst('$PROJECT_DIR'), 'lib', 'MidiKiti', 'mk_config.h'
+)
+
+# (owner, member, element, capacity macro)
+CONTAINERS = [
+    ('MidiCommander', '_interfaces', 'pointer', 'MK_MAX_INTERFACES'),
+    ('MidiCommander', '_pooled_events', 'RawEvent', 'MK_MAX_POOLED_EVENTS'),
+    ('MidiController', '_connections', 'pointer', 'MK_MAX_CONNECTIONS'),
+    ('MidiController', '_octaves', 'uint8_t', 'MK_MAX_OCTAVES'),
+    ('MidiController', '_local', 'pointer', 'MK_MAX_LOCAL_COMMANDERS'),
+    ('MidiController', '_events', 'RawEvent', 'MK_MAX_POOLED_EVENTS'),
+    ('MidiController', '_announcements', 'Announcement', 'MK_MAX_CONNECTIONS'),
+    ('MidiController', '_tunnels', 'Tunnel', 'MK_MAX_TUNNELS'),
+    ('SerialLink', '_rx', 'uint8_t', 'MK_SERIAL_BUFFER'),
+    ('SerialLink', '_tx', 'uint8_t', 'MK_SERIAL_TX_BUFFER'),
+    ('SnapshotStore', '_buffer', 'uint8_t', 'MK_SNAPSHOT_SLOT'),
+    ('Log', '_records', 'LogRecord', 'MK_LOG_RECORDS'),
+    ('Recorder', '_entries', 'RecorderEntry', 'MK_RECORDER_ENTRIES'),
+    ('Tracer', '_buffer', 'uint8_t', 'MK_TRACE_BUFFER'),
+    ('Monitor', '_records', 'MonitorRecord', 'MK_MONITOR_RECORDS'),
+    ('MidiOctave', '_keys', 'pointer', 'MK_MAX_KEYS'),
+]
+
+# Owners only built in when their flag is set
+FLAGS = {
+    'Tracer': 'MK_TRACING',
+    'Monitor': 'MK_MONITOR_RECORDS',
+}
+
+
+def is_avr():
+    return env.get('PIOPLATFORM') == 'atmelavr'
+
+
+def element_size(element, capacities):
+    """
+    :return: ``tuple(size, alignment)`` of a container element
+    """
+    if element == 'pointer':
+        size = 2 if is_avr() else 4
+        return size, size
+    if element == 'RawEvent':
+        return 8, 1 # packed
+    if element == 'Announcement':
+        return 7, 1 # packed
+    if element == 'LogRecord':
+        return 6, 1 # packed
+    if element == 'RecorderEntry':
+        return 12, 1 # packed
+    if element == 'MonitorRecord':
+        return 10, 1 # packed
+    if element == 'Tunnel':
+        # 7 bytes of bookkeeping, the start time and the parameters
+        align = 1 if is_avr() else 4
+        size = 7 + capacities.get('MK_MAX_PARAMETERS', 0)
+        size += (align - size % align) % align
+        return size + 4, align
+    return 1, 1
+
+
+def defaults():
+    """
+    Pull the default capacity for each macro out of mk_config.h,
+    picking the __AVR__ branch when there is one.
+    """
+    values = {}
+    with open(CONFIG) as f:
+        text = f.read()
+
+    for block in re.finditer(
+            r'#ifndef (MK_\w+)\n(.*?)\n#endif', text, re.S):
+        name, body = block.groups()
+        numbers = re.findall(r'#\s*define\s+' + name + r'\s+(\d+)', body)
+        if not numbers:
+            continue
+        if len(numbers) > 1 and not is_avr():
+            values[name] = int(numbers[1])
+        else:
+            values[name] = int(numbers[0])
+    return values
+
+
+def overrides():
+    values = {}
+    for define in env.get('CPPDEFINES', []):
+        if isinstance(define, (list, tuple)) and len(define) == 2:
+            name, value = define
+            try:
+                values[str(name)] = int(str(value), 0)
+            except ValueError:
+                pass
+    return values
+
+
+def print_budget():
+    capacities = defaults()
+    capacities.update(overrides())
+
+    print(f"MidiKiti RAM budget ({env.subst('$PIOENV')})")
+    print(f"  {'container':<36}{'capacity':>10}{'bytes':>10}")
+
+    totals = {}
+    for owner, member, element, macro in CONTAINERS:
+        size, align = element_size(element, capacities)
+        align = max(align, 2) # uint16_t count
+        count = capacities.get(macro, 0)
+        if capacities.get(FLAGS.get(owner), 1):
+            total = size * count + 2
+            total += (align - total % align) % align
+        else:
+            count = total = 0 # compiled out
+
+        totals[owner] = totals.get(owner, 0) + total
+        print(f"  {owner + '::' + member:<36}{count:>10}{total:>10}")
+
+    for owner, total in totals.items():
+        print(f"  {owner + ' (total)':<36}{'':>10}{total:>10}")
+
+    grand = sum(totals.values())
+    print(f"  {'all containers':<36}{'':>10}{grand:>10}")
+
+    budget = overrides().get('MK_RAM_BUDGET')
+    if budget is not None and grand > budget:
+        print(f"MidiKiti containers need {grand} bytes, "
+              f"over MK_RAM_BUDGET={budget}")
+        env.Exit(1)
+
+
+print_budget()
@@ -2,4 +2,8 @@
 
 #include "mk_common.h"
 #include "mk_interface.h"
+#include "mk_protocol.h"
+#include "mk_probe.h"
+#include "mk_recorder.h"
+#include "mk_scheduler.h"
 #include "mk_shift.h"
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Stops the compiler moving memory accesses across this point
+#define MK_BARRIER() __asm__ __volatile__("" ::: "memory")
+
+namespace mk
+{
+
+/**
+ * A value that's read by the scan and replaced from elsewhere
+ * (process_command, the Wire handlers) without either side waiting
+ * on the other.
+ *
+ * New values are staged into the back buffer and only take over when
+ * the scan calls swap() at a point where it's safe for everything to
+ * change at once, so the scan never sees half of one configuration
+ * and half of another.
+ *
+ * The scan may run from an interrupt. stage() marks itself busy for
+ * the copy and swap() leaves the buffers alone until it's done, the
+ * staged value is picked up at the next boundary instead.
+ */
+template<typename T>
+class DoubleBuffered
+{
+public:
+    explicit DoubleBuffered(const T &value)
+        : _buffers{ value, value }
+    {}
+
+    // What the scan works with. Doesn't change until swap().
+    const T &live() const { return _buffers[_live]; }
+
+    // The value the next swap() will make live
+    const T &next() const { return _buffers[_pending ? _live ^ 1 : _live]; }
+
+    // Replace whatever is staged with value
+    void stage(const T &value)
+    {
+        _staging = true;
+        MK_BARRIER();
+
+        _buffers[_live ^ 1] = value;
+
+        MK_BARRIER();
+        _pending = true;
+        _staging = false;
+    }
+
+    // Called by the scan between passes. True if a new value
+    // has taken over.
+    bool swap()
+    {
+        if (!_pending || _staging)
+            return false;
+
+        _live ^= 1;
+        _pending = false;
+        return true;
+    }
+
+private:
+    T _buffers[2];
+
+    volatile uint8_t _live = 0;
+    volatile bool _pending = false;
+    volatile bool _staging = false;
+};
+
+} // namespace mk
@@ -1,5 +1,6 @@
 #include "mk_button.h"
 #include "mk_command.h"
+#include "mk_log.h"
 
 namespace mk
 {
@@ -7,10 +8,8 @@ namespace mk
 MidiButton::MidiButton(const Config &config, MidiCommander *command)
     : lutil::Button(config.pin)
     , _command(command)
+    , _settings(Settings{ config.control, config.toggle })
 {
-    _control = config.control;
-    _toggle = config.toggle;
-
     _command->add(this);
 
     _ledPin = config.ledPin;
@@ -23,33 +22,68 @@ uint8_t MidiButton::interface_id() const
     return BUTTON_ID;
 }
 
-Parameters *MidiButton::parameters(size_t &size) const
+uint8_t MidiButton::event_type() const
+{
+    return BUTTON_EVENT_ID;
+}
+
+size_t MidiButton::parameters(uint8_t *buffer, size_t capacity) const
+{
+    if (capacity < sizeof(ButtonParameters))
+        return 0;
+
+    const Settings &settings = _settings.next();
+
+    ButtonParameters parms;
+    parms.control = settings.control;
+    parms.toggle = settings.toggle;
+
+    memcpy(buffer, &parms, sizeof(ButtonParameters));
+    return sizeof(ButtonParameters);
+}
+
+bool MidiButton::validate(const uint8_t *buffer, size_t size) const
 {
-    size = sizeof(ButtonParameters);
+    if (size < sizeof(ButtonParameters))
+        return false;
 
-    ButtonParameters *parms = new ButtonParameters();
-    parms->toggle = _toggle;
-    return parms;
+    return parameters_from<ButtonParameters>(buffer).control <= 127;
 }
 
 void MidiButton::setParameters(Parameters *parameters, size_t size)
 {
-    if (size <= sizeof(ButtonParameters))
+    if (size < sizeof(ButtonParameters))
+    {
+        MK_LOG(Log_InvalidParamSize, size, BUTTON_ID);
         return;
+    }
 
-    ButtonParameters *parms = static_cast<ButtonParameters*>(parameters);
-    parms->toggle = _toggle;
-    parms->control = _control;
+    const uint8_t *buffer = reinterpret_cast<const uint8_t*>(parameters);
+    if (!validate(buffer, size))
+    {
+        MK_LOG(Log_InvalidButtonParams);
+        return;
+    }
+
+    ButtonParameters parms = parameters_from<ButtonParameters>(buffer);
+    _settings.stage(Settings{ parms.control, parms.toggle });
 }
 
 void MidiButton::pressed()
 {
+    // A press starts a new scan of the button, new settings can
+    // take over here
+    if (_settings.swap() && !_settings.live().toggle)
+        _on = false;
+
+    const Settings &settings = _settings.live();
+
     ButtonEvent event;
     event.type = BUTTON_EVENT_ID;
     event.address = _command->address();
-    event.control = _control;
+    event.control = settings.control;
 
-    if (_toggle)
+    if (settings.toggle)
     {
         _on = !_on;
         event.pressed = _on ? 1 : 0;
@@ -70,13 +104,17 @@ void MidiButton::pressed()
 
 void MidiButton::released()
 {
-    if (_toggle)
+    // Settings only change on a press so the release always
+    // matches it
+    const Settings &settings = _settings.live();
+
+    if (settings.toggle)
         return; // Nothing to do here.
     
     ButtonEvent event;
     event.type = BUTTON_EVENT_ID;
     event.address = _command->address();
-    event.control = _control;
+    event.control = settings.control;
     event.pressed = 0;
 
     if (_ledPin >= 0)
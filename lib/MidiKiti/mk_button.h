@@ -35,19 +35,27 @@ protected:
 
     // Implement _AbstractMidiInterface
     uint8_t interface_id() const override;
-    Parameters *parameters(size_t &size) const override;
+    uint8_t event_type() const override;
+    size_t parameters(uint8_t *buffer, size_t capacity) const override;
     void setParameters(Parameters *parameters, size_t size) override;
+    bool validate(const uint8_t *buffer, size_t size) const override;
 
     // Implement lutil::Button options
     void pressed() override;
     void released() override;
 
 private:
+    // What the Manager can change
+    struct Settings
+    {
+        uint8_t control;
+        bool toggle;
+    };
+
     // Implement the midi interface requirements
     MidiCommander *_command = nullptr;
 
-    uint8_t _control;
-    bool _toggle = false;
+    DoubleBuffered<Settings> _settings;
 
     int _ledPin;
     bool _on = false; // If toggle is true, this will change
@@ -0,0 +1,56 @@
+#include "mk_clock.h"
+
+#if !defined(ARDUINO)
+#  include <chrono>
+#endif
+
+namespace mk
+{
+
+#if defined(ARM_DWT_CYCCNT)
+namespace
+{
+
+// Teensy 4 turns the cycle counter on at startup, Teensy 3 doesn't
+struct CycleCounter
+{
+    CycleCounter()
+    {
+        ARM_DEMCR |= ARM_DEMCR_TRCENA;
+        ARM_DWT_CTRL |= ARM_DWT_CTRL_CYCCNTENA;
+    }
+} cycle_counter;
+
+} // namespace
+#endif
+
+uint32_t Clock::now()
+{
+#if defined(ARM_DWT_CYCCNT)
+    return ARM_DWT_CYCCNT;
+#elif defined(ARDUINO)
+    return micros();
+#else
+    using namespace std::chrono;
+    return uint32_t(duration_cast<nanoseconds>(
+        steady_clock::now().time_since_epoch()
+    ).count());
+#endif
+}
+
+uint16_t Clock::ticks_per_us()
+{
+#if defined(ARM_DWT_CYCCNT)
+#  if defined(__IMXRT1062__)
+    return F_CPU_ACTUAL / 1000000;
+#  else
+    return F_CPU / 1000000;
+#  endif
+#elif defined(ARDUINO)
+    return 1;
+#else
+    return 1000;
+#endif
+}
+
+} // namespace mk
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <Arduino.h>
+
+namespace mk
+{
+
+/**
+ * The cheapest high resolution clock we have. The DWT cycle counter
+ * on Teensy, micros() on AVR and steady_clock (ns) on the host.
+ * Anything that sends ticks to the host sends ticks_per_us() along
+ * with them.
+ */
+class Clock
+{
+public:
+    static uint32_t now();
+    static uint16_t ticks_per_us();
+};
+
+} // namespace mk
@@ -2,6 +2,10 @@
 #include "mk_interface.h"
 
 #include "mk_controller.h"
+#include "mk_log.h"
+#include "mk_protocol.h"
+#include "mk_recorder.h"
+#include "mk_store.h"
 
 static mk::MidiCommander *__handler_inst = nullptr;
 
@@ -14,6 +18,19 @@ void __handle_request()
     __handler_inst->events_requested();
 }
 
+/* Handler for anything the controller writes to us */
+void __handle_receive(int count)
+{
+    if (!__handler_inst)
+    {
+        while (Wire.available() > 0)
+            Wire.read();
+        return;
+    }
+
+    __handler_inst->received(count);
+}
+
 namespace mk
 {
 
@@ -30,17 +47,45 @@ void MidiCommander::SetInterfaceInstance(MidiCommander *instance)
 {
     __handler_inst = instance;
     Wire.onRequest(__handle_request);
+    Wire.onReceive(__handle_receive);
+}
+
+static uint32_t default_unique_id()
+{
+#if defined(__IMXRT1062__)
+    // Teensy 4.x, the MAC is unique per chip
+    return HW_OCOTP_MAC0 ^ (HW_OCOTP_MAC1 << 16);
+#elif defined(SIM_UIDL)
+    // Teensy 3.x
+    return SIM_UIDL ^ SIM_UIDML;
+#else
+    // No serial number to go by. A floating analog pin gives us
+    // enough noise to keep modules apart for a session.
+    randomSeed((uint32_t(analogRead(0)) << 16) ^ micros());
+    return (uint32_t(random(0xFFFF)) << 16) | uint32_t(random(0xFFFF));
+#endif
+}
+
+void MidiCommander::set_unique_id(uint32_t uid)
+{
+    _uid = uid;
+}
+
+uint32_t MidiCommander::unique_id() const
+{
+    return _uid;
 }
 
 void MidiCommander::add(_AbstractMidiInterface *interface)
 {
-    _interfaces.push(interface);
+    if (!_interfaces.push(interface))
+        MK_LOG(Log_TooManyInterfaces, MK_MAX_INTERFACES);
 }
 
 
 bool MidiCommander::is_local() const
 {
-    return _ready_in < 0;
+    return _ready_in == -1;
 }
 
 bool MidiCommander::is_connected() const
@@ -61,84 +106,308 @@ bool MidiCommander::initialize()
 // network.
 bool MidiCommander::ready_to_connect()
 {
-    if (_ready_in < 0) // local only
+    if (is_local())
     {
         _connected = true;
         return true;
     }
-        
-    if (digitalRead(_ready_in) == HIGH)
-    {
-        // Clear the buffer (if any)
-        while (Wire.available() > 0)
-            Wire.read();
 
-        // --------------------------------------
-        // Startup the I2C interface so, while we
-        // handle the connection bits
-        Wire.begin(0xFE);
+    // On a daisy chain we wait for the module before us to
+    // finish joining
+    if (_ready_in >= 0 && digitalRead(_ready_in) != HIGH)
+        return false;
 
-        // Send the address
-        Wire.beginTransmission(0);
+    if (_uid == 0)
+        _uid = default_unique_id();
 
-        // TODO: SEND DESCRIPTOR THAT OUTLINES INTERFACE
-        // LAYOUT AND PREFERENCES...
-        // Wire.write((byte *)(&_uuid), sizeof(_uuid));
+    // Our interfaces are all set up by now
+    _describe();
 
-        Wire.endTransmission();
-        // --------------------------------------
+    // Listen on the shared address for our assignment while
+    // we announce ourselves
+    _assigned = false;
+    SetInterfaceInstance(this);
+    Wire.begin(MK_I2C_ENUMERATE);
 
-        return true;
+    _announce();
+    return true;
+}
+
+void MidiCommander::_describe()
+{
+    LayoutHash hash;
+    push_layout(&hash);
+
+    DescriptorHeader header{
+        MK_DESCRIPTOR_VERSION,
+        uint8_t(_interfaces.count()),
+        hash.value()
+    };
+
+    memcpy(_descriptor, &header, sizeof(DescriptorHeader));
+    _descriptor_size = sizeof(DescriptorHeader);
+
+    uint8_t parms[MK_MAX_PARAMETERS];
+
+    auto it = _interfaces.begin();
+    for (; it != _interfaces.end(); it++)
+    {
+        DescriptorEntry entry{
+            (*it)->interface_id(),
+            (*it)->parameter_version(),
+            uint8_t((*it)->parameters(parms, sizeof(parms))),
+            (*it)->event_type()
+        };
+
+        memcpy(_descriptor + _descriptor_size, &entry, sizeof(DescriptorEntry));
+        _descriptor_size += sizeof(DescriptorEntry);
     }
+}
+
+void MidiCommander::_announce()
+{
+    // The uuid is our first interface type and the number
+    // of interfaces
+    uint16_t uuid = _interfaces.count();
+    if (_interfaces.count() > 0)
+        uuid |= uint16_t(_interfaces[0]->interface_id()) << 8;
+
+    Announcement announcement{ I2C_Announce, _uid, uuid };
+
+    // Lost arbitration (or nobody listening yet) just means
+    // trying again on the next pass
+    Wire.beginTransmission(MK_I2C_CONTROLLER);
+    Wire.write(reinterpret_cast<uint8_t*>(&announcement), sizeof(Announcement));
+    if (Wire.endTransmission() == 0)
+        _announced = millis();
+    else
+        _announced = millis() - MK_ENUMERATE_RETRY_MS;
+}
 
-    return false;
+bool MidiCommander::assigned()
+{
+    return is_connected();
 }
 
 bool MidiCommander::runtime_engage()
 {
-    if (_ready_in < 0) // local only
+    if (is_local())
     {
         return true;
     }
 
-    if (Wire.available() > 2)
+    return _engaged;
+}
+
+bool MidiCommander::_join()
+{
+    if (!_assigned)
     {
-        byte read[3];
-        Wire.readBytes(read, 3);
-        return strcmp((const char *)read, ENGAGE_COMMAND) == 0;
+        // Nobody has answered, the controller may have missed us
+        if (millis() - _announced >= MK_ENUMERATE_RETRY_MS)
+            _announce();
+        return false;
     }
 
-    return false;
+    // Swap straight over to the new address
+    _address = _assigned_address;
+    Wire.begin(_address);
+
+    _polled = millis();
+    _connected = true;
+    return true;
 }
 
 void MidiCommander::connect()
 {
-    if (_ready_in < 0)
+    if (is_local())
     {
         _connected = true;
         return;
     }
-    
-    // Check on the available wire and swap to the new
-    // address, then let the ready pin out know
+
+    if (!_join())
+        return;
+
+    // The next device (if any) can now take
+    // its turn to regsiter for an address
+    if (_ready_out >= 0)
+        digitalWrite(_ready_out, HIGH);
+}
+
+void MidiCommander::_service_tunnel()
+{
+    if (_reply_wanted)
+    {
+        noInterrupts();
+        uint8_t index = _reply_index;
+        _reply_wanted = false;
+        interrupts();
+
+        // An index we don't have is answered with nothing
+        uint8_t size = 0;
+        if (index < _interfaces.count())
+            size = _interfaces[index]->parameters(_reply, sizeof(_reply));
+
+        noInterrupts();
+        _reply_size = size;
+        _reply_ready = true;
+        interrupts();
+    }
+
+    if (_incoming_ready)
+    {
+        if (check_preferences(_incoming_index, _incoming_size, _incoming))
+            set_preferences(_incoming_index, _incoming_size, _incoming);
+        _incoming_ready = false;
+    }
+}
+
+void MidiCommander::runtime()
+{
+    if (is_local())
+        return;
+
+    if (!_connected)
+    {
+        _join();
+        return;
+    }
+
+    _service_tunnel();
+
+    noInterrupts();
+    unsigned long polled = _polled;
+    interrupts();
+
+    if (millis() - polled < MK_MODULE_ORPHAN_MS)
+        return;
+
+    // The controller has given up on us (or restarted). Back to
+    // the shared address to ask for our spot again. The daisy
+    // chain has already been let through so we leave ready_out be.
+    _connected = false;
+    _assigned = false;
+    Wire.begin(MK_I2C_ENUMERATE);
+    _announce();
+}
+
+void MidiCommander::received(int /*count*/)
+{
+    uint8_t buffer[MK_I2C_BUFFER];
+    size_t size = 0;
+
     while (Wire.available() > 0)
     {
-        _address = Wire.read();
-        Wire.end();
-        delay(1);
-        Wire.begin(_address);
+        uint8_t b = Wire.read();
+        if (size < sizeof(buffer))
+            buffer[size++] = b;
+    }
 
-        // The next device (if any) can now take
-        // its turn to regsiter for an address
-        if (_ready_out >= 0)
-            digitalWrite(_ready_out, HIGH);
-        _connected = true;
+    if (!_connected)
+    {
+        if (size != sizeof(Assignment) || buffer[0] != I2C_Assign)
+            return;
+
+        Assignment assignment;
+        memcpy(&assignment, buffer, sizeof(Assignment));
+
+        if (assignment.uid == _uid)
+        {
+            _assigned_address = assignment.address;
+            _assigned = true;
+        }
+        return;
+    }
+
+    if (size == 3 && memcmp(buffer, ENGAGE_COMMAND, 3) == 0)
+    {
+        _engaged = true;
+        return;
+    }
+
+    if (size < sizeof(TunnelHeader))
+        return;
+
+    TunnelHeader header;
+    memcpy(&header, buffer, sizeof(TunnelHeader));
+
+    switch (header.tag)
+    {
+    case I2C_GetPreferences:
+    {
+        _reply_ready = false;
+        _reply_index = header.index;
+        _reply_wanted = true;
+        break;
+    }
+    case I2C_ReadReply:
+    {
+        _reply_offset = header.offset;
+        _reply_armed = true;
+        break;
+    }
+    case I2C_ReadDescriptor:
+    {
+        _reply_offset = header.offset;
+        _descriptor_armed = true;
+        break;
+    }
+    case I2C_SetPreferences:
+    {
+        if (_incoming_ready)
+            break; // Still applying the last one
+
+        if (header.offset == 0)
+        {
+            _incoming_index = header.index;
+            _incoming_size = header.size;
+            _incoming_received = 0;
+        }
+
+        // Chunks arrive in order, anything else is a request we've
+        // lost track of
+        if (header.offset != _incoming_received
+            || header.size != _incoming_size
+            || header.size > sizeof(_incoming))
+            break;
+
+        uint8_t n = min(
+            uint8_t(size - sizeof(TunnelHeader)),
+            uint8_t(header.size - header.offset)
+        );
+        memcpy(_incoming + header.offset, buffer + sizeof(TunnelHeader), n);
+        _incoming_received += n;
+
+        if (_incoming_received >= _incoming_size)
+            _incoming_ready = true;
+        break;
+    }
+    default:
+        break;
     }
 }
 
 void MidiCommander::queue_event(const RawEvent &event)
 {
-    _pooled_events.push(event);
+    RawEvent stamped = event;
+#if MK_MONITOR_RECORDS
+    stamp_event(stamped);
+#endif
+
+    // Modules hand the pool over from the Wire request handler
+    noInterrupts();
+    bool pooled = _pooled_events.push(stamped);
+    if (!pooled && _unreported_drops < 0xFF)
+        _unreported_drops++;
+    interrupts();
+
+    MK_RECORD_EVENT(stamped);
+    if (!pooled)
+    {
+        _dropped_events++;
+        MK_RECORD_TRIGGER(Trigger_Overflow, _address);
+    }
 }
 
 void MidiCommander::flush()
@@ -153,7 +422,7 @@ void MidiCommander::flush()
     }
 
     // Reset the queue
-    _pooled_events = {};
+    _pooled_events.clear();
     Wire.endTransmission();
 }
 
@@ -167,18 +436,96 @@ uint8_t MidiCommander::address() const
     return _address;
 }
 
+void MidiCommander::_write_reply(const uint8_t *data, uint8_t size, bool ready)
+{
+    // ready | size | data from the offset asked for
+    uint8_t buffer[MK_I2C_BUFFER];
+    uint8_t n = 0;
+
+    buffer[0] = ready;
+    buffer[1] = size;
+
+    if (ready && _reply_offset < size)
+    {
+        n = min(uint8_t(size - _reply_offset), ReplyChunk);
+        memcpy(buffer + sizeof(ReplyHeader), data + _reply_offset, n);
+    }
+
+    Wire.write(buffer, sizeof(ReplyHeader) + n);
+}
+
 void MidiCommander::events_requested()
 {
-    Wire.write((uint8_t)_pooled_events.count());
-    _requested = true;
+    _polled = millis();
+
+    if (_reply_armed)
+    {
+        _reply_armed = false;
+        _write_reply(_reply, _reply_size, _reply_ready);
+        return;
+    }
+
+    if (_descriptor_armed)
+    {
+        _descriptor_armed = false;
+        _write_reply(_descriptor, _descriptor_size, true);
+        return;
+    }
+
+    // The read straight after a header takes the events it counted.
+    // Only now are they gone from the pool, a header read never
+    // loses anything. The pool only grows in between.
+    unsigned long now = micros();
+    if (_poll_promised > 0 && now - _poll_header_at < MK_I2C_POLL_GAP_US)
+    {
+        // In a single write, some Wire libraries only keep the last
+        // write made in a request handler
+        uint8_t buffer[EventsPerPoll * WireEventSize];
+        uint8_t count = _poll_promised;
+        _poll_promised = 0;
+
+        for (uint8_t i = 0; i < count; i++)
+            memcpy(buffer + i * WireEventSize, &_pooled_events[i], WireEventSize);
+
+        // Anything left goes out on the next poll
+        _pooled_events.erase(0, count);
+        Wire.write(buffer, count * WireEventSize);
+        return;
+    }
+
+    PollHeader header;
+    header.count = min(_pooled_events.count(), size_t(EventsPerPoll));
+    header.dropped = _unreported_drops;
+    _unreported_drops = 0;
+
+    _poll_promised = header.count;
+    _poll_header_at = now;
+    Wire.write(reinterpret_cast<uint8_t*>(&header), sizeof(PollHeader));
+}
+
+void MidiCommander::take_events(EventBuffer &events)
+{
+    size_t taken = 0;
+    for (; taken < _pooled_events.count(); taken++)
+    {
+        if (!events.push(_pooled_events[taken]))
+            break;
+    }
+
+    _pooled_events.erase(0, taken);
+}
+
+uint16_t MidiCommander::dropped_events() const
+{
+    return _dropped_events;
 }
 
-void MidiCommander::take_events(lutil::Vec<RawEvent> &events)
+size_t MidiCommander::pooled() const
 {
-    events.swap(_pooled_events);
+    return _pooled_events.count();
 }
 
-void MidiCommander::push_layout(Stream *stream)
+void MidiCommander::push_layout(Print *stream)
 {
     // The first byte is the number of interfaces
     stream->write(_interfaces.count());
@@ -192,35 +539,109 @@ void MidiCommander::push_layout(Stream *stream)
     }
 }
 
-void MidiCommander::query_preferences(uint8_t index)
+void MidiCommander::query_preferences(uint8_t commander, uint8_t index)
 {
     if (index >= _interfaces.count())
         return;
     
     _AbstractMidiInterface *interf = _interfaces[index];
-    
-    size_t size;
-    Parameters *parms = interf->parameters(size);
 
-    if (!parms)
+    uint8_t parms[MK_MAX_PARAMETERS];
+    size_t size = interf->parameters(parms, sizeof(parms));
+    if (size == 0)
         return;
 
-    Serial.write(Command_StartFlag);
-    Serial.write(Command_GetPreferences);
-    Serial.write(size + sizeof(PreferencesHeader));
+    // PreferencesHeader | Parameters
+    SerialLink &link = SerialLink::get();
+    link.begin(Command_GetPreferences, size + sizeof(PreferencesHeader));
 
     // We need to include the 2 byte address of our interface
-    PreferencesHeader header{ address(), index };
-    Serial.write(
-        reinterpret_cast<uint8_t*>(&header),
-        sizeof(PreferencesHeader)
-    );
+    PreferencesHeader header{ commander, index };
+    link.write(reinterpret_cast<uint8_t*>(&header), sizeof(PreferencesHeader));
+
+    // The link buffers the frame and hands it to the serial
+    // driver in one write
+    link.write(parms, size);
+    link.end();
+}
+
+bool MidiCommander::check_preferences(
+    uint8_t index,
+    uint8_t size,
+    const uint8_t *buffer)
+{
+    if (index >= _interfaces.count())
+        return false;
+
+    _AbstractMidiInterface *interf = _interfaces[index];
 
-    // We can now write out the parameters byte by byte (in case
-    // it's too large for the buffer, this way it should feed into
-    // the computer interface over time)
-    for (size_t i = 0; i < size; i++)
-        Serial.write(reinterpret_cast<uint8_t*>(parms)[i]);
+    uint8_t current[MK_MAX_PARAMETERS];
+    size_t expected = interf->parameters(current, sizeof(current));
+    if (expected == 0 || size != expected)
+        return false;
+
+    // Parameters lead with the type they belong to
+    Parameters incoming = parameters_from<Parameters>(buffer);
+    if (incoming.parameter_type != interf->interface_id())
+        return false;
+
+    return interf->validate(buffer, size);
+}
+
+bool MidiCommander::patch_preferences(
+    uint8_t index,
+    uint8_t offset,
+    uint8_t size,
+    const uint8_t *data,
+    bool apply)
+{
+    if (index >= _interfaces.count())
+        return false;
+
+    uint8_t current[MK_MAX_PARAMETERS];
+    size_t total = _interfaces[index]->parameters(current, sizeof(current));
+
+    // The parameter type stays what it is
+    if (size == 0 || offset < sizeof(Parameters) || offset + size > total)
+        return false;
+
+    // Checked as the whole set it makes
+    memcpy(current + offset, data, size);
+    if (!_interfaces[index]->validate(current, total))
+        return false;
+
+    if (apply)
+        set_preferences(index, total, current);
+    return true;
+}
+
+uint16_t MidiCommander::dump_size()
+{
+    uint8_t parms[MK_MAX_PARAMETERS];
+    uint16_t size = 1;
+
+    auto it = _interfaces.begin();
+    for (; it != _interfaces.end(); it++)
+        size += 2 + (*it)->parameters(parms, sizeof(parms));
+
+    return size;
+}
+
+void MidiCommander::dump_preferences(Print *stream)
+{
+    uint8_t parms[MK_MAX_PARAMETERS];
+
+    stream->write(uint8_t(_interfaces.count()));
+
+    auto it = _interfaces.begin();
+    for (; it != _interfaces.end(); it++)
+    {
+        uint8_t size = (*it)->parameters(parms, sizeof(parms));
+
+        stream->write((*it)->interface_id());
+        stream->write(size);
+        stream->write(parms, size);
+    }
 }
 
 void MidiCommander::set_preferences(
@@ -230,7 +651,7 @@ void MidiCommander::set_preferences(
 {
     if (index >= _interfaces.count())
     {
-        Message("Invalid Interface Index");
+        MK_LOG(Log_InvalidInterfaceIndex, index);
         return;
     }
 
@@ -240,11 +661,9 @@ void MidiCommander::set_preferences(
         reinterpret_cast<Parameters*>(buffer),
         size
     );
-
-    Message("Params Set");
 }
 
-lutil::Vec<_AbstractMidiInterface*> &MidiCommander::components()
+MidiCommander::InterfaceList &MidiCommander::components()
 {
     return _interfaces;
 }
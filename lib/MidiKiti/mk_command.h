@@ -14,6 +14,12 @@ class _AbstractMidiInterface;
 class MidiCommander : public lutil::StateDriver<MidiCommander>
 {
 public:
+    using InterfaceList = StaticVec<_AbstractMidiInterface*, MK_MAX_INTERFACES>;
+
+    // Pass as ready_in for a module that joins through bus
+    // arbitration instead of the ready in/out daisy chain
+    static constexpr int Arbitrate = -2;
+
     static void SetInterfaceInstance(MidiCommander *instance);
 
     explicit MidiCommander(int ready_in = -1, int ready_out = -1)
@@ -21,8 +27,12 @@ public:
         , _ready_in(ready_in)
         , _ready_out(ready_out)
     {
-        // TODO: Setup the ready-in-out wire tooling
-        add_runtime(Off, &MidiCommander::runtime);
+        add_transition(Off, Connect, &MidiCommander::ready_to_connect);
+        add_transition(Connect, Engage, &MidiCommander::assigned);
+        add_transition(Engage, Runtime, &MidiCommander::runtime_engage);
+
+        add_runtime(Connect, &MidiCommander::connect);
+        add_runtime(Runtime, &MidiCommander::runtime);
     }
 
     bool is_local() const;
@@ -32,18 +42,30 @@ public:
     // Check to see if we are on deck to be added to the
     // network.
     bool ready_to_connect();
+    bool assigned();
     bool runtime_engage();
     void connect();
     void flush();
 
+    // Something that identifies this module from the others on
+    // the bus. Defaults to the chip's serial number (or a random
+    // number on boards without one).
+    void set_unique_id(uint32_t uid);
+    uint32_t unique_id() const;
+
+    // Called from the Wire receive handler
+    void received(int count);
+
     void set_address(uint8_t address);
     uint8_t address() const;
 
+    // Called from the Wire request handler. Answers the
+    // controller's poll with as many events as fit.
     void events_requested();
 
-    // Currently we do nothing, but we'll probably
-    // use this in the future to handle pushing events
-    void runtime() {}
+    // Works through preference requests from the controller,
+    // watches for it dropping us, and rejoins
+    void runtime();
 
     // Called via the interface constructors
     void add(_AbstractMidiInterface *interface);
@@ -51,11 +73,44 @@ public:
     // Post a new event. Called via the interfaces
     void queue_event(const RawEvent &event);
 
-    // Take any pooled events
-    void take_events(lutil::Vec<RawEvent> &events);
+    // Move as many pooled events as fit into events. Anything
+    // that doesn't fit stays pooled for the next pass.
+    void take_events(EventBuffer &events);
+
+    // Events we've had to drop because the pool was full
+    uint16_t dropped_events() const;
+
+    // Events waiting in the pool
+    size_t pooled() const;
+
+    void push_layout(Print *stream);
+    // commander is the number the host knows us by, local
+    // commanders come after the I2C modules
+    void query_preferences(uint8_t commander, uint8_t index);
+
+    // Check that buffer holds parameters for the interface at index,
+    // and that it would take them
+    bool check_preferences(
+        uint8_t index,
+        uint8_t size,
+        const uint8_t *buffer
+    );
+
+    // Overwrite size bytes of the interface's parameters from
+    // offset. Only checks (the result included) when apply is false.
+    bool patch_preferences(
+        uint8_t index,
+        uint8_t offset,
+        uint8_t size,
+        const uint8_t *data,
+        bool apply
+    );
+
+    // Interface count, then type | size | parameters for each
+    // interface. dump_size() is the number of bytes that writes.
+    uint16_t dump_size();
+    void dump_preferences(Print *stream);
 
-    void push_layout(Stream *stream);
-    void query_preferences(uint8_t index);
     void set_preferences(
         uint8_t index,
         uint8_t size,
@@ -64,20 +119,74 @@ public:
 
 protected:
     friend class MidiController;
-    lutil::Vec<_AbstractMidiInterface*> &components();
+    InterfaceList &components();
 
 private:
+    void _announce();
+
+    // Announce until we have an assignment, then move onto the
+    // address. True once we're there.
+    bool _join();
+
+    // Answer (or apply) preference requests from the controller
+    void _service_tunnel();
+
+    // Build our descriptor, once our interfaces are all added
+    void _describe();
+
+    // The read after an I2C_ReadReply (or I2C_ReadDescriptor)
+    void _write_reply(const uint8_t *data, uint8_t size, bool ready);
+
     uint8_t _address;
 
     bool _connected = false;
     int _ready_in;
     int _ready_out;
 
-    lutil::Vec<_AbstractMidiInterface*> _interfaces;
+    uint32_t _uid = 0;
+    unsigned long _announced = 0;
+
+    // Set from the Wire receive handler
+    volatile bool _assigned = false;
+    volatile uint8_t _assigned_address = 0;
+    volatile bool _engaged = false;
+
+    InterfaceList _interfaces;
 
     // All events we're waiting to send to the controller
-    lutil::Vec<RawEvent> _pooled_events;
-    bool _requested;
+    EventBuffer _pooled_events;
+    uint16_t _dropped_events = 0;
+
+    // Drops the controller hasn't heard about yet
+    volatile uint8_t _unreported_drops = 0;
+
+    // Last time the controller polled us (millis)
+    volatile unsigned long _polled = 0;
+
+    // Events the last poll header promised, for the read after it
+    volatile uint8_t _poll_promised = 0;
+    volatile unsigned long _poll_header_at = 0; // us
+
+    // -- Preference requests from the controller. Set from the Wire
+    //    handlers and worked through in runtime().
+
+    volatile bool _reply_wanted = false;
+    volatile uint8_t _reply_index = 0;
+    volatile bool _reply_ready = false;
+    volatile bool _reply_armed = false; // The next request is for the reply
+    volatile bool _descriptor_armed = false; // ... or for the descriptor
+    volatile uint8_t _reply_offset = 0;
+    uint8_t _reply_size = 0;
+    uint8_t _reply[MK_MAX_PARAMETERS];
+
+    volatile bool _incoming_ready = false;
+    uint8_t _incoming_index = 0;
+    uint8_t _incoming_size = 0;
+    uint8_t _incoming_received = 0;
+    uint8_t _incoming[MK_MAX_PARAMETERS];
+
+    uint8_t _descriptor_size = 0;
+    uint8_t _descriptor[DescriptorSize];
 };
 
 }
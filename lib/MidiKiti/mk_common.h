@@ -1,14 +1,32 @@
 #pragma once
 
 #include <Arduino.h>
+#include "mk_config.h"
 #include "mk_util.h"
+#include "mk_vector.h"
+#include "mk_buffered.h"
 
 #include "lutil.h"
-#include "lu_memory/managed_ptr.h"
 
 #define ENGAGE_COMMAND "###"
 #define EVENT_COMMAND '!'
 
+// I2C addresses used while modules join the network
+#define MK_I2C_CONTROLLER 0x08   // Controller listens here for announcements
+#define MK_I2C_ENUMERATE 0x77    // Every module waiting for an address
+#define MK_I2C_FIRST_MODULE 0x10 // First address handed out
+
+#define I2C_Announce 0xA1
+#define I2C_Assign 0xA2
+#define I2C_GetPreferences 0xA3
+#define I2C_SetPreferences 0xA4
+#define I2C_ReadReply 0xA5
+#define I2C_ReadDescriptor 0xA6
+
+// Bumped with any change to what goes over I2C, modules that don't
+// match aren't taken on
+#define MK_DESCRIPTOR_VERSION 2
+
 #define OCTAVE_ID 0xF1
 #define POT_ID 0xF2
 #define BUTTON_ID 0xF3
@@ -17,11 +35,24 @@
 #define POT_EVENT_ID 2
 #define BUTTON_EVENT_ID 2
 
+#define MK_PROTOCOL_VERSION 2
+
 #define Command_StartFlag 0xFF
 #define Command_GetLayout 0x01
 #define Command_GetPreferences 0x02
 #define Command_SetPreferences 0x03
 #define Command_Message 0x04
+#define Command_Hello 0x05
+#define Command_DumpAll 0x06
+#define Command_SetAll 0x07
+#define Command_GetProbes 0x08
+#define Command_Telemetry 0x09
+#define Command_Log 0x0A
+#define Command_Recorder 0x0B
+#define Command_Trace 0x0C
+#define Command_PatchPreferences 0x0D
+#define Command_Monitor 0x0E
+#define Command_Profile 0x0F
 
 constexpr char Off[] = "Off";
 constexpr char Boot[] = "Boot";
@@ -62,6 +93,10 @@ union RawEvent{
     uint64_t payload;
 };
 
+// Fixed-size pool of events passed between commanders and
+// the controller
+using EventBuffer = StaticVec<RawEvent, MK_MAX_POOLED_EVENTS>;
+
 // --------------------------------------------------------------------
 // -- Event Structures
 // --------------------------------------------------------------------
@@ -100,6 +135,53 @@ struct ButtonEvent
     uint8_t pressed;  // MIDI Note On/Off
 };
 
+// Events travel over I2C as the leading bytes of their struct, the
+// largest of which sets the size
+constexpr uint8_t WireEventSize = sizeof(KeyEvent);
+static_assert(sizeof(PotEvent) <= WireEventSize, "PotEvent too large for the wire");
+static_assert(sizeof(ButtonEvent) <= WireEventSize, "ButtonEvent too large for the wire");
+
+// Module -> controller, a poll is two reads. The first is only the
+// header, the second (when count > 0) takes that many events:
+//
+//   PollHeader
+//   events...
+struct PollHeader
+{
+    uint8_t count;   // Events the second read takes
+    uint8_t dropped; // Events the module's pool turned away since
+                     // the last poll (saturates)
+};
+
+// Both reads of a poll have to fit the Wire buffer
+constexpr uint8_t EventsPerPoll = (MK_I2C_BUFFER - sizeof(PollHeader)) / WireEventSize;
+
+// The controller stamps events as they're pooled (locally, or when a
+// module's come in with a poll) in the last two bytes of the
+// RawEvent, past anything that goes over the wire. Ticks are
+// EventStampUs long so the stamp wraps after about a second.
+constexpr uint8_t EventStampOffset = sizeof(RawEvent) - sizeof(uint16_t);
+constexpr uint8_t EventStampUs = 16;
+static_assert(WireEventSize <= EventStampOffset, "Events overlap the stamp");
+
+inline uint16_t event_ticks()
+{
+    return uint16_t(micros() / EventStampUs);
+}
+
+inline void stamp_event(RawEvent &event)
+{
+    uint16_t ticks = event_ticks();
+    memcpy(reinterpret_cast<uint8_t*>(&event) + EventStampOffset, &ticks, sizeof(ticks));
+}
+
+inline uint16_t event_stamp(const RawEvent &event)
+{
+    uint16_t ticks;
+    memcpy(&ticks, reinterpret_cast<const uint8_t*>(&event) + EventStampOffset, sizeof(ticks));
+    return ticks;
+}
+
 // --------------------------------------------------------------------
 // -- Event Casting
 // --------------------------------------------------------------------
@@ -118,6 +200,78 @@ RawEvent *rawevent_cast(T *e)
     return reinterpret_cast<RawEvent*>(e);
 }
 
+// --------------------------------------------------------------------
+// -- I2C Enumeration
+// --------------------------------------------------------------------
+
+// Module -> MK_I2C_CONTROLLER. Every module waiting for an address
+// sends this at the same time, bus arbitration lets one through at
+// a time and the rest try again straight away.
+struct Announcement
+{
+    uint8_t tag;   // I2C_Announce
+    uint32_t uid;  // Unique to the module
+    uint16_t uuid; // Module type
+};
+
+// Controller -> MK_I2C_ENUMERATE. Heard by every waiting module but
+// only the one with the matching uid takes the address.
+struct Assignment
+{
+    uint8_t tag;     // I2C_Assign
+    uint32_t uid;
+    uint8_t address;
+};
+
+// Controller -> module, preference requests. Each is a single small
+// transfer so event polling carries on between them.
+//
+//   I2C_GetPreferences  index                  module readies a reply
+//   I2C_SetPreferences  index | offset | size  + a chunk of the data
+//   I2C_ReadReply       offset                 next read is the reply
+struct TunnelHeader
+{
+    uint8_t tag;
+    uint8_t index;  // Interface on the module
+    uint8_t offset; // Of this chunk
+    uint8_t size;   // Of all the data
+};
+
+// Module -> controller, the read after an I2C_ReadReply. Followed by
+// the reply from offset on.
+struct ReplyHeader
+{
+    uint8_t ready; // Zero until the module has the reply
+    uint8_t size;  // Of the whole reply
+};
+
+// Module -> controller, read (like a reply) through
+// I2C_ReadDescriptor once the module is on its address. Everything
+// the controller needs to know about a module up front.
+//
+//   DescriptorHeader | DescriptorEntry for each interface
+struct DescriptorHeader
+{
+    uint8_t version; // MK_DESCRIPTOR_VERSION
+    uint8_t count;   // Interfaces
+    uint32_t layout; // LayoutHash of the module's layout
+};
+
+struct DescriptorEntry
+{
+    uint8_t type;              // Interface type (e.g. OCTAVE_ID)
+    uint8_t parameter_version; // Of the Parameters struct it uses
+    uint8_t parameter_size;    // Bytes of parameters
+    uint8_t event_type;        // Events it produces, 0 if none
+};
+
+constexpr size_t DescriptorSize =
+    sizeof(DescriptorHeader) + MK_MAX_INTERFACES * sizeof(DescriptorEntry);
+static_assert(DescriptorSize <= 0xFF, "Descriptor too large, lower MK_MAX_INTERFACES");
+
+constexpr uint8_t TunnelChunk = MK_I2C_BUFFER - sizeof(TunnelHeader);
+constexpr uint8_t ReplyChunk = MK_I2C_BUFFER - sizeof(ReplyHeader);
+
 // --------------------------------------------------------------------
 // -- Parameter Settings
 // --------------------------------------------------------------------
@@ -167,16 +321,31 @@ struct ButtonParameters : public Parameters
     bool toggle = false;
 };
 
+// A copy of the parameters serialized in buffer, which holds at
+// least sizeof(T) bytes. They're packed so any address will do.
+template<typename T>
+T parameters_from(const uint8_t *buffer)
+{
+    return *reinterpret_cast<const T*>(buffer);
+}
+
+static_assert(sizeof(OctaveParameters) <= MK_MAX_PARAMETERS, "MK_MAX_PARAMETERS");
+static_assert(sizeof(PotParameters) <= MK_MAX_PARAMETERS, "MK_MAX_PARAMETERS");
+static_assert(sizeof(ButtonParameters) <= MK_MAX_PARAMETERS, "MK_MAX_PARAMETERS");
+
 // --------------------------------------------------------------------
 // -- Command Structures
 // --------------------------------------------------------------------
 
-// The "raw" command that comes from the serial input
+// The "raw" command that comes from the serial input. The payload
+// points into the SerialLink receive buffer and is only valid
+// while the command is being processed.
 struct Command
 {
     uint8_t id;
-    uint8_t size;
-    lutil::managed_data payload;
+    uint8_t seq; // 0 for v1 hosts
+    uint16_t size;
+    uint8_t *payload;
 };
 
 struct PreferencesHeader
@@ -188,13 +357,27 @@ struct PreferencesHeader
     uint8_t index;
 };
 
-inline void Message(const char *message)
+// A Command_PatchPreferences record, the new bytes follow
+struct PatchHeader
 {
-    Serial.write(Command_StartFlag);
-    Serial.write(Command_Message);
-    Serial.write(strlen(message));
-    Serial.write(message);
-}
+    uint8_t commander;
+    uint8_t index;
+
+    // Into the interface's parameters, counting the parameter type
+    uint8_t offset;
+    uint8_t size;
+};
+
+// Reply to Command_SetAll
+struct SetAllResult
+{
+    uint8_t status;  // 0 if everything was applied
+    uint8_t applied; // Number of interfaces updated
+    uint16_t offset; // Where in the payload we gave up
+};
+
+// Send a string to the Manager (see mk_protocol.cpp)
+void Message(const char *message);
 
 // Simple jenkins one-at-a-time hashing math.
 // https://en.wikipedia.org/wiki/Jenkins_hash_function
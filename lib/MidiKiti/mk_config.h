@@ -0,0 +1,298 @@
+#pragma once
+
+/**
+ * Compile-time capacities for every container in MidiKiti. Each of
+ * these can be overridden per board through the build_flags in
+ * platformio.ini (e.g. -D MK_MAX_INTERFACES=12). The defaults are
+ * sized so a Nano controller still leaves room for the stack.
+ *
+ * extra/scripts/ram_budget.py reads this file to print the RAM
+ * budget summary for each env when building.
+ */
+
+// Interfaces (pots, buttons, octaves) owned by a single MidiCommander
+#ifndef MK_MAX_INTERFACES
+#  if defined(__AVR__)
+#    define MK_MAX_INTERFACES 8
+#  else
+#    define MK_MAX_INTERFACES 32
+#  endif
+#endif
+
+// Events a MidiCommander can hold before the controller takes them.
+// Also used for the controller's per-loop event buffer.
+#ifndef MK_MAX_POOLED_EVENTS
+#  if defined(__AVR__)
+#    define MK_MAX_POOLED_EVENTS 16
+#  else
+#    define MK_MAX_POOLED_EVENTS 64
+#  endif
+#endif
+
+// I2C modules a MidiController can talk to
+#ifndef MK_MAX_CONNECTIONS
+#  if defined(__AVR__)
+#    define MK_MAX_CONNECTIONS 4
+#  else
+#    define MK_MAX_CONNECTIONS 16
+#  endif
+#endif
+
+// Octaves we can route keys for
+#ifndef MK_MAX_OCTAVES
+#  if defined(__AVR__)
+#    define MK_MAX_OCTAVES 4
+#  else
+#    define MK_MAX_OCTAVES 8
+#  endif
+#endif
+
+// Local (non-i2c) commanders on the controller
+#ifndef MK_MAX_LOCAL_COMMANDERS
+#  if defined(__AVR__)
+#    define MK_MAX_LOCAL_COMMANDERS 2
+#  else
+#    define MK_MAX_LOCAL_COMMANDERS 4
+#  endif
+#endif
+
+// Keys on a single MidiOctave
+#ifndef MK_MAX_KEYS
+#  define MK_MAX_KEYS 16
+#endif
+
+// Receive buffer for serial commands from the Manager. A command
+// larger than this is skipped.
+#ifndef MK_SERIAL_BUFFER
+#  if defined(__AVR__)
+#    define MK_SERIAL_BUFFER 64
+#  else
+#    define MK_SERIAL_BUFFER 288
+#  endif
+#endif
+
+// Time (us) scan_input may spend per runtime pass before handing
+// the loop back to the interfaces
+#ifndef MK_SERIAL_BUDGET_US
+#  define MK_SERIAL_BUDGET_US 250
+#endif
+
+// Largest serialized Parameters struct of any interface
+#ifndef MK_MAX_PARAMETERS
+#  define MK_MAX_PARAMETERS 32
+#endif
+
+// Transmit buffer for frames to the Manager. Protocol v2 needs room
+// for a full COBS block (255 bytes).
+#ifndef MK_SERIAL_TX_BUFFER
+#  if defined(__AVR__)
+#    define MK_SERIAL_TX_BUFFER 256
+#  else
+#    define MK_SERIAL_TX_BUFFER 512
+#  endif
+#endif
+
+// Size of one preference snapshot slot (header included). The
+// backend is split into as many slots as fit for wear levelling.
+#ifndef MK_SNAPSHOT_SLOT
+#  if defined(__AVR__)
+#    define MK_SNAPSHOT_SLOT 256
+#  else
+#    define MK_SNAPSHOT_SLOT 1024
+#  endif
+#endif
+
+// Slots kept in the snapshot file on an SD card
+#ifndef MK_SNAPSHOT_SD_SLOTS
+#  define MK_SNAPSHOT_SD_SLOTS 4
+#endif
+
+// Quiet time (ms) after a preference change before we save
+#ifndef MK_SNAPSHOT_DEBOUNCE_MS
+#  define MK_SNAPSHOT_DEBOUNCE_MS 2000
+#endif
+
+// Bytes written to the snapshot backend per host pass. The pass
+// can't be interrupted by the key scans, and on AVR each EEPROM byte
+// that changes takes ~3.3 ms, so there it's one at a time (a 256 byte
+// slot then takes a little over a second at MK_SERIAL_PERIOD_US).
+#ifndef MK_SNAPSHOT_CHUNK
+#  if defined(__AVR__)
+#    define MK_SNAPSHOT_CHUNK 1
+#  else
+#    define MK_SNAPSHOT_CHUNK 16
+#  endif
+#endif
+
+// Shortest (ms) the controller waits after the last module joins
+// before it starts the runtime. The wait grows with the gaps seen
+// between joins, up to MK_ENUMERATE_MAX_MS.
+#ifndef MK_ENUMERATE_MIN_MS
+#  define MK_ENUMERATE_MIN_MS 20
+#endif
+
+#ifndef MK_ENUMERATE_MAX_MS
+#  define MK_ENUMERATE_MAX_MS 500
+#endif
+
+// A module that hasn't heard back about its announcement tries
+// again after this long (ms)
+#ifndef MK_ENUMERATE_RETRY_MS
+#  define MK_ENUMERATE_RETRY_MS 10
+#endif
+
+// Size of the Wire library's buffer. A single poll never moves more
+// than this.
+#ifndef MK_I2C_BUFFER
+#  define MK_I2C_BUFFER 32
+#endif
+
+// Bus clock (Hz) the controller runs the I2C at. Fast mode, an idle
+// poll is then ~75 us on the wire rather than ~300.
+#ifndef MK_I2C_CLOCK
+#  define MK_I2C_CLOCK 400000
+#endif
+
+// Longest (us) a module waits for the second read of a poll (the
+// events) after the first told the controller how many there are.
+// Past it the next read is a new poll.
+#ifndef MK_I2C_POLL_GAP_US
+#  define MK_I2C_POLL_GAP_US 2000
+#endif
+
+// Longest (us) we let a single I2C transfer hang before giving up,
+// where the Wire library supports it
+#ifndef MK_I2C_TIMEOUT_US
+#  define MK_I2C_TIMEOUT_US 1000
+#endif
+
+// Polls in a row a module can miss before the controller drops it
+#ifndef MK_CONNECTION_MISSES
+#  define MK_CONNECTION_MISSES 8
+#endif
+
+// A module that hasn't been polled for this long (ms) assumes the
+// controller has dropped it and announces itself again
+#ifndef MK_MODULE_ORPHAN_MS
+#  define MK_MODULE_ORPHAN_MS 250
+#endif
+
+// Preference requests for I2C modules we can have in flight
+#ifndef MK_MAX_TUNNELS
+#  if defined(__AVR__)
+#    define MK_MAX_TUNNELS 2
+#  else
+#    define MK_MAX_TUNNELS 4
+#  endif
+#endif
+
+// How long (ms) a module has to answer a preference request
+#ifndef MK_TUNNEL_TIMEOUT_MS
+#  define MK_TUNNEL_TIMEOUT_MS 100
+#endif
+
+// Build the hot path probes (mk_probe.h) in. Off by default, when
+// off they compile to nothing.
+#ifndef MK_PROBES
+#  define MK_PROBES 0
+#endif
+
+// Power of two buckets in each probe's histogram. Bucket i counts
+// samples of [2^i, 2^(i+1)) ticks, the last one catches the rest.
+#ifndef MK_PROBE_BUCKETS
+#  if defined(__AVR__)
+#    define MK_PROBE_BUCKETS 16
+#  else
+#    define MK_PROBE_BUCKETS 24
+#  endif
+#endif
+
+// Fastest (ms) the host can ask for telemetry frames
+#ifndef MK_TELEMETRY_MIN_MS
+#  define MK_TELEMETRY_MIN_MS 50
+#endif
+
+// Log records (mk_log.h) held until the serial link is idle
+#ifndef MK_LOG_RECORDS
+#  if defined(__AVR__)
+#    define MK_LOG_RECORDS 8
+#  else
+#    define MK_LOG_RECORDS 32
+#  endif
+#endif
+
+// Most log records sent in one Command_Log frame
+#ifndef MK_LOG_DRAIN
+#  define MK_LOG_DRAIN 8
+#endif
+
+// Flight recorder entries (mk_recorder.h), 0 leaves it out
+#ifndef MK_RECORDER_ENTRIES
+#  if defined(__AVR__)
+#    define MK_RECORDER_ENTRIES 0
+#  else
+#    define MK_RECORDER_ENTRIES 256
+#  endif
+#endif
+
+// Entries still recorded after a trigger before the recorder
+// freezes, so the dump shows what happened next as well
+#ifndef MK_RECORDER_AFTER
+#  define MK_RECORDER_AFTER (MK_RECORDER_ENTRIES / 4)
+#endif
+
+// Build input tracing (mk_trace.h) in. Off by default, when off the
+// hooks compile to nothing.
+#ifndef MK_TRACING
+#  define MK_TRACING 0
+#endif
+
+// Bytes of trace records held until the serial link is idle
+#ifndef MK_TRACE_BUFFER
+#  if defined(__AVR__)
+#    define MK_TRACE_BUFFER 128
+#  else
+#    define MK_TRACE_BUFFER 1024
+#  endif
+#endif
+
+// Events mirrored to the host (mk_monitor.h) held between frames,
+// 0 leaves the monitor out
+#ifndef MK_MONITOR_RECORDS
+#  if defined(__AVR__)
+#    define MK_MONITOR_RECORDS 0
+#  else
+#    define MK_MONITOR_RECORDS 32
+#  endif
+#endif
+
+// How often (us) mk::Scheduler runs each kind of task, see
+// mk_scheduler.h. Sketches still on lutil's Processor run them all
+// every pass instead.
+#ifndef MK_SCAN_PERIOD_US
+#  define MK_SCAN_PERIOD_US 100
+#endif
+
+#ifndef MK_POT_PERIOD_US
+#  define MK_POT_PERIOD_US 1000
+#endif
+
+// The controller's event pass, I2C polls included
+#ifndef MK_EVENT_PERIOD_US
+#  define MK_EVENT_PERIOD_US 250
+#endif
+
+#ifndef MK_SERIAL_PERIOD_US
+#  define MK_SERIAL_PERIOD_US 5000
+#endif
+
+// State changes (lutil's Processor)
+#ifndef MK_STATE_PERIOD_US
+#  define MK_STATE_PERIOD_US 1000
+#endif
+
+// Time (us) an event pass may spend polling I2C modules. Whoever
+// doesn't fit is polled first next pass.
+#ifndef MK_I2C_BUDGET_US
+#  define MK_I2C_BUDGET_US 200
+#endif
@@ -1,6 +1,13 @@
 #include "mk_controller.h"
 #include "mk_interface.h"
 #include "mk_command.h"
+#include "mk_log.h"
+#include "mk_protocol.h"
+#include "mk_probe.h"
+#include "mk_recorder.h"
+#include "mk_trace.h"
+#include "mk_telemetry.h"
+#include "mk_monitor.h"
 
 #include <SoftwareSerial.h>
 
@@ -11,83 +18,307 @@
 // The controller listen on the extra hardware serial from our teensy
 // MIDI_CREATE_INSTANCE(HardwareSerial, Serial2, s_midi)
 
+static mk::MidiController *__controller_inst = nullptr;
+
+/* Handler for modules announcing themselves */
+void __handle_announcement(int count)
+{
+    if (!__controller_inst)
+    {
+        while (Wire.available() > 0)
+            Wire.read();
+        return;
+    }
+
+    __controller_inst->received(count);
+}
+
 namespace mk {
 
 using namespace lutil;
 
-void MidiConnection::send(uint8_t *bytes, uint8_t size)
+bool MidiConnection::send(uint8_t *bytes, uint8_t size)
 {
     Wire.beginTransmission(_address);
     Wire.write(bytes, size);
-    Wire.endTransmission();
+    return Wire.endTransmission() == 0;
 }
 
-bool MidiConnection::poll(Vec<RawEvent> &events)
+bool MidiConnection::poll(EventBuffer &events)
 {
-    // 1. Request an OK byte from the device as a handshake
-    // 2. Then sit on the line waiting for the events
-    //    to come in and pass them back.
-    
-    delayMicroseconds(25);
-    uint8_t size = Wire.requestFrom(_address, sizeof(byte));
-    if (size > 0)
+    // The header first, so a module with nothing pooled (most of
+    // them, most of the time) costs two bytes on the wire. A module
+    // that's gone away costs us a NACK and nothing more.
+    uint8_t size = Wire.requestFrom(_address, uint8_t(sizeof(PollHeader)));
+
+    PollHeader header{ 0xFF, 0 };
+    if (size >= sizeof(PollHeader))
     {
-        uint8_t eventCount = Wire.read();
-        if (eventCount < 0)
-            return false;
+        header.count = Wire.read();
+        header.dropped = Wire.read();
+    }
+
+    // The module has forgotten its drops once it's sent them, even
+    // if the events don't make it
+    if (header.count <= EventsPerPoll)
+        _add_dropped(header.dropped);
 
-        // With that done, we know there are events to process
-        // so we need to collect them.
-        delayMicroseconds(25);
+    // Then exactly the events it has for us
+    uint8_t wanted = 0;
+    if (header.count > 0 && header.count <= EventsPerPoll)
+    {
+        wanted = header.count * WireEventSize;
+        size = Wire.requestFrom(_address, wanted);
+    }
 
-        // Up to 127 simult events from a controller (yikes)
-        while (eventCount > 0)
+    if (header.count > EventsPerPoll || size < wanted)
+    {
+        // Nothing (or nonsense) came back
+        while (Wire.available() > 0)
+            Wire.read();
+
+        MK_TRACE(Trace_I2CReply, _address, nullptr, 0);
+
+        if (_missed < 0xFF)
+            _missed++;
+        return false;
+    }
+
+#if MK_TRACING
+    uint8_t reply[sizeof(PollHeader) + EventsPerPoll * WireEventSize];
+    memcpy(reply, &header, sizeof(PollHeader));
+#endif
+
+    for (uint8_t i = 0; i < header.count; i++)
+    {
+        RawEvent event = {0};
+        uint8_t *bytes = reinterpret_cast<uint8_t*>(&event);
+        for (uint8_t b = 0; b < WireEventSize; b++)
+            bytes[b] = Wire.read();
+
+#if MK_TRACING
+        memcpy(reply + sizeof(PollHeader) + i * WireEventSize, bytes, WireEventSize);
+#endif
+
+#if MK_MONITOR_RECORDS
+        stamp_event(event);
+#endif
+
+        // If the buffer is full the event is lost
+        MK_RECORD_EVENT(event);
+        if (!events.push(event))
         {
-            if (Wire.available() > 0)
-            {
-                eventCount--;
-
-                // We have an event incoming...
-
-                while (true)
-                {
-                    RawEvent event = {0};
-                    if (Wire.available())
-                    {
-                        // Asserted
-                        uint8_t type = Wire.read();
-                        uint8_t address = Wire.read();
-
-                        event.type = type;
-                        event.payload |= uint64_t(address) << 48;
-
-                        switch (type)
-                        {
-                        case KEY_EVENT_ID:
-                        {
-                            // key
-                            event.payload |= uint64_t(Wire.read()) << 40;
-
-                            // velocity
-                            event.payload |= uint64_t(Wire.read()) << 32;
-
-                            // pressed
-                            event.payload |= uint64_t(Wire.read()) << 24;
-                            break;
-                        }
-                        default:
-                            break;
-                        }
-
-                        events.push(event);
-                        break;
-                    }
-                }
-            }
+            _add_dropped(1);
+            MK_RECORD_TRIGGER(Trigger_Overflow, _address);
         }
     }
-    
-    return size > 0;
+
+    while (Wire.available() > 0)
+        Wire.read();
+
+    // Empty polls are what we assume on replay. The trace keeps
+    // both reads as one reply.
+    if (header.count > 0 || header.dropped > 0)
+    {
+        MK_TRACE(
+            Trace_I2CReply,
+            _address,
+            reply,
+            sizeof(PollHeader) + header.count * WireEventSize
+        );
+    }
+
+    _missed = 0;
+    return true;
+}
+
+void MidiConnection::_add_dropped(uint8_t count)
+{
+    _dropped = (_dropped > 0xFFFF - count) ? 0xFFFF : _dropped + count;
+}
+
+bool MidiConnection::push_preferences(Tunnel &tunnel)
+{
+    uint8_t n = min(uint8_t(tunnel.size - tunnel.offset), TunnelChunk);
+
+    TunnelHeader header{
+        I2C_SetPreferences,
+        tunnel.index,
+        tunnel.offset,
+        tunnel.size
+    };
+
+    Wire.beginTransmission(_address);
+    Wire.write(reinterpret_cast<uint8_t*>(&header), sizeof(TunnelHeader));
+    Wire.write(tunnel.data + tunnel.offset, n);
+    if (Wire.endTransmission() != 0)
+        return false;
+
+    tunnel.offset += n;
+    return tunnel.offset >= tunnel.size;
+}
+
+bool MidiConnection::pull_preferences(Tunnel &tunnel)
+{
+    if (!tunnel.requested)
+    {
+        TunnelHeader header{ I2C_GetPreferences, tunnel.index, 0, 0 };
+        tunnel.requested = send(
+            reinterpret_cast<uint8_t*>(&header),
+            sizeof(TunnelHeader)
+        );
+        return false;
+    }
+
+    // Point the module at the part we want, then read it
+    TunnelHeader header{ I2C_ReadReply, tunnel.index, tunnel.offset, 0 };
+    if (!send(reinterpret_cast<uint8_t*>(&header), sizeof(TunnelHeader)))
+        return false;
+
+    uint8_t size = Wire.requestFrom(_address, uint8_t(MK_I2C_BUFFER));
+
+    ReplyHeader reply{ 0, 0 };
+    if (size >= sizeof(ReplyHeader))
+    {
+        reply.ready = Wire.read();
+        reply.size = Wire.read();
+    }
+
+    bool done = false;
+    if (reply.ready)
+    {
+        if (reply.size > sizeof(tunnel.data))
+        {
+            // Nothing we can relay
+            tunnel.size = 0;
+            done = true;
+        }
+        else
+        {
+            tunnel.size = reply.size;
+
+            uint8_t n = min(uint8_t(tunnel.size - tunnel.offset), ReplyChunk);
+            for (uint8_t i = 0; i < n && Wire.available() > 0; i++)
+                tunnel.data[tunnel.offset++] = Wire.read();
+
+            done = tunnel.offset >= tunnel.size;
+        }
+    }
+
+    while (Wire.available() > 0)
+        Wire.read();
+
+    return done;
+}
+
+bool MidiConnection::describe()
+{
+    if (_described)
+        return true;
+
+    TunnelHeader header{ I2C_ReadDescriptor, 0, _descriptor_read, 0 };
+    if (!send(reinterpret_cast<uint8_t*>(&header), sizeof(TunnelHeader)))
+    {
+        if (_missed < 0xFF)
+            _missed++;
+        return false;
+    }
+
+    uint8_t size = Wire.requestFrom(_address, uint8_t(MK_I2C_BUFFER));
+
+    ReplyHeader reply{ 0, 0 };
+    if (size >= sizeof(ReplyHeader))
+    {
+        reply.ready = Wire.read();
+        reply.size = Wire.read();
+    }
+
+    if (reply.ready
+        && reply.size >= sizeof(DescriptorHeader)
+        && reply.size <= sizeof(_descriptor))
+    {
+        uint8_t n = min(uint8_t(reply.size - _descriptor_read), ReplyChunk);
+        for (uint8_t i = 0; i < n && Wire.available() > 0; i++)
+            _descriptor[_descriptor_read++] = Wire.read();
+    }
+
+    while (Wire.available() > 0)
+        Wire.read();
+
+    if (reply.size == 0 || _descriptor_read < reply.size)
+    {
+        // Still talking to us, just not done yet
+        _missed = 0;
+        return false;
+    }
+
+    DescriptorHeader descriptor;
+    memcpy(&descriptor, _descriptor, sizeof(DescriptorHeader));
+
+    if (descriptor.version != MK_DESCRIPTOR_VERSION
+        || reply.size != sizeof(DescriptorHeader)
+            + descriptor.count * sizeof(DescriptorEntry))
+    {
+        // Start over, we'll drop the module if it keeps this up
+        _descriptor_read = 0;
+        if (_missed < 0xFF)
+            _missed++;
+        return false;
+    }
+
+    _described = true;
+    _missed = 0;
+    return true;
+}
+
+uint32_t MidiConnection::layout() const
+{
+    if (!_described)
+        return _uuid;
+
+    DescriptorHeader header;
+    memcpy(&header, _descriptor, sizeof(DescriptorHeader));
+    return header.layout;
+}
+
+uint8_t MidiConnection::interface_count() const
+{
+    return _described ? _descriptor[1] : 0;
+}
+
+const DescriptorEntry &MidiConnection::interface(uint8_t index) const
+{
+    return *reinterpret_cast<const DescriptorEntry*>(
+        _descriptor + sizeof(DescriptorHeader) + index * sizeof(DescriptorEntry)
+    );
+}
+
+bool MidiConnection::has_interface(uint8_t type) const
+{
+    for (uint8_t i = 0; i < interface_count(); i++)
+    {
+        if (interface(i).type == type)
+            return true;
+    }
+    return false;
+}
+
+void MidiConnection::rejoin()
+{
+    // It may have been reflashed, so we ask again
+    _online = true;
+    _engaged = false;
+    _missed = 0;
+    _described = false;
+    _descriptor_read = 0;
+}
+
+bool MidiConnection::engage()
+{
+    _engaged = send((uint8_t *)ENGAGE_COMMAND, 3);
+    if (!_engaged && _missed < 0xFF)
+        _missed++;
+    return _engaged;
 }
 
 MidiController::MidiController(const Config &config, int ready_out)
@@ -96,6 +327,8 @@ MidiController::MidiController(const Config &config, int ready_out)
     , _event_count(0)
     , _ready_out(ready_out)
     , _last_address(0)
+    , _events_task(&MidiController::_run_events, this, MK_EVENT_PERIOD_US, Priority_High)
+    , _host_task(&MidiController::_run_host, this, MK_SERIAL_PERIOD_US, Priority_Low)
     , _config(config)
 {
     // -- Transitions
@@ -114,16 +347,29 @@ bool MidiController::boot()
 {
     //
     // Three primary components to the boot process
-    // 1. Initialize the I2C
+    // 1. Initialize the I2C, listening for module announcements
     // 2. MIDI Interface Setup and Pins
     // 3. Move the READY_RUN_OUTPUT to high to initialize
     //    the connection process.
     //
-    Wire.begin();
+    __controller_inst = this;
+    Wire.begin(MK_I2C_CONTROLLER);
+    Wire.setClock(MK_I2C_CLOCK);
+    Wire.onReceive(__handle_announcement);
+
+#if defined(WIRE_HAS_TIMEOUT)
+    // A module browning out mid-transfer mustn't hang the bus
+    Wire.setWireTimeout(MK_I2C_TIMEOUT_US, true);
+#endif
 
     // We also hook up the MIDI interface here :D
     // s_midi.begin();
 
+    _store.begin(SnapshotBackend::create(_config.sdPin));
+
+    _boot_time = millis();
+    _last_join = _boot_time;
+
     if (_ready_out >= 0)
         digitalWrite(_ready_out, HIGH);
     return true;
@@ -131,85 +377,286 @@ bool MidiController::boot()
 
 bool MidiController::connected()
 {
-    unsigned long time = millis();
-    if ((_ready_out < 0) || (_last_connection + 500 < time))
-    {
-        //
-        // We're ready to move into the runtime phase, but we
-        // want to check to see if we have existing preferences
-        //
-        // bool ok;
-        // Preferences prefs = Preferences::Read(_config.sdPin, &ok);
-        // if (!ok)
-        //     return true; // Just skip
-        //
-        // lutil::DataStream stream;
-        // uint32_t seed = 0;
-        // for (item : _local)
-        // {
-        //     item->push_layout(&stream);
-        //     while (stream->available())
-        //     {
-        //         uint8_t d = stream->read();
-        //         seed = mk::hash(&d, 1, seed);
-        //     }
-        // }
-        // if (seed == prefs.hash())
-        // {
-        //     // We can reuse!
-        //     prefs.
-        // }
-        //
+    bool ready = false;
 
-        return true;
+    if (_config.expected_modules >= 0)
+    {
+        // We know what we're waiting for
+        ready = int(_connections.count()) >= _config.expected_modules
+            || millis() - _boot_time >= MK_ENUMERATE_MAX_MS;
     }
-    return false;
+    else
+    {
+        // Modules arbitrate for the bus so they arrive back to
+        // back. Once it's been quiet for a few of the longest gaps
+        // we've seen, everyone is in.
+        unsigned long wait = max(
+            (unsigned long)MK_ENUMERATE_MIN_MS,
+            _longest_gap * 4
+        );
+        wait = min(wait, (unsigned long)MK_ENUMERATE_MAX_MS);
+        ready = millis() - _last_join >= wait;
+    }
+
+    // Give everyone a chance to send their descriptor
+    if (!_all_described() && millis() - _last_join < MK_ENUMERATE_MAX_MS)
+        ready = false;
+
+    if (!ready)
+        return false;
+
+    //
+    // We're ready to move into the runtime phase, but we
+    // want to check to see if we have existing preferences
+    // for this exact rig
+    //
+    uint16_t size = _store.load(_layout_hash());
+    if (size > 0)
+    {
+        SetAllResult result;
+        if (!_apply_records(_store.buffer(), size, result))
+            MK_LOG(Log_SnapshotRejected, result.offset);
+    }
+
+    return true;
 }
 
-void MidiController::discover()
+void MidiController::received(int /*count*/)
 {
-    if (Wire.available() > 0)
+    uint8_t buffer[sizeof(Announcement)];
+    size_t size = 0;
+
+    while (Wire.available() > 0)
     {
-        // We have a new connection now!
-        _last_connection = ElapsedMicros();
+        uint8_t b = Wire.read();
+        if (size < sizeof(buffer))
+            buffer[size++] = b;
+    }
 
-        uint16_t uuid = Wire.read();
+    MK_TRACE(Trace_I2CReceive, MK_I2C_CONTROLLER, buffer, size);
 
-        // The first 8 bits tell use if this is an Octave (for
-        // which we support multiple)
-        bool isOctave = uuid == OCTAVE_ID;
-        uuid = uuid << 8;
-        uuid |= Wire.read();
+    if (size != sizeof(Announcement) || buffer[0] != I2C_Announce)
+        return;
 
-        delayMicroseconds(50);
-        Wire.beginTransmission(0xFE);
-        Wire.write(_last_address++);
-        Wire.endTransmission();
+    Announcement announcement;
+    memcpy(&announcement, buffer, sizeof(Announcement));
+    _announcements.push(announcement);
+}
 
-        MidiConnection *conn = new MidiConnection(uuid, _last_address);
+MidiConnection *MidiController::_find_connection(uint32_t uid)
+{
+    auto it = _connections.begin();
+    for (; it != _connections.end(); it++)
+    {
+        if ((*it)->uid() == uid)
+            return *it;
+    }
+    return nullptr;
+}
+
+void MidiController::_join(const Announcement &announcement)
+{
+    // A module that didn't hear its assignment, or has restarted,
+    // gets the same address back
+    MidiConnection *conn = _find_connection(announcement.uid);
+    if (conn)
+    {
+        conn->rejoin();
+    }
+    else
+    {
+        if (_connections.full())
+            return; // No room for this module
+
+        // We have a new connection now!
+        conn = new MidiConnection(
+            announcement.uid,
+            announcement.uuid,
+            _next_address++
+        );
         _connections.push(conn);
 
-        if (isOctave)
-            _octaves.push(uuid);
+        unsigned long now = millis();
+        _longest_gap = max(_longest_gap, now - _last_join);
+        _last_join = now;
     }
+
+    Assignment assignment{ I2C_Assign, announcement.uid, conn->address() };
+    Wire.beginTransmission(MK_I2C_ENUMERATE);
+    Wire.write(reinterpret_cast<uint8_t*>(&assignment), sizeof(Assignment));
+    Wire.endTransmission();
+
+    MK_LOG(Log_ModuleJoined, conn->address());
 }
 
-void MidiController::runtime()
+void MidiController::discover()
 {
-    Vec<RawEvent> events;
+    // Take what the receive handler has heard so far
+    Announcement pending[MK_MAX_CONNECTIONS];
+    size_t count = 0;
+
+    noInterrupts();
+    for (; count < _announcements.count(); count++)
+        pending[count] = _announcements[count];
+    _announcements.clear();
+    interrupts();
 
+    for (size_t i = 0; i < count; i++)
+        _join(pending[i]);
+
+    // Modules that have moved onto their address tell us about
+    // themselves
     auto it = _connections.begin();
     for (; it != _connections.end(); it++)
     {
-        MidiConnection *conn = (*it);
-        conn->poll(events);
+        if (!(*it)->described())
+            _describe(*it);
+    }
+}
+
+bool MidiController::_describe(MidiConnection *conn)
+{
+    if (!conn->describe())
+        return false;
+
+    // Octaves (for which we support multiple) route keys by the
+    // order they joined in. A module coming back keeps its place.
+    if (conn->has_interface(OCTAVE_ID))
+    {
+        bool known = false;
+        auto it = _octaves.begin();
+        for (; it != _octaves.end(); it++)
+            known = known || (*it) == conn->address();
+
+        if (!known && !_octaves.push(conn->address()))
+            MK_LOG(Log_TooManyOctaves, MK_MAX_OCTAVES);
+    }
+
+    return true;
+}
+
+bool MidiController::_all_described()
+{
+    auto it = _connections.begin();
+    for (; it != _connections.end(); it++)
+    {
+        if (!(*it)->described())
+            return false;
     }
+    return true;
+}
+
+void MidiController::_rediscover()
+{
+    // One at a time so a module (re)joining never costs a pass
+    // more than a single transfer
+    bool pending = false;
+    Announcement announcement;
 
-    if (events.count() > 0)
+    noInterrupts();
+    if (_announcements.count() > 0)
+    {
+        announcement = _announcements[0];
+        _announcements.erase(0);
+        pending = true;
+    }
+    interrupts();
+
+    if (!pending)
+        return;
+
+    _join(announcement);
+}
+
+void MidiController::runtime()
+{
+    if (Scheduler::get().running())
+    {
+        _events_task.arm();
+        _host_task.arm();
+        return;
+    }
+
+    _telemetry.begin_pass();
+    _event_pass();
+    _host_pass();
+    _telemetry.end_pass();
+}
+
+void MidiController::_run_events(void *context)
+{
+    MidiController *controller = static_cast<MidiController*>(context);
+
+    controller->_telemetry.begin_pass();
+    controller->_event_pass();
+    controller->_telemetry.end_pass();
+}
+
+void MidiController::_run_host(void *context)
+{
+    static_cast<MidiController*>(context)->_host_pass();
+}
+
+void MidiController::_poll_connections()
+{
+    size_t count = _connections.count();
+    if (count == 0)
+        return;
+
+    // Always at least one, the rest as long as the budget lasts.
+    // Whoever we don't get to goes first next time.
+    ElapsedMicros elapsed;
+    for (size_t n = 0; n < count; n++)
+    {
+        if (n > 0 && elapsed >= MK_I2C_BUDGET_US)
+            break;
+
+        if (_next_poll >= count)
+            _next_poll = 0;
+        MidiConnection *conn = _connections[_next_poll++];
+
+        if (!conn->online())
+            continue;
+
+        // Anything that (re)joined while we were running sends its
+        // descriptor and is engaged first. It'll be on its new
+        // address a pass or two from now.
+        bool answered = false;
+        if (!conn->described())
+            answered = _describe(conn) || conn->missed() == 0;
+        else if (!conn->engaged())
+            answered = conn->engage();
+        else
+        {
+            MK_PROBE(Probe_Poll);
+            TelemetryTimer timer(_telemetry, Telemetry::Poll);
+            answered = conn->poll(_events);
+        }
+
+        if (!answered && conn->missed() >= MK_CONNECTION_MISSES)
+        {
+            // Stop spending time on it. It'll announce itself
+            // again once it notices we've stopped polling.
+            MK_LOG(Log_ModuleDropped, conn->address(), conn->missed());
+            conn->drop();
+        }
+    }
+}
+
+void MidiController::_event_pass()
+{
+    MK_PROBE(Probe_Loop);
+
+    _events.clear();
+    _poll_connections();
+
+    size_t pass_events = _events.count();
+
+    if (_events.count() > 0)
     {
         // Process all events at the same time.
-        auto eit = events.begin();
-        for (; eit != events.end(); eit++)
+        auto eit = _events.begin();
+        for (; eit != _events.end(); eit++)
             _process_event(*eit);
     }
 
@@ -219,65 +666,135 @@ void MidiController::runtime()
         MidiCommander *command = (*lit);
 
         // Consume the events
-        lutil::Vec<RawEvent> events;
-        command->take_events(events);
+        _events.clear();
+        _telemetry.note_pool(command->pooled());
+        command->take_events(_events);
+        pass_events += _events.count();
 
-        auto eit = events.begin();
-        for (; eit != events.end(); eit++)
+        auto eit = _events.begin();
+        for (; eit != _events.end(); eit++)
         {
             _process_event(*eit);
         }
     }
 
-    while(usbMIDI.read()){}
+    _telemetry.add_events(pass_events);
+
+    {
+        MK_PROBE(Probe_UsbIn);
+        TelemetryTimer timer(_telemetry, Telemetry::Usb);
+        while(usbMIDI.read()){}
+    }
+}
+
+void MidiController::_host_pass()
+{
+    // A step of any remote preference work
+    _tunnel();
+
+    // Modules that were late, or are coming back
+    _rediscover();
+
+    // Save any preference changes once they've settled. The
+    // write itself is spread over many passes.
+    if (_store.due())
+        _store.save(_layout_hash(), _snapshot(_store.buffer(), _store.capacity()));
+    _store.update();
 
     // We'll also check for input commands from the
     // Serial lines. This way, we can have a computer
     // manage the preference settings, among other
     // future activities
     scan_input();
+
+    _send_telemetry();
+}
+
+void MidiController::_send_telemetry()
+{
+    TelemetryFrame frame;
+    if (!_telemetry.take(frame))
+        return;
+
+    // Wherever they were lost: a local pool, a module's pool, or
+    // our own buffer when a poll brought in too many
+    frame.dropped = 0;
+    auto lit = _local.begin();
+    for (; lit != _local.end(); lit++)
+        frame.dropped += (*lit)->dropped_events();
+
+    auto cit = _connections.begin();
+    for (; cit != _connections.end(); cit++)
+        frame.dropped += (*cit)->dropped_events();
+
+    frame.modules = 0;
+    auto it = _connections.begin();
+    for (; it != _connections.end(); it++)
+        frame.modules += (*it)->online() ? 1 : 0;
+
+    frame.connections = _connections.count();
+    frame.rx_errors = SerialLink::get().rx_errors();
+    Scheduler &scheduler = Scheduler::get();
+    frame.missed = scheduler.misses();
+
+    // Under the scheduler the time between our passes is mostly
+    // idle, what the interfaces and lutil took is whatever the
+    // other tasks were busy for
+    if (scheduler.running())
+    {
+        frame.busy_high = scheduler.busy(Priority_High);
+        frame.busy_normal = scheduler.busy(Priority_Normal);
+        frame.busy_low = scheduler.busy(Priority_Low);
+        frame.late_max = min(scheduler.worst_late(), uint32_t(0xFFFF));
+
+        frame.scan = frame.busy_high + frame.busy_normal + frame.busy_low
+            - _events_task.busy() - _host_task.busy();
+        scheduler.clear_stats();
+    }
+
+    SerialLink::get().send(
+        Command_Telemetry,
+        reinterpret_cast<uint8_t*>(&frame),
+        sizeof(TelemetryFrame)
+    );
 }
 
 void MidiController::scan_input()
 {
-    while (Serial.available())
+    MK_PROBE(Probe_Serial);
+    TelemetryTimer timer(_telemetry, Telemetry::Serial);
+
+    // Pull whatever has arrived in as few reads as we can, but
+    // never hold the loop longer than our budget
+    SerialLink &link = SerialLink::get();
+
+    bool idle = false;
+    ElapsedMicros elapsed;
+    while (elapsed < MK_SERIAL_BUDGET_US)
     {
-        if (!_receiving)
+        Command command;
+        if (!link.next(command))
         {
-            uint8_t b = Serial.read();
-            if (b == Command_StartFlag)
-            {
-                // Pulled High - time to start
-                // reading a command.
-                _receiving = new Command();
-                _receiving->id = Command_StartFlag;
-                _receiving->size = Command_StartFlag;
-            }
-        }
-        else if (_receiving->id == Command_StartFlag)
-        {
-            _receiving->id = Serial.read();
+            idle = link.fill() == 0;
+            if (idle)
+                break;
+            continue;
         }
-        else if (_receiving->size == Command_StartFlag)
-        {
-            _receiving->size = Serial.read();
-            _receiving->payload = lutil::managed_data(
-                _receiving->size
-            );
-        }
-        else
-        {
-            _receiving->payload[_payload_index++] = Serial.read();
-            if (_payload_index >= _receiving->size)
-            {
-                // We've got a command ready.
-                process_command(*_receiving);
 
-                delete _receiving;
-                _receiving = nullptr;
-                _payload_index = 0;
-            }
-        }
+        process_command(command);
+        link.consume();
+    }
+
+    // Logging waits until the host has nothing more for us
+    if (idle)
+    {
+        Log::get().drain();
+#if MK_TRACING
+        Tracer::get().drain();
+#endif
+#if MK_MONITOR_RECORDS
+        _monitor.drain();
+#endif
     }
 }
 
@@ -287,56 +804,81 @@ void MidiController::process_command(Command &command)
     {
     case Command_GetLayout:
     {
+        SerialLink &link = SerialLink::get();
+
         // First, we write the number of commanders:
         uint8_t count = _connections.count();
         count += _local.count();
 
-        Serial.write(Command_StartFlag);
-        Serial.write(Command_GetLayout);
-        Serial.write(count);
-
-        // TODO
-        // auto it = _connections.begin();
-        // for (; it != _connections.end(); it++)
-        // {
-        //     _push_layout(*it);
-        // }
+        // Then each commander's interface count and types
+        uint16_t size = 1;
+        auto it = _connections.begin();
+        for (; it != _connections.end(); it++)
+            size += 1 + (*it)->interface_count();
 
         auto lit = _local.begin();
         for (; lit != _local.end(); lit++)
+            size += 1 + (*lit)->components().count();
+
+        if (link.version() < 2)
+        {
+            // Version 1 hosts read the count in place of the size
+            link.begin(Command_GetLayout, count);
+        }
+        else
+        {
+            link.begin(Command_GetLayout, size);
+            link.write(count);
+        }
+
+        // Remote modules answer from their descriptor
+        for (it = _connections.begin(); it != _connections.end(); it++)
         {
-            (*lit)->push_layout(&Serial);
+            MidiConnection *conn = (*it);
+            link.write(conn->interface_count());
+            for (uint8_t i = 0; i < conn->interface_count(); i++)
+                link.write(conn->interface(i).type);
         }
 
+        for (lit = _local.begin(); lit != _local.end(); lit++)
+        {
+            (*lit)->push_layout(&link);
+        }
+
+        link.end();
         break;
     }
     case Command_GetPreferences:
     {
+        if (command.size < sizeof(PreferencesHeader))
+            break;
+
         PreferencesHeader *comm = reinterpret_cast<PreferencesHeader*>(
-            command.payload.get()
+            command.payload
         );
 
-        uint8_t idx = comm->commander;
-        if (idx >= _connections.count())
+        MidiCommander *commander = _local_commander(comm->commander);
+        if (commander)
         {
-            idx -= _connections.count();
-            MidiCommander *commander = _local[idx];
-
             // Write to the Serial line
-            commander->query_preferences(comm->index);
+            commander->query_preferences(comm->commander, comm->index);
         }
         else
         {
-            // TODO: MidiConnection::push_preferences()
+            // Relayed once the module answers
+            _queue_tunnel(command, comm->commander);
         }
 
-        Message("Prefs Requested");
+        MK_LOG(Log_PrefsRequested, comm->commander, comm->index);
 
         break;
     }
     case Command_SetPreferences:
     {
-        uint8_t *data = command.payload.get();
+        if (command.size < sizeof(PreferencesHeader) + 1)
+            break;
+
+        uint8_t *data = command.payload;
 
         PreferencesHeader *comm = reinterpret_cast<PreferencesHeader*>(
             data
@@ -345,36 +887,531 @@ void MidiController::process_command(Command &command)
         // Start of the actual Preferences bytes
         data = data + sizeof(PreferencesHeader);
 
-        uint8_t idx = comm->commander;
-        if (idx >= _connections.count())
+        MidiCommander *commander = _local_commander(comm->commander);
+        if (commander)
         {
-            idx -= _connections.count();
-            MidiCommander *commander = _local[idx];
+            // The size byte can't promise more than the frame holds,
+            // and nothing is applied unless all of it checks out
+            uint8_t size = data[0];
+            if (size > command.size - sizeof(PreferencesHeader) - 1
+                || !commander->check_preferences(comm->index, size, data + 1))
+            {
+                MK_LOG(Log_InvalidPreferences, comm->commander, comm->index);
+                break;
+            }
 
-            Message("Set Preference");
             commander->set_preferences(
                 comm->index,
-                data[0],
+                size,
                 data + 1
             );
 
+            MK_LOG(Log_ParamsSet, comm->commander, comm->index);
+            _store.touch();
+
         }
         else
         {
-            // TODO: MidiConnection::push_preferences()
+            _queue_tunnel(command, comm->commander);
+        }
+
+        break;
+    }
+    case Command_DumpAll:
+    {
+        _dump_all();
+        break;
+    }
+    case Command_GetProbes:
+    {
+        SerialLink &link = SerialLink::get();
+
+#if MK_PROBES
+        if (link.version() < 2)
+        {
+            MK_LOG(Log_NeedsProtocolV2, Command_GetProbes);
+            break;
         }
 
+        Probes &probes = Probes::get();
+        link.begin(Command_GetProbes, Probes::dump_size());
+        probes.dump(&link);
+        link.end();
+
+        // A non-zero byte asks us to start over
+        if (command.size > 0 && command.payload[0])
+            probes.reset();
+#else
+        // Nothing to report, no probes were built in
+        link.send(Command_GetProbes, nullptr, 0);
+#endif
         break;
     }
+    case Command_Telemetry:
+    {
+        // interval (ms, 16) - 0 stops the frames
+        uint16_t interval = 0;
+        if (command.size >= sizeof(interval))
+            memcpy(&interval, command.payload, sizeof(interval));
+
+        _telemetry.set_interval(interval);
+        Scheduler::get().clear_stats();
+        break;
+    }
+    case Command_SetAll:
+    {
+        _set_all(command);
+        break;
     }
+    case Command_PatchPreferences:
+    {
+        _patch(command);
+        break;
+    }
+    case Command_Profile:
+    {
+        // layout (32) | preferences (32)
+        uint32_t profile[2] = { _layout_hash(), _preferences_hash() };
+        SerialLink::get().send(
+            Command_Profile,
+            reinterpret_cast<uint8_t*>(profile),
+            sizeof(profile)
+        );
+        break;
+    }
+    case Command_Monitor:
+    {
+        SerialLink &link = SerialLink::get();
+        bool on = command.size > 0 && command.payload[0];
+
+#if MK_MONITOR_RECORDS
+        if (on && link.version() < 2)
+        {
+            MK_LOG(Log_NeedsProtocolV2, Command_Monitor);
+            break;
+        }
+
+        if (on)
+            _monitor.start();
+        else
+            _monitor.stop();
+#else
+        // Nothing to mirror, tell the host so it doesn't wait
+        if (on)
+            link.send(Command_Monitor, nullptr, 0);
+#endif
+        break;
+    }
+    case Command_Trace:
+    {
+        SerialLink &link = SerialLink::get();
+        bool on = command.size > 0 && command.payload[0];
+
+#if MK_TRACING
+        if (on && link.version() < 2)
+        {
+            MK_LOG(Log_NeedsProtocolV2, Command_Trace);
+            break;
+        }
+
+        if (on)
+            Tracer::get().start();
+        else
+            Tracer::get().stop();
+#else
+        // Nothing to trace, tell the host so it doesn't wait
+        if (on)
+            link.send(Command_Trace, nullptr, 0);
+#endif
+        break;
+    }
+    case Command_Recorder:
+    {
+        SerialLink &link = SerialLink::get();
+        uint8_t op = command.size > 0 ? command.payload[0] : uint8_t(Recorder_Dump);
+
+#if MK_RECORDER_ENTRIES
+        Recorder &recorder = Recorder::get();
+        switch (op)
+        {
+        case Recorder_Dump:
+        {
+            if (link.version() < 2)
+            {
+                MK_LOG(Log_NeedsProtocolV2, Command_Recorder);
+                break;
+            }
+
+            // Hold it still while it goes out
+            recorder.freeze();
+            link.begin(Command_Recorder, recorder.dump_size());
+            recorder.dump(&link);
+            link.end();
+            break;
+        }
+        case Recorder_Arm:
+            recorder.arm();
+            break;
+        case Recorder_Freeze:
+            recorder.trigger(Trigger_Host);
+            break;
+        }
+#else
+        // Nothing recorded, the recorder wasn't built in
+        if (op == Recorder_Dump)
+            link.send(Command_Recorder, nullptr, 0);
+#endif
+        break;
+    }
+    }
+}
+
+void MidiController::_queue_tunnel(Command &command, uint8_t commander)
+{
+    if (commander >= _connections.count())
+    {
+        MK_LOG(Log_InvalidCommander, commander);
+        return;
+    }
+
+    PreferencesHeader *header = reinterpret_cast<PreferencesHeader*>(
+        command.payload
+    );
+
+    Tunnel tunnel;
+    tunnel.command = command.id;
+    tunnel.seq = command.seq;
+    tunnel.commander = commander;
+    tunnel.index = header->index;
+    tunnel.size = 0;
+    tunnel.offset = 0;
+    tunnel.requested = false;
+    tunnel.started = millis();
+
+    if (command.id == Command_SetPreferences)
+    {
+        // PreferencesHeader | size | parameters...
+        uint8_t *data = command.payload + sizeof(PreferencesHeader);
+        tunnel.size = data[0];
+
+        if (tunnel.size == 0
+            || tunnel.size > sizeof(tunnel.data)
+            || command.size < sizeof(PreferencesHeader) + 1 + tunnel.size)
+        {
+            MK_LOG(Log_InvalidPreferences, commander, tunnel.index);
+            return;
+        }
+
+        memcpy(tunnel.data, data + 1, tunnel.size);
+    }
+
+    if (!_tunnels.push(tunnel))
+        MK_LOG(Log_ModuleBusy, commander);
+}
+
+void MidiController::_tunnel()
+{
+    if (_tunnels.empty())
+        return;
+
+    Tunnel &tunnel = _tunnels[0];
+    MidiConnection *conn = _connections[tunnel.commander];
+
+    if (!conn->online() || millis() - tunnel.started >= MK_TUNNEL_TIMEOUT_MS)
+    {
+        MK_LOG(Log_ModuleTimeout, tunnel.commander);
+        _reply_tunnel(tunnel, false);
+        _tunnels.erase(0);
+        return;
+    }
+
+    bool done = (tunnel.command == Command_SetPreferences)
+        ? conn->push_preferences(tunnel)
+        : conn->pull_preferences(tunnel);
+
+    if (!done)
+        return;
+
+    // A Get the module had nothing for comes back empty
+    _reply_tunnel(tunnel, tunnel.command == Command_SetPreferences || tunnel.size > 0);
+    _tunnels.erase(0);
+}
+
+void MidiController::_reply_tunnel(const Tunnel &tunnel, bool ok)
+{
+    // Sets are only answered when they didn't make it
+    if (tunnel.command == Command_SetPreferences && ok)
+        return;
+
+    // Answer the request it came from, the Manager has moved on
+    // since. Just the header when there's nothing to give, so it
+    // doesn't sit out its own timeout and ask again.
+    uint8_t size = (tunnel.command == Command_GetPreferences && ok) ? tunnel.size : 0;
+
+    SerialLink &link = SerialLink::get();
+    link.begin(tunnel.command, sizeof(PreferencesHeader) + size, tunnel.seq);
+
+    PreferencesHeader header{ tunnel.commander, tunnel.index };
+    link.write(reinterpret_cast<uint8_t*>(&header), sizeof(PreferencesHeader));
+    link.write(tunnel.data, size);
+    link.end();
+}
+
+MidiCommander *MidiController::_local_commander(uint8_t index)
+{
+    if (index < _connections.count())
+        return nullptr;
+
+    index -= _connections.count();
+    if (index >= _local.count())
+        return nullptr;
+
+    return _local[index];
+}
+
+void MidiController::_dump_all()
+{
+    //
+    // The whole topology and every interface's parameters in one
+    // frame:
+    //
+    //  commander count
+    //  for each commander:
+    //      interface count
+    //      for each interface: type | size | parameters...
+    //
+    SerialLink &link = SerialLink::get();
+    if (link.version() < 2)
+    {
+        MK_LOG(Log_NeedsProtocolV2, Command_DumpAll);
+        return;
+    }
+
+    uint16_t size = 1;
+    auto it = _connections.begin();
+    for (; it != _connections.end(); it++)
+        size += 1 + 2 * (*it)->interface_count();
+
+    auto lit = _local.begin();
+    for (; lit != _local.end(); lit++)
+        size += (*lit)->dump_size();
+
+    link.begin(Command_DumpAll, size);
+    link.write(uint8_t(_connections.count() + _local.count()));
+
+    // Remote modules answer from their descriptor. Their parameters
+    // are left empty (size 0) for the host to ask for separately.
+    for (it = _connections.begin(); it != _connections.end(); it++)
+    {
+        MidiConnection *conn = (*it);
+        link.write(conn->interface_count());
+        for (uint8_t i = 0; i < conn->interface_count(); i++)
+        {
+            link.write(conn->interface(i).type);
+            link.write(uint8_t(0));
+        }
+    }
+
+    for (lit = _local.begin(); lit != _local.end(); lit++)
+        (*lit)->dump_preferences(&link);
+
+    link.end();
+}
+
+void MidiController::_set_all(Command &command)
+{
+    SetAllResult result;
+    if (_apply_records(command.payload, command.size, result))
+        _store.touch();
+
+    SerialLink::get().send(
+        Command_SetAll,
+        reinterpret_cast<uint8_t*>(&result),
+        sizeof(SetAllResult)
+    );
+}
+
+void MidiController::_patch(Command &command)
+{
+    //
+    // Edits from the Manager, a run of:
+    //
+    //  commander | index | offset | size | bytes...
+    //
+    // Local interfaces only. Like SetAll it's all or nothing, but
+    // there's no reply, the Manager already knows what it sent.
+    //
+    for (uint8_t apply = 0; apply < 2; apply++)
+    {
+        uint16_t offset = 0;
+        while (offset < command.size)
+        {
+            uint8_t *record = command.payload + offset;
+
+            // offset < command.size, so there's no wrapping
+            size_t remaining = size_t(command.size) - offset;
+
+            PatchHeader header{};
+            if (remaining >= sizeof(PatchHeader))
+                memcpy(&header, record, sizeof(PatchHeader));
+
+            MidiCommander *commander = _local_commander(header.commander);
+            if (remaining < sizeof(PatchHeader) + header.size
+                || !commander
+                || !commander->patch_preferences(
+                    header.index,
+                    header.offset,
+                    header.size,
+                    record + sizeof(PatchHeader),
+                    apply))
+            {
+                MK_LOG(Log_PatchRejected, offset);
+                return;
+            }
+
+            offset += sizeof(PatchHeader) + header.size;
+        }
+    }
+
+    _store.touch();
+}
+
+bool MidiController::_apply_records(
+    uint8_t *data,
+    uint16_t size,
+    SetAllResult &result)
+{
+    //
+    // A run of SetPreferences payloads:
+    //
+    //  commander | index | size | parameters...
+    //
+    // Everything is checked before anything is applied so the
+    // Manager either gets all of it or none of it.
+    //
+    const uint8_t header = sizeof(PreferencesHeader) + 1;
+
+    result = SetAllResult{ 0, 0, 0 };
+
+    uint16_t offset = 0;
+    while (offset < size)
+    {
+        uint8_t *record = data + offset;
+        if (size - offset < header
+            || size - offset < header + record[2])
+        {
+            result.status = 1;
+            break;
+        }
+
+        PreferencesHeader *comm = reinterpret_cast<PreferencesHeader*>(
+            record
+        );
+
+        MidiCommander *commander = _local_commander(comm->commander);
+        if (!commander || !commander->check_preferences(
+                comm->index, record[2], record + header))
+        {
+            result.status = 1;
+            break;
+        }
+
+        offset += header + record[2];
+    }
+
+    if (result.status == 0)
+    {
+        for (offset = 0; offset < size; result.applied++)
+        {
+            uint8_t *record = data + offset;
+            PreferencesHeader *comm = reinterpret_cast<PreferencesHeader*>(
+                record
+            );
+
+            _local_commander(comm->commander)->set_preferences(
+                comm->index,
+                record[2],
+                record + header
+            );
+
+            offset += header + record[2];
+        }
+    }
+
+    result.offset = offset;
+    return result.status == 0;
+}
+
+uint32_t MidiController::_preferences_hash()
+{
+    LayoutHash hash;
+
+    auto lit = _local.begin();
+    for (; lit != _local.end(); lit++)
+        (*lit)->dump_preferences(&hash);
+
+    return hash.value();
+}
+
+uint32_t MidiController::_layout_hash()
+{
+    LayoutHash hash;
+
+    auto it = _connections.begin();
+    for (; it != _connections.end(); it++)
+    {
+        uint32_t layout = (*it)->layout();
+        hash.write(reinterpret_cast<uint8_t*>(&layout), sizeof(layout));
+    }
+
+    auto lit = _local.begin();
+    for (; lit != _local.end(); lit++)
+        (*lit)->push_layout(&hash);
+
+    return hash.value();
+}
+
+uint16_t MidiController::_snapshot(uint8_t *buffer, size_t capacity)
+{
+    const uint8_t header = sizeof(PreferencesHeader) + 1;
+    uint16_t offset = 0;
+
+    for (size_t i = 0; i < _local.count(); i++)
+    {
+        MidiCommander::InterfaceList &components = _local[i]->components();
+        for (size_t index = 0; index < components.count(); index++)
+        {
+            if (capacity - offset <= header)
+                return offset;
+
+            size_t size = components[index]->parameters(
+                buffer + offset + header,
+                capacity - offset - header
+            );
+
+            if (size == 0)
+                return offset; // Out of room
+
+            buffer[offset] = _connections.count() + i;
+            buffer[offset + 1] = index;
+            buffer[offset + 2] = size;
+            offset += header + size;
+        }
+    }
+
+    return offset;
 }
 
 void MidiController::add_local(MidiCommander *command)
 {
-    _local.push(command);
+    if (!_local.push(command))
+    {
+        MK_LOG(Log_TooManyLocal, MK_MAX_LOCAL_COMMANDERS);
+        return;
+    }
     command->set_address(_last_address++);
 
-    lutil::Vec<_AbstractMidiInterface*> &components = command->components();
+    MidiCommander::InterfaceList &components = command->components();
     auto it = components.begin();
     for (; it != components.end(); it++)
     {
@@ -386,6 +1423,9 @@ void MidiController::add_local(MidiCommander *command)
 
 void MidiController::_process_event(RawEvent &event)
 {
+    MK_PROBE(Probe_UsbOut);
+    TelemetryTimer timer(_telemetry, Telemetry::Usb);
+
     switch (event.type)
     {
     case KEY_EVENT_ID:
@@ -402,10 +1442,22 @@ void MidiController::_process_event(RawEvent &event)
         if (key->pressed)
         {
             usbMIDI.sendNoteOn(realkey, key->velocity, _config.midi_channel);
+            _sent(
+                event,
+                0x90 | ((_config.midi_channel - 1) & 0x0F),
+                realkey,
+                key->velocity
+            );
         }
         else
         {
             usbMIDI.sendNoteOff(realkey, key->velocity, _config.midi_channel);
+            _sent(
+                event,
+                0x80 | ((_config.midi_channel - 1) & 0x0F),
+                realkey,
+                key->velocity
+            );
         }
 
         break;
@@ -418,10 +1470,28 @@ void MidiController::_process_event(RawEvent &event)
             pot->value,
             _config.midi_channel
         );
+        _sent(
+            event,
+            0xB0 | ((_config.midi_channel - 1) & 0x0F),
+            pot->control,
+            pot->value
+        );
     }
     }
 }
 
+void MidiController::_sent(
+    const RawEvent &event,
+    uint8_t status,
+    uint8_t data1,
+    uint8_t data2)
+{
+    MK_RECORD_USB(status, data1, data2);
+#if MK_MONITOR_RECORDS
+    _monitor.add(event, status, data1, data2);
+#endif
+}
+
 int8_t MidiController::_get_octave(uint8_t address)
 {
     int index = 0;
@@ -444,12 +1514,12 @@ int8_t MidiController::_get_octave(uint8_t address)
 
 bool MidiController::enter_runtime()
 {
+    // Anyone that misses this is engaged from the runtime
     auto it = _connections.begin();
-    while (it != _connections.end())
+    for (; it != _connections.end(); it++)
     {
-        MidiConnection *conn = (*it);
-        conn->send((uint8_t *)ENGAGE_COMMAND, 3);
-        it++;
+        if ((*it)->described())
+            (*it)->engage();
     }
 
     // Now that we've let the devices know, we can start
@@ -1,30 +1,106 @@
 #pragma once
 
 #include "mk_common.h"
+#include "mk_store.h"
+#include "mk_telemetry.h"
+#include "mk_monitor.h"
+#include "mk_scheduler.h"
 
 #include "lutil.h"
-#include "lu_storage/vector.h"
 #include "lu_state/state.h"
 
 namespace mk {
 
 class MidiCommander;
 
+/**
+ * A preference request for a module on the I2C bus. It's worked
+ * through a transfer per runtime pass so the rest of the bus keeps
+ * being polled while a module is being tuned.
+ */
+struct Tunnel
+{
+    uint8_t command;   // Command_GetPreferences | Command_SetPreferences
+    uint8_t seq;       // Of the serial command, the reply acks it
+    uint8_t commander; // Manager's commander index
+    uint8_t index;     // Interface on the module
+    uint8_t size;      // Bytes of data
+    uint8_t offset;    // How far through data we are
+    bool requested;    // Get: the module knows what we want
+    uint8_t data[MK_MAX_PARAMETERS];
+    unsigned long started;
+};
+
 class MidiConnection
 {
 public:
-    MidiConnection(uint16_t uuid, uint8_t address)
-        : _uuid(uuid)
+    MidiConnection(uint32_t uid, uint16_t uuid, uint8_t address)
+        : _uid(uid)
+        , _uuid(uuid)
         , _address(address)
     {}
     
-    void send(uint8_t *bytes, uint8_t size);
+    // False if the module didn't acknowledge
+    bool send(uint8_t *bytes, uint8_t size);
+
+    uint32_t uid() const { return _uid; }
+    uint16_t uuid() const { return _uuid; }
+    uint8_t address() const { return _address; }
+
+    // Collect pending events. A poll the module doesn't answer
+    // counts as a miss.
+    bool poll(EventBuffer &events);
+
+    // Events lost on the way from this module, in its pool or
+    // because events was full (total)
+    uint16_t dropped_events() const { return _dropped; }
+
+    // A step of a preference request. True once it's complete, a
+    // step that fails is simply tried again.
+    bool push_preferences(Tunnel &tunnel);
+    bool pull_preferences(Tunnel &tunnel);
+
+    // -- Descriptor
+    //
+    // Read a chunk per call once the module is on its address, and
+    // kept from then on. True once we have it.
+    bool describe();
+    bool described() const { return _described; }
+
+    uint32_t layout() const;
+    uint8_t interface_count() const;
+    const DescriptorEntry &interface(uint8_t index) const;
+    bool has_interface(uint8_t type) const;
+
+    // -- Health
+    //
+    // A dropped connection keeps its slot (and address) so the
+    // module gets both back when it announces itself again.
+
+    bool online() const { return _online; }
+    uint8_t missed() const { return _missed; }
+    void drop() { _online = false; }
+    void rejoin();
 
-    bool poll(lutil::Vec<RawEvent> &events);
+    // Send the go ahead to start the runtime
+    bool engage();
+    bool engaged() const { return _engaged; }
 
 private:
+    uint32_t _uid;    // Unique id the module announced
     uint16_t _uuid;   // UUID of instance
     uint8_t _address; // I2C address of device
+
+    bool _online = true;
+    bool _engaged = false;
+    uint8_t _missed = 0; // Polls missed in a row
+    uint16_t _dropped = 0;
+
+    void _add_dropped(uint8_t count);
+
+    bool _described = false;
+    uint8_t _descriptor_read = 0;
+    uint8_t _descriptor[DescriptorSize];
 };
 
 /* Primary Controller (ideally a teensy for the clock speed) */
@@ -45,8 +121,13 @@ public:
         // Wiz820+SD board: pin 4
         // Teensy 2.0: pin 0
         // Teensy++ 2.0: pin 20
-        // -1 means no-SD card (and no saved settings)
+        // -1 means no-SD card (settings are saved to the EEPROM)
         int sdPin = -1;
+
+        // Number of I2C modules in the rig. We start the runtime as
+        // soon as they've all joined. -1 means we don't know and wait
+        // until joins have stopped for a little while.
+        int expected_modules = -1;
     };
 
     MidiController(const Config &config, int ready_out = -1);
@@ -66,13 +147,80 @@ public:
 
     void add_local(MidiCommander *command);
 
+    // Called from the Wire receive handler
+    void received(int count);
+
     void scan_input();
     void process_command(Command &command);
 
 private:
+    MidiConnection *_find_connection(uint32_t uid);
+
+    // Give an announcing module its address
+    void _join(const Announcement &announcement);
+
+    // Handle one late announcement while in the runtime
+    void _rediscover();
+
+    // The runtime's two halves, each a task of its own under the
+    // scheduler. Polls and local events go out with every event
+    // pass, the host and the snapshots are kept up by the other.
+    void _event_pass();
+    void _host_pass();
+    static void _run_events(void *context);
+    static void _run_host(void *context);
+
+    // Poll what we can of the connections in MK_I2C_BUDGET_US
+    void _poll_connections();
+
+    // A step of reading conn's descriptor. Sets up its routing
+    // once it's complete.
+    bool _describe(MidiConnection *conn);
+
+    // True once every connection has sent its descriptor
+    bool _all_described();
+
+    // The local commander behind a Manager commander index, or
+    // nullptr if it's remote (or doesn't exist)
+    MidiCommander *_local_commander(uint8_t index);
+
+    // Queue a preference request for a remote commander
+    void _queue_tunnel(Command &command, uint8_t commander);
+
+    // Work on the oldest preference request, relaying the reply
+    // once there is one
+    void _tunnel();
+
+    // Answer the host for a finished (or failed) request
+    void _reply_tunnel(const Tunnel &tunnel, bool ok);
+
+    // Push a Command_Telemetry frame when one is due
+    void _send_telemetry();
+
+    void _dump_all();
+    void _set_all(Command &command);
+    void _patch(Command &command);
+
+    // Check and then apply a run of SetAll records
+    bool _apply_records(uint8_t *data, uint16_t size, SetAllResult &result);
+
+    // Hash of the connected modules and local interfaces. Snapshots
+    // are only loaded onto the rig they came from.
+    uint32_t _layout_hash();
+
+    // Hash of every local interface's parameters, for the host to
+    // tell if what it remembers is still current
+    uint32_t _preferences_hash();
+
+    // Every local interface's parameters as SetAll records
+    uint16_t _snapshot(uint8_t *buffer, size_t capacity);
+
     void _process_event(RawEvent &event);
     int8_t _get_octave(uint8_t address);
 
+    // An event's MIDI has gone out over USB
+    void _sent(const RawEvent &event, uint8_t status, uint8_t data1, uint8_t data2);
+
     /**
      * Events can come in "packs" where multiple events occur at the
      * sametime (e.g. user presses a full piano chord). We want to
@@ -83,17 +231,43 @@ private:
     uint16_t _event_count;
 
     uint16_t _ready_out;
-    ElapsedMicros _last_connection;
 
+    // -- Module enumeration (millis)
+    unsigned long _boot_time = 0;
+    unsigned long _last_join = 0;
+    unsigned long _longest_gap = 0;
+
+    // Announcements heard by the Wire receive handler
+    StaticVec<Announcement, MK_MAX_CONNECTIONS> _announcements;
+
+    uint8_t _next_address = MK_I2C_FIRST_MODULE;
     uint8_t _last_address;
-    lutil::Vec<MidiConnection*> _connections;
-    lutil::Vec<uint8_t> _octaves;
+    StaticVec<MidiConnection*, MK_MAX_CONNECTIONS> _connections;
+
+    // Where the next event pass starts polling
+    uint8_t _next_poll = 0;
+    StaticVec<uint8_t, MK_MAX_OCTAVES> _octaves;
 
     // -- Local interfaces (non i2c)
-    lutil::Vec<MidiCommander*> _local;
+    StaticVec<MidiCommander*, MK_MAX_LOCAL_COMMANDERS> _local;
+
+    // Preference requests for remote commanders
+    StaticVec<Tunnel, MK_MAX_TUNNELS> _tunnels;
+
+    // Events collected during a single runtime pass
+    EventBuffer _events;
+
+    // Saved preferences
+    SnapshotStore _store;
+
+    // Off until the host asks for it
+    Telemetry _telemetry;
+#if MK_MONITOR_RECORDS
+    Monitor _monitor;
+#endif
 
-    Command *_receiving = nullptr;
-    uint8_t _payload_index;
+    Task _events_task;
+    Task _host_task;
 
     Config _config;
 };
@@ -3,16 +3,22 @@
 
 namespace mk {
 
-_MidiInterface::_MidiInterface(uint8_t id, MidiCommander *command)
+_MidiInterface::_MidiInterface(
+    uint8_t id,
+    MidiCommander *command,
+    uint32_t period,
+    uint8_t priority
+)
     : lutil::StateDriver<_MidiInterface>()
     , _command(command)
     , _interface_id(id)
+    , _task(&_MidiInterface::_run_task, this, period, priority)
 {
     // Local controller Off -> Runtime
     add_transition(Off, Runtime, &_MidiInterface::initialize);
 
-    // The virtual runtime interface
-    add_runtime(Runtime, &_MidiInterface::runtime);
+    // The virtual runtime interface, through the scheduler
+    add_runtime(Runtime, &_MidiInterface::_step);
 
     _command->add(this);
 }
@@ -33,6 +39,19 @@ void _MidiInterface::runtime()
 {
 }
 
+void _MidiInterface::_step()
+{
+    if (Scheduler::get().running())
+        _task.arm();
+    else
+        runtime();
+}
+
+void _MidiInterface::_run_task(void *context)
+{
+    static_cast<_MidiInterface*>(context)->runtime();
+}
+
 void _MidiInterface::queue_event(const RawEvent &event)
 {
     _command->queue_event(event);
@@ -3,10 +3,10 @@
 #include <Wire.h>
 
 #include "mk_common.h"
+#include "mk_scheduler.h"
 
 #include "lutil.h"
 #include "lu_state/state.h"
-#include "lu_storage/vector.h"
 
 namespace mk {
 
@@ -32,8 +32,21 @@ class _AbstractMidiInterface
 {
 public:
     virtual uint8_t interface_id() const = 0;
-    virtual Parameters *parameters(size_t &size) const = 0;
+
+    // Serialize our parameters into buffer. Returns the number of
+    // bytes written, or 0 if they don't fit.
+    virtual size_t parameters(uint8_t *buffer, size_t capacity) const = 0;
     virtual void setParameters(Parameters *parameters, size_t size) = 0;
+
+    // Check serialized parameters (of our type and size) before any
+    // of a set is applied
+    virtual bool validate(const uint8_t * /*buffer*/, size_t /*size*/) const { return true; }
+
+    // Bumped when the layout of the Parameters struct changes
+    virtual uint8_t parameter_version() const { return 1; }
+
+    // Type of the events we queue, 0 if we don't
+    virtual uint8_t event_type() const { return 0; }
 };
 
 /**
@@ -44,7 +57,14 @@ class _MidiInterface
     , public _AbstractMidiInterface
 {
 public:
-    explicit _MidiInterface(uint8_t id, MidiCommander *command);
+    // period and priority are what mk::Scheduler runs our runtime()
+    // with, when the sketch uses it
+    _MidiInterface(
+        uint8_t id,
+        MidiCommander *command,
+        uint32_t period = MK_POT_PERIOD_US,
+        uint8_t priority = Priority_Normal
+    );
     uint8_t interface_id() const override;
 
     // -- Transitions
@@ -65,6 +85,8 @@ public:
     // call this to clear any pooled events
     virtual void runtime();
 
+    const Task &task() const { return _task; }
+
 protected:
     void queue_event(const RawEvent &event);
 
@@ -81,7 +103,13 @@ protected:
 private:
     void flush();
 
+    // Our lutil runtime. Arms the task under the scheduler, runs
+    // runtime() straight away otherwise.
+    void _step();
+    static void _run_task(void *context);
+
     int8_t _interface_id;
+    Task _task;
 };
 
 } // namespace mk
\ No newline at end of file
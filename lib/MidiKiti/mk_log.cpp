@@ -0,0 +1,63 @@
+#include "mk_log.h"
+#include "mk_protocol.h"
+
+namespace mk
+{
+
+Log &Log::get()
+{
+    static Log log;
+    return log;
+}
+
+void Log::push(uint16_t id, uint16_t arg0, uint16_t arg1)
+{
+    InterruptGuard guard;
+
+    if (_count >= MK_LOG_RECORDS)
+    {
+        if (_lost < 0xFFFF)
+            _lost++;
+        return;
+    }
+
+    LogRecord &record = _records[(_head + _count) % MK_LOG_RECORDS];
+    record.id = id;
+    record.args[0] = arg0;
+    record.args[1] = arg1;
+    _count++;
+}
+
+void Log::drain()
+{
+    LogRecord records[MK_LOG_DRAIN];
+    uint8_t count = 0;
+
+    {
+        InterruptGuard guard;
+
+        if (_lost)
+        {
+            records[count++] = { Log_LogLost, { _lost, 0 } };
+            _lost = 0;
+        }
+
+        while (_count && count < MK_LOG_DRAIN)
+        {
+            records[count++] = _records[_head];
+            _head = (_head + 1) % MK_LOG_RECORDS;
+            _count--;
+        }
+    }
+
+    if (!count)
+        return;
+
+    SerialLink::get().send(
+        Command_Log,
+        reinterpret_cast<const uint8_t*>(records),
+        count * sizeof(LogRecord)
+    );
+}
+
+} // namespace mk
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "mk_common.h"
+
+namespace mk
+{
+
+// Log_<name> for every message in mk_log.def
+enum LogId : uint16_t
+{
+#define MK_LOG_MESSAGE(name, id, format) Log_##name = id,
+#include "mk_log.def"
+#undef MK_LOG_MESSAGE
+};
+
+#pragma pack(push, 1)
+
+// What a log call leaves behind, the Manager has the text
+struct LogRecord
+{
+    uint16_t id;
+    uint16_t args[2];
+};
+
+#pragma pack(pop)
+
+/**
+ * Replaces Message() strings with a few bytes per message.
+ *
+ * push() only copies an id and two arguments into a ring, so it's
+ * cheap enough for the scan and safe from the Wire handlers. The
+ * ring goes out as Command_Log frames when the serial link has
+ * nothing else to do. If it fills up the oldest records are kept
+ * and the host is told how many were lost.
+ */
+class Log
+{
+public:
+    static Log &get();
+
+    void push(uint16_t id, uint16_t arg0 = 0, uint16_t arg1 = 0);
+
+    bool empty() const { return _count == 0 && _lost == 0; }
+
+    // Send up to MK_LOG_DRAIN records to the host
+    void drain();
+
+private:
+    Log() {}
+
+    LogRecord _records[MK_LOG_RECORDS];
+    volatile uint8_t _head = 0;
+    volatile uint8_t _count = 0;
+    volatile uint16_t _lost = 0;
+};
+
+} // namespace mk
+
+#define MK_LOG(...) mk::Log::get().push(__VA_ARGS__)
@@ -0,0 +1,69 @@
+#include "mk_monitor.h"
+#include "mk_protocol.h"
+
+#if MK_MONITOR_RECORDS
+
+namespace mk
+{
+
+void Monitor::start()
+{
+    _count = 0;
+    _lost = 0;
+    _enabled = true;
+}
+
+void Monitor::stop()
+{
+    drain();
+    _enabled = false;
+}
+
+void Monitor::add(
+    const RawEvent &event,
+    uint8_t status,
+    uint8_t data1,
+    uint8_t data2)
+{
+    if (!_enabled)
+        return;
+
+    if (_count == MK_MONITOR_RECORDS)
+    {
+        if (_lost < 0xFFFF)
+            _lost++;
+        return;
+    }
+
+    // Ticks wrap, the difference doesn't care
+    uint16_t ticks = event_ticks() - event_stamp(event);
+    uint32_t latency = uint32_t(ticks) * EventStampUs;
+
+    _records[_count++] = MonitorRecord{
+        uint32_t(micros()),
+        uint16_t(min(latency, uint32_t(0xFFFF))),
+        reinterpret_cast<const uint8_t*>(&event)[1], // address
+        status,
+        data1,
+        data2
+    };
+}
+
+void Monitor::drain()
+{
+    if (!_enabled || (!_count && !_lost))
+        return;
+
+    SerialLink &link = SerialLink::get();
+    link.begin(Command_Monitor, sizeof(_lost) + _count * sizeof(MonitorRecord));
+    link.write(reinterpret_cast<uint8_t*>(&_lost), sizeof(_lost));
+    link.write(reinterpret_cast<uint8_t*>(_records), _count * sizeof(MonitorRecord));
+    link.end();
+
+    _count = 0;
+    _lost = 0;
+}
+
+} // namespace mk
+
+#endif
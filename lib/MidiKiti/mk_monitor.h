@@ -0,0 +1,58 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "mk_common.h"
+
+/**
+ * A mirror of the MIDI the controller sends, for the host to watch
+ * alongside a DAW. Each message is recorded with where it came from
+ * and how long its event waited between being pooled and going out
+ * over USB (see stamp_event), then sent on in Command_Monitor frames
+ * (lost (16) | records...) while the host has the monitor on.
+ *
+ * Built with MK_MONITOR_RECORDS=0 (the default on AVR) there's no
+ * monitor and a Command_Monitor gets an empty frame back.
+ */
+
+namespace mk
+{
+
+#pragma pack(push, 1)
+
+struct MonitorRecord
+{
+    uint32_t time;    // us, when it went out
+    uint16_t latency; // us since the event was pooled, saturates
+    uint8_t source;   // Address of the commander it came from
+    uint8_t status;   // MIDI status byte
+    uint8_t data1;
+    uint8_t data2;
+};
+
+#pragma pack(pop)
+
+#if MK_MONITOR_RECORDS
+
+class Monitor
+{
+public:
+    void start();
+    void stop();
+    bool enabled() const { return _enabled; }
+
+    void add(const RawEvent &event, uint8_t status, uint8_t data1, uint8_t data2);
+
+    // Send what we have to the host
+    void drain();
+
+private:
+    MonitorRecord _records[MK_MONITOR_RECORDS];
+    uint16_t _count = 0;
+    uint16_t _lost = 0; // Since the last frame
+    bool _enabled = false;
+};
+
+#endif
+
+} // namespace mk
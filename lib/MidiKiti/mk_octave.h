@@ -3,6 +3,9 @@
 #include "mk_command.h"
 #include "mk_shift.h"
 #include "mk_interface.h"
+#include "mk_log.h"
+#include "mk_probe.h"
+#include "mk_recorder.h"
 
 #define kMaxPressTime 800000 // .8s (preference? SD Card? idk...)
 
@@ -150,7 +153,7 @@ public:
     };
 
     explicit MidiOctave(const Config &config, MidiCommander *command)
-        : _MidiInterface(OCTAVE_ID, command)
+        : _MidiInterface(OCTAVE_ID, command, MK_SCAN_PERIOD_US, Priority_High)
     {
         _shift.begin(
             config.loadPin,
@@ -160,15 +163,35 @@ public:
         );
     }
 
-    void add_key(MidiKey *key)
+    // False (and logged) once MK_MAX_KEYS are taken
+    bool add_key(MidiKey *key)
     {
-        _keys.push(key);
+        if (!_keys.push(key))
+        {
+            MK_LOG(Log_TooManyKeys, MK_MAX_KEYS);
+            return false;
+        }
+        return true;
+    }
+
+    uint8_t event_type() const override
+    {
+        return KEY_EVENT_ID;
     }
 
     void runtime() override
     {
-        if (_shift.update())
+        bool changed = false;
         {
+            MK_PROBE(Probe_ShiftIn);
+            changed = _shift.update();
+        }
+
+        if (changed)
+        {
+            MK_PROBE(Probe_Keys);
+            MK_RECORD_EDGE(_command->address(), _shift.getCurrent());
+
             KeyEvent event;
             event.type = KEY_EVENT_ID;
             event.address = _command->address();
@@ -181,13 +204,17 @@ public:
         }
     }
 
-    virtual Parameters *parameters(size_t &size) const
+    virtual size_t parameters(uint8_t *buffer, size_t capacity) const
     {
-        size = sizeof(OctaveParameters);
-        return new OctaveParameters();
+        if (capacity < sizeof(OctaveParameters))
+            return 0;
+
+        OctaveParameters parms;
+        memcpy(buffer, &parms, sizeof(OctaveParameters));
+        return sizeof(OctaveParameters);
     }
 
-    virtual void setParameters(Parameters *parameters, size_t size)
+    virtual void setParameters(Parameters * /*parameters*/, size_t size)
     {
         if (size < sizeof(OctaveParameters))
             return;
@@ -198,7 +225,7 @@ public:
 
 private:
     // Keys we've already registered as pressed
-    lutil::Vec<MidiKey*> _keys;
+    StaticVec<MidiKey*, MK_MAX_KEYS> _keys;
 
     // Register for our piano keys
     mk::KeyShift _shift;
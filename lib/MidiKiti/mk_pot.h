@@ -2,6 +2,9 @@
 #include "mk_common.h"
 #include "mk_command.h"
 #include "mk_interface.h"
+#include "mk_log.h"
+#include "mk_probe.h"
+#include "mk_trace.h"
 
 namespace mk
 {
@@ -45,16 +48,37 @@ public:
         const Config &config,
         MidiCommander *command)
         : _MidiInterface(POT_ID, command)
+        , _config(config)
     {
-        _config = config;
         pinMode(config.pin, INPUT);
     }
 
+    uint8_t event_type() const override
+    {
+        return POT_EVENT_ID;
+    }
+
     void runtime() override
     {
-        int current = analogRead(_config.pin);
+        MK_PROBE(Probe_Pot);
+
+        // Between reads is the only place new parameters can
+        // take over
+        _config.swap();
+        const Config &config = _config.live();
+
+        int current = analogRead(config.pin);
 
-        if (abs(current - _last) > _config.threshold)
+#if MK_TRACING
+        if (current != _traced)
+        {
+            uint16_t value = current;
+            MK_TRACE(Trace_Analog, config.pin, &value, sizeof(value));
+            _traced = current;
+        }
+#endif
+
+        if (abs(current - _last) > config.threshold)
         {
             // Let's call this a change!
             PotEvent event;
@@ -63,10 +87,10 @@ public:
             // TODO: Implement the address on a per-item basis where the
             // second byte is the offset of the item
             event.address = _command->address();
-            event.control = _config.control;
-            event.command = _config.command;
+            event.control = config.control;
+            event.command = config.command;
 
-            event.value = calculate(current);
+            event.value = calculate(config, current);
             if (event.value == _last_val)
                 return; // We've already set to this value
 
@@ -78,66 +102,99 @@ public:
         }
     }
 
-    virtual Parameters *parameters(size_t &size) const
+    virtual size_t parameters(uint8_t *buffer, size_t capacity) const
     {
-        size = sizeof(PotParameters);
-        PotParameters *parms = new PotParameters();
-
-        parms->control = _config.control;
-        parms->high = _config.high;
-        parms->low = _config.low;
-        parms->midi_high = _config.midi_high;
-        parms->midi_low = _config.midi_low;
-        parms->threshold = _config.threshold;
-        parms->invert = _config.invert;
-
-        return parms;
+        if (capacity < sizeof(PotParameters))
+            return 0;
+
+        // Anything still waiting to take over is what the Manager
+        // last set
+        const Config &config = _config.next();
+
+        PotParameters parms;
+        parms.control = config.control;
+        parms.high = config.high;
+        parms.low = config.low;
+        parms.midi_high = config.midi_high;
+        parms.midi_low = config.midi_low;
+        parms.threshold = config.threshold;
+        parms.invert = config.invert;
+
+        memcpy(buffer, &parms, sizeof(PotParameters));
+        return sizeof(PotParameters);
+    }
+
+    bool validate(const uint8_t *buffer, size_t size) const override
+    {
+        if (size < sizeof(PotParameters))
+            return false;
+
+        PotParameters parms = parameters_from<PotParameters>(buffer);
+        return parms.control <= 127
+            && parms.midi_high <= 127
+            && parms.midi_low <= 127
+            && parms.low < parms.high;
     }
 
     virtual void setParameters(Parameters *parameters, size_t size)
     {
         if (size < sizeof(PotParameters))
         {
-            Message("Invalid Param Size!");
+            MK_LOG(Log_InvalidParamSize, size, POT_ID);
             return;
         }
 
-        PotParameters *parms = static_cast<PotParameters*>(parameters);
+        // The whole set is checked before any of it is used
+        const uint8_t *buffer = reinterpret_cast<const uint8_t*>(parameters);
+        if (!validate(buffer, size))
+        {
+            MK_LOG(Log_InvalidPotParams);
+            return;
+        }
+
+        PotParameters parms = parameters_from<PotParameters>(buffer);
 
-        _config.control = parms->control;
-        _config.high = parms->high;
-        _config.low = parms->low;
-        _config.midi_high = parms->midi_high;
-        _config.midi_low = parms->midi_low;
-        _config.threshold = parms->threshold;
-        _config.invert = parms->invert;
+        Config config = _config.next();
+        config.control = parms.control;
+        config.high = parms.high;
+        config.low = parms.low;
+        config.midi_high = parms.midi_high;
+        config.midi_low = parms.midi_low;
+        config.threshold = parms.threshold;
+        config.invert = parms.invert;
 
-        Message("Pot Parms!");
+        _config.stage(config);
+
+        MK_LOG(Log_PotParamsStaged);
     }
 
-    uint8_t calculate(int value)
+    static uint8_t calculate(const Config &config, int value)
     {
-        uint8_t lo = _config.invert
-            ? _config.midi_high
-            : _config.midi_low;
+        uint8_t lo = config.invert
+            ? config.midi_high
+            : config.midi_low;
 
-        uint8_t hi = _config.invert
-            ? _config.midi_low
-            : _config.midi_high;
+        uint8_t hi = config.invert
+            ? config.midi_low
+            : config.midi_high;
 
         return (uint8_t) map(
-            value,
-            _config.low,
-            _config.high,
+            constrain(value, config.low, config.high),
+            config.low,
+            config.high,
             lo,
             hi
         );
     }
 
 private:
-    Config _config;
+    DoubleBuffered<Config> _config;
     int _last = 0; // analog
     uint8_t _last_val = 0; // MIDI
+
+#if MK_TRACING
+    int _traced = -1; // Last analog value we traced
+#endif
 };
 
 }
@@ -0,0 +1,78 @@
+#include "mk_probe.h"
+
+#if MK_PROBES
+
+namespace mk
+{
+
+Probes &Probes::get()
+{
+    static Probes probes;
+    return probes;
+}
+
+Probes::Probes()
+{
+    reset();
+}
+
+void Probes::add(uint8_t id, uint32_t ticks)
+{
+    if (id >= Probe_Count)
+        return;
+
+    ProbeStats &stats = _stats[id];
+
+    stats.count++;
+    if (ticks > stats.max)
+        stats.max = ticks;
+
+    // Position of the top bit, clamped to the last bucket
+    uint8_t bucket = 0;
+    while ((ticks >> 1) && bucket < MK_PROBE_BUCKETS - 1)
+    {
+        ticks >>= 1;
+        bucket++;
+    }
+
+    if (stats.buckets[bucket] < 0xFFFF)
+        stats.buckets[bucket]++;
+}
+
+void Probes::reset()
+{
+    memset(_stats, 0, sizeof(_stats));
+}
+
+const ProbeStats &Probes::stats(uint8_t id) const
+{
+    return _stats[id];
+}
+
+uint16_t Probes::dump_size()
+{
+    return 4 + Probe_Count * (8 + 2 * MK_PROBE_BUCKETS);
+}
+
+void Probes::dump(Print *stream) const
+{
+    uint16_t tpu = Clock::ticks_per_us();
+    stream->write(reinterpret_cast<uint8_t*>(&tpu), sizeof(tpu));
+    stream->write(uint8_t(Probe_Count));
+    stream->write(uint8_t(MK_PROBE_BUCKETS));
+
+    for (uint8_t i = 0; i < Probe_Count; i++)
+    {
+        const ProbeStats &stats = _stats[i];
+        stream->write(reinterpret_cast<const uint8_t*>(&stats.count), 4);
+        stream->write(reinterpret_cast<const uint8_t*>(&stats.max), 4);
+        stream->write(
+            reinterpret_cast<const uint8_t*>(stats.buckets),
+            sizeof(stats.buckets)
+        );
+    }
+}
+
+} // namespace mk
+
+#endif
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "mk_config.h"
+#include "mk_clock.h"
+
+/**
+ * Hot path probes. Wrap a stage in MK_PROBE(id) and the time spent
+ * in it until the end of the scope lands in that probe's histogram:
+ *
+ *     {
+ *         MK_PROBE(Probe_Poll);
+ *         conn->poll(_events);
+ *     }
+ *
+ * Ticks come from mk::Clock. Command_GetProbes reports ticks_per_us
+ * so the host can make sense of them.
+ *
+ * Built with MK_PROBES=0 (the default) MK_PROBE is nothing at all.
+ */
+
+namespace mk
+{
+
+enum ProbeId : uint8_t
+{
+    Probe_Loop = 0,  // A whole controller event pass
+    Probe_ShiftIn,   // Reading an octave's shift register
+    Probe_Keys,      // Turning key changes into events
+    Probe_Pot,       // MidiPot::runtime
+    Probe_Poll,      // MidiConnection::poll
+    Probe_Serial,    // MidiController::scan_input
+    Probe_UsbOut,    // Sending MIDI over USB
+    Probe_UsbIn,     // Draining incoming USB MIDI
+
+    Probe_Count
+};
+
+#if MK_PROBES
+
+struct ProbeStats
+{
+    uint32_t count;
+    uint32_t max;
+    uint16_t buckets[MK_PROBE_BUCKETS]; // Saturate rather than wrap
+};
+
+class Probes
+{
+public:
+    static Probes &get();
+
+    void add(uint8_t id, uint32_t ticks);
+    void reset();
+
+    const ProbeStats &stats(uint8_t id) const;
+
+    // ticks_per_us (16) | probe count | bucket count |
+    //   for each probe: count (32) | max (32) | buckets (16)...
+    static uint16_t dump_size();
+    void dump(Print *stream) const;
+
+private:
+    Probes();
+
+    ProbeStats _stats[Probe_Count];
+};
+
+class ProbeScope
+{
+public:
+    explicit ProbeScope(uint8_t id)
+        : _id(id)
+        , _start(Clock::now())
+    {}
+
+    ~ProbeScope()
+    {
+        Probes::get().add(_id, Clock::now() - _start);
+    }
+
+private:
+    uint8_t _id;
+    uint32_t _start;
+};
+
+#define MK_PROBE_JOIN2(a, b) a##b
+#define MK_PROBE_JOIN(a, b) MK_PROBE_JOIN2(a, b)
+#define MK_PROBE(id) mk::ProbeScope MK_PROBE_JOIN(__mk_probe_, __LINE__)(id)
+
+#else
+
+#define MK_PROBE(id) do {} while (0)
+
+#endif
+
+} // namespace mk
@@ -0,0 +1,441 @@
+#include "mk_protocol.h"
+
+static_assert(MK_SERIAL_TX_BUFFER >= 256, "MK_SERIAL_TX_BUFFER must hold a COBS block");
+
+// version | seq | ack | id | size (16)
+#define kHeaderSize 6
+#define kCrcSize 2
+
+namespace mk
+{
+
+uint16_t crc16(const uint8_t *data, size_t length, uint16_t crc)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        crc ^= uint16_t(data[i]) << 8;
+        for (uint8_t bit = 0; bit < 8; bit++)
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+    }
+    return crc;
+}
+
+size_t cobs_decode(uint8_t *data, size_t length)
+{
+    // The output never gets ahead of the input, so this is safe
+    // to do in place
+    size_t in = 0;
+    size_t out = 0;
+
+    while (in < length)
+    {
+        uint8_t code = data[in++];
+        if (code == 0)
+            return 0;
+
+        for (uint8_t i = 1; i < code; i++)
+        {
+            if (in >= length)
+                return 0;
+            data[out++] = data[in++];
+        }
+
+        if (code != 0xFF && in < length)
+            data[out++] = 0;
+    }
+
+    return out;
+}
+
+void Message(const char *message)
+{
+    SerialLink::get().send(
+        Command_Message,
+        reinterpret_cast<const uint8_t*>(message),
+        strlen(message)
+    );
+}
+
+SerialLink &SerialLink::get()
+{
+    static SerialLink link;
+    return link;
+}
+
+uint8_t SerialLink::version() const
+{
+    return _version;
+}
+
+uint16_t SerialLink::rx_errors() const
+{
+    return _rx_errors;
+}
+
+// -- Input
+
+size_t SerialLink::fill()
+{
+    int available = Serial.available();
+    if (available <= 0)
+        return 0;
+
+    size_t space = sizeof(_rx) - _rx_count;
+    size_t wanted = min(size_t(available), space);
+    if (wanted == 0)
+        return 0;
+
+    size_t read = Serial.readBytes(_rx + _rx_count, wanted);
+    _rx_count += read;
+    return read;
+}
+
+void SerialLink::_drop(size_t n)
+{
+    if (n > _rx_count)
+        n = _rx_count;
+
+    memmove(_rx, _rx + n, _rx_count - n);
+    _rx_count -= n;
+}
+
+void SerialLink::consume()
+{
+    _drop(_consumed);
+    _consumed = 0;
+    _ack = 0;
+}
+
+bool SerialLink::next(Command &command)
+{
+    consume();
+
+    while (_rx_count > 0)
+    {
+        if (_rx_skip > 0)
+        {
+            // Dropping the tail of a command we can't hold
+            size_t n = min(size_t(_rx_skip), size_t(_rx_count));
+            _rx_skip -= n;
+            _drop(n);
+            continue;
+        }
+
+        if (_resync)
+        {
+            uint8_t *end = (uint8_t *)memchr(_rx, 0, _rx_count);
+            if (!end)
+            {
+                _rx_count = 0;
+                return false;
+            }
+
+            _drop(end - _rx);
+            _resync = false;
+        }
+
+        if (_rx[0] == 0)
+        {
+            // Frame delimiter (or line noise in v1)
+            _drop(1);
+            continue;
+        }
+
+        // A v1 Hello is honored at the start of any frame so the
+        // host can always get back to a known state
+        bool hello = _rx[0] == Command_StartFlag
+            && (_rx_count < 2 || _rx[1] == Command_Hello);
+
+        bool ready = (_version < 2 || hello)
+            ? _next_v1(command)
+            : _next_v2(command);
+
+        if (!ready)
+        {
+            if (_consumed == 0 && _rx_skip == 0 && !_resync)
+                return false; // Need more bytes
+
+            // Bad (or skipped) frame, drop it and keep going
+            consume();
+            continue;
+        }
+
+        if (command.id == Command_Hello)
+        {
+            _hello(command);
+            consume();
+            continue;
+        }
+
+        _ack = command.seq;
+        return true;
+    }
+
+    return false;
+}
+
+bool SerialLink::_next_v1(Command &command)
+{
+    if (_rx[0] != Command_StartFlag)
+    {
+        // Not a command boundary. Look for the next one.
+        _consumed = 1;
+        return false;
+    }
+
+    // StartFlag | id | size | payload...
+    if (_rx_count < 3)
+        return false;
+
+    size_t length = 3 + _rx[2];
+    if (length > sizeof(_rx))
+    {
+        _rx_errors++;
+        _rx_skip = length;
+        return false;
+    }
+
+    if (_rx_count < length)
+        return false; // Wait for the rest
+
+    command.id = _rx[1];
+    command.size = _rx[2];
+    command.seq = 0;
+    command.payload = _rx + 3;
+
+    _consumed = length;
+    return true;
+}
+
+bool SerialLink::_next_v2(Command &command)
+{
+    uint8_t *end = (uint8_t *)memchr(_rx, 0, _rx_count);
+    if (!end)
+    {
+        if (_rx_count == sizeof(_rx))
+        {
+            // Too large for us, throw it out
+            _rx_errors++;
+            _rx_count = 0;
+            _resync = true;
+        }
+        return false;
+    }
+
+    size_t encoded = end - _rx;
+    _consumed = encoded + 1;
+
+    size_t length = cobs_decode(_rx, encoded);
+    if (length < kHeaderSize + kCrcSize)
+    {
+        _rx_errors++;
+        return false;
+    }
+
+    uint16_t crc = _rx[length - 2] | (uint16_t(_rx[length - 1]) << 8);
+    length -= kCrcSize;
+
+    uint16_t size = _rx[4] | (uint16_t(_rx[5]) << 8);
+
+    if (crc != crc16(_rx, length)
+        || _rx[0] != MK_PROTOCOL_VERSION
+        || size != length - kHeaderSize)
+    {
+        _rx_errors++;
+        return false;
+    }
+
+    command.seq = _rx[1];
+    command.id = _rx[3];
+    command.size = size;
+    command.payload = _rx + kHeaderSize;
+
+    // Frames we never saw still count against the link. seq wraps
+    // from 255 to 1, 0 is never sent.
+    uint8_t expected = _rx_seq == 0xFF ? 1 : _rx_seq + 1;
+    if (_rx_seq != 0 && command.seq != expected)
+        _rx_errors++;
+    _rx_seq = command.seq;
+
+    return true;
+}
+
+void SerialLink::_hello(const Command &command)
+{
+    uint8_t requested = command.size > 0 ? command.payload[0] : 1;
+
+    // Always answered in v1 so the host can read it no matter
+    // which version it thinks we're on
+    _version = 1;
+    uint8_t version = min(requested, uint8_t(MK_PROTOCOL_VERSION));
+
+    begin(Command_Hello, 1);
+    write(version);
+    end();
+
+    _version = version;
+    _rx_seq = 0;
+}
+
+// -- Output
+
+void SerialLink::_flush()
+{
+    if (_tx_code == 0)
+        return;
+
+    Serial.write(_tx, _tx_code);
+
+    memmove(_tx, _tx + _tx_code, _tx_count - _tx_code);
+    _tx_count -= _tx_code;
+    _tx_code = 0;
+}
+
+void SerialLink::_put(uint8_t b)
+{
+    // Everything but the block being encoded can go out
+    if (_tx_count == sizeof(_tx))
+        _flush();
+
+    _tx[_tx_count++] = b;
+}
+
+void SerialLink::_encode(uint8_t b)
+{
+    if (_version < 2)
+    {
+        _put(b);
+        _tx_code = _tx_count;
+        return;
+    }
+
+    if (b == 0)
+    {
+        // Close this block and open the next one
+        _tx[_tx_code] = _tx_count - _tx_code;
+        _tx_code = _tx_count;
+        _put(0);
+        return;
+    }
+
+    _put(b);
+
+    if (_tx_count - _tx_code == 0xFF)
+    {
+        // Full block, no implied zero
+        _tx[_tx_code] = 0xFF;
+        _tx_code = _tx_count;
+        _put(0);
+    }
+}
+
+bool SerialLink::begin(uint8_t id, uint16_t size)
+{
+    return begin(id, size, _ack);
+}
+
+bool SerialLink::begin(uint8_t id, uint16_t size, uint8_t ack)
+{
+    if (_framing)
+        end();
+
+    _framing = true;
+    _tx_remaining = size;
+
+    if (_version < 2)
+    {
+        // The size byte is sent as-is. Legacy GetLayout replies
+        // rely on that.
+        _encode(Command_StartFlag);
+        _encode(id);
+        _encode(uint8_t(size));
+        return true;
+    }
+
+    // Placeholder for the first code byte
+    _tx_code = _tx_count;
+    _put(0);
+
+    // seq 0 is never sent so the host can tell when we restart
+    if (++_tx_seq == 0)
+        _tx_seq = 1;
+
+    uint8_t header[kHeaderSize] = {
+        MK_PROTOCOL_VERSION,
+        _tx_seq,
+        ack,
+        id,
+        uint8_t(size & 0xFF),
+        uint8_t(size >> 8)
+    };
+
+    _tx_crc = crc16(header, kHeaderSize);
+    for (uint8_t i = 0; i < kHeaderSize; i++)
+        _encode(header[i]);
+
+    return true;
+}
+
+size_t SerialLink::write(uint8_t b)
+{
+    if (!_framing)
+        return 0;
+
+    if (_version < 2)
+    {
+        _encode(b);
+        return 1;
+    }
+
+    if (_tx_remaining == 0)
+        return 0; // More than we said we'd send
+
+    _tx_remaining--;
+    _tx_crc = crc16(&b, 1, _tx_crc);
+    _encode(b);
+    return 1;
+}
+
+size_t SerialLink::write(const uint8_t *data, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        if (write(data[i]) == 0)
+            return i;
+    }
+    return size;
+}
+
+void SerialLink::end()
+{
+    if (!_framing)
+        return;
+
+    if (_version >= 2)
+    {
+        // Keep the frame consistent with the size we promised
+        while (_tx_remaining > 0)
+            write(uint8_t(0));
+
+        uint16_t crc = _tx_crc;
+        _encode(crc & 0xFF);
+        _encode(crc >> 8);
+
+        // Close the last block and delimit the frame
+        _tx[_tx_code] = _tx_count - _tx_code;
+        _put(0);
+    }
+
+    _framing = false;
+    _tx_code = _tx_count;
+    _flush();
+}
+
+void SerialLink::send(uint8_t id, const uint8_t *payload, uint16_t size)
+{
+    begin(id, size);
+    write(payload, size);
+    end();
+}
+
+} // namespace mk
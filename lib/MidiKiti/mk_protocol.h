@@ -0,0 +1,124 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "mk_common.h"
+
+namespace mk
+{
+
+// CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF)
+uint16_t crc16(const uint8_t *data, size_t length, uint16_t crc = 0xFFFF);
+
+// Decode a COBS block in place. Returns the decoded length, or 0 if
+// the block is malformed.
+size_t cobs_decode(uint8_t *data, size_t length);
+
+/**
+ * The serial link to the Manager. Owns the receive and transmit
+ * buffers and frames commands for whichever protocol version the
+ * host asked for.
+ *
+ * Version 1 (what every host starts with):
+ *
+ *   StartFlag | id | size | payload...
+ *
+ * Version 2, negotiated with a v1 Command_Hello:
+ *
+ *   COBS( version | seq | ack | id | size (16) | payload... | crc16 ) 0x00
+ *
+ * seq counts up for every frame the sender writes, ack is the seq of
+ * the command being answered (0 if unsolicited). A v1 Hello is always
+ * understood at the start of a frame so a host can renegotiate from
+ * any state.
+ */
+class SerialLink : public Print
+{
+public:
+    static SerialLink &get();
+
+    uint8_t version() const;
+
+    // -- Input
+
+    // Read whatever is waiting on the Serial into our buffer.
+    // Returns the number of bytes read.
+    size_t fill();
+
+    // Decode the next complete command in the buffer. The payload
+    // is valid until consume() or the next call to next().
+    bool next(Command &command);
+
+    // Release the command returned by next()
+    void consume();
+
+    // Frames we've thrown away (bad crc, overflow, missed seq)
+    uint16_t rx_errors() const;
+
+    // -- Output
+
+    // Start an outgoing frame. Everything written until end() is
+    // the payload and should add up to size.
+    bool begin(uint8_t id, uint16_t size);
+
+    // Same, but answering the command with seq ack. For replies
+    // that come in after that command has been consumed.
+    bool begin(uint8_t id, uint16_t size, uint8_t ack);
+    void end();
+
+    size_t write(uint8_t b) override;
+    size_t write(const uint8_t *data, size_t size) override;
+    using Print::write;
+
+    void send(uint8_t id, const uint8_t *payload, uint16_t size);
+
+private:
+    SerialLink() {}
+
+    void _drop(size_t n);
+    bool _next_v1(Command &command);
+    bool _next_v2(Command &command);
+    void _hello(const Command &command);
+
+    void _put(uint8_t b);
+    void _encode(uint8_t b);
+    void _flush();
+
+    uint8_t _version = 1;
+
+    // -- Input
+
+    uint8_t _rx[MK_SERIAL_BUFFER];
+    uint16_t _rx_count = 0;
+
+    // Bytes left of a v1 command too large for _rx
+    uint16_t _rx_skip = 0;
+
+    // Dropping everything until the next v2 delimiter
+    bool _resync = false;
+
+    // Bytes of the command handed out by next()
+    uint16_t _consumed = 0;
+
+    uint8_t _rx_seq = 0;
+    uint16_t _rx_errors = 0;
+
+    // -- Output
+
+    uint8_t _tx[MK_SERIAL_TX_BUFFER];
+    uint16_t _tx_count = 0;
+
+    // Index of the COBS code byte for the block being written.
+    // Everything before it is ready to go out.
+    uint16_t _tx_code = 0;
+
+    bool _framing = false;
+    uint16_t _tx_remaining = 0;
+    uint16_t _tx_crc = 0xFFFF;
+    uint8_t _tx_seq = 0;
+
+    // seq of the command we're currently answering
+    uint8_t _ack = 0;
+};
+
+} // namespace mk
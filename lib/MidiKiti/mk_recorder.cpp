@@ -0,0 +1,150 @@
+#include "mk_recorder.h"
+#include "mk_log.h"
+
+#if MK_RECORDER_ENTRIES
+
+namespace mk
+{
+
+Recorder &Recorder::get()
+{
+    static Recorder recorder;
+    return recorder;
+}
+
+Recorder::Recorder()
+{
+    arm();
+}
+
+void Recorder::edge(uint8_t address, uint32_t state)
+{
+    uint8_t data[5];
+    data[0] = address;
+    memcpy(data + 1, &state, sizeof(state));
+    _record(Record_Edge, data, sizeof(data));
+}
+
+void Recorder::event(const RawEvent &event)
+{
+    _record(Record_Event, &event, 7);
+}
+
+void Recorder::usb(uint8_t status, uint8_t data1, uint8_t data2)
+{
+    uint8_t data[3] = { status, data1, data2 };
+    _record(Record_Usb, data, sizeof(data));
+
+    uint8_t type = status & 0xF0;
+    uint8_t bit = 1 << (data1 & 7);
+    uint8_t &notes = _notes[(data1 & 0x7F) >> 3];
+
+    if (type == 0x90 && data2 > 0)
+    {
+        if (notes & bit)
+            trigger(Trigger_StuckNote, data1);
+        notes |= bit;
+    }
+    else if (type == 0x80 || type == 0x90)
+    {
+        notes &= ~bit;
+    }
+}
+
+void Recorder::trigger(uint8_t reason, uint8_t arg)
+{
+    if (_trigger != Trigger_None)
+        return;
+
+    _trigger = reason;
+    _trigger_arg = arg;
+    _after = MK_RECORDER_AFTER + 1; // This entry counts too
+
+    uint8_t data[2] = { reason, arg };
+    _record(Record_Trigger, data, sizeof(data));
+}
+
+void Recorder::freeze()
+{
+    if (_trigger == Trigger_None)
+    {
+        _trigger = Trigger_Host;
+        _trigger_arg = 0;
+    }
+    _frozen = true;
+}
+
+void Recorder::arm()
+{
+    InterruptGuard guard;
+
+    _head = 0;
+    _count = 0;
+    _trigger = Trigger_None;
+    _trigger_arg = 0;
+    _after = 0;
+    _frozen = false;
+    memset(_notes, 0, sizeof(_notes));
+}
+
+void Recorder::_record(uint8_t kind, const void *data, uint8_t size)
+{
+    if (_frozen)
+        return;
+
+    uint32_t now = Clock::now();
+    bool froze = false;
+
+    {
+        InterruptGuard guard;
+
+        RecorderEntry &entry = _entries[_head];
+        entry.time = now;
+        entry.kind = kind;
+        memset(entry.data, 0, sizeof(entry.data));
+        memcpy(entry.data, data, min(size, uint8_t(sizeof(entry.data))));
+
+        _head = (_head + 1) % MK_RECORDER_ENTRIES;
+        if (_count < MK_RECORDER_ENTRIES)
+            _count++;
+
+        if (_trigger != Trigger_None)
+        {
+            if (_after > 0)
+                _after--;
+            froze = _frozen = _after == 0;
+        }
+    }
+
+    if (froze)
+        MK_LOG(Log_RecorderFrozen, _trigger, _trigger_arg);
+}
+
+uint16_t Recorder::dump_size() const
+{
+    return 7 + _count * sizeof(RecorderEntry);
+}
+
+void Recorder::dump(Print *stream) const
+{
+    uint16_t tpu = Clock::ticks_per_us();
+    stream->write(reinterpret_cast<uint8_t*>(&tpu), sizeof(tpu));
+    stream->write(reinterpret_cast<const uint8_t*>(&_count), sizeof(_count));
+    stream->write(_trigger);
+    stream->write(_trigger_arg);
+    stream->write(uint8_t(_frozen));
+
+    uint16_t start = (_head + MK_RECORDER_ENTRIES - _count) % MK_RECORDER_ENTRIES;
+    for (uint16_t i = 0; i < _count; i++)
+    {
+        const RecorderEntry &entry = _entries[(start + i) % MK_RECORDER_ENTRIES];
+        stream->write(
+            reinterpret_cast<const uint8_t*>(&entry),
+            sizeof(RecorderEntry)
+        );
+    }
+}
+
+} // namespace mk
+
+#endif
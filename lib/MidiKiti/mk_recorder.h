@@ -0,0 +1,120 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "mk_common.h"
+#include "mk_clock.h"
+
+/**
+ * Flight recorder. A fixed ring of timestamped entries following a
+ * note from the shift register edge, through the RawEvent it turns
+ * into, to what went out over USB.
+ *
+ * It records all the time and freezes MK_RECORDER_AFTER entries
+ * after a trigger, so when something goes wrong the ring holds what
+ * led up to it. Triggers are the host (Command_Recorder), a note-on
+ * for a note that never got its note-off, and events dropped because
+ * a queue was full. The host pulls the frozen ring with
+ * Command_Recorder and re-arms it.
+ *
+ * With MK_RECORDER_ENTRIES=0 (the default on AVR) the MK_RECORD_*
+ * macros are nothing at all.
+ */
+
+namespace mk
+{
+
+enum RecordKind : uint8_t
+{
+    Record_Edge = 1, // address | shift register state (32)
+    Record_Event,    // The first 7 bytes of the RawEvent
+    Record_Usb,      // status | data1 | data2
+    Record_Trigger   // reason | arg
+};
+
+enum RecorderTrigger : uint8_t
+{
+    Trigger_None = 0,
+    Trigger_Host,      // Asked for with Command_Recorder
+    Trigger_StuckNote, // Note-on while the note was still on
+    Trigger_Overflow   // An event queue was full, arg is the address
+};
+
+enum RecorderOp : uint8_t
+{
+    Recorder_Dump = 0, // Freeze (if it isn't already) and send it all
+    Recorder_Arm,      // Throw it away and start recording again
+    Recorder_Freeze    // Trigger from the host
+};
+
+#pragma pack(push, 1)
+
+struct RecorderEntry
+{
+    uint32_t time; // Clock ticks
+    uint8_t kind;  // RecordKind
+    uint8_t data[7];
+};
+
+#pragma pack(pop)
+
+#if MK_RECORDER_ENTRIES
+
+class Recorder
+{
+public:
+    static Recorder &get();
+
+    void edge(uint8_t address, uint32_t state);
+    void event(const RawEvent &event);
+    void usb(uint8_t status, uint8_t data1, uint8_t data2);
+
+    // Freeze once MK_RECORDER_AFTER more entries are in. Only the
+    // first trigger counts until the recorder is armed again.
+    void trigger(uint8_t reason, uint8_t arg = 0);
+
+    // Stop right now, for a dump
+    void freeze();
+
+    void arm();
+    bool frozen() const { return _frozen; }
+
+    // ticks_per_us (16) | count (16) | trigger | arg | frozen |
+    //   entries... oldest first
+    uint16_t dump_size() const;
+    void dump(Print *stream) const;
+
+private:
+    Recorder();
+
+    void _record(uint8_t kind, const void *data, uint8_t size);
+
+    RecorderEntry _entries[MK_RECORDER_ENTRIES];
+    uint16_t _head = 0;  // Where the next entry goes
+    uint16_t _count = 0;
+
+    uint8_t _trigger = Trigger_None;
+    uint8_t _trigger_arg = 0;
+    uint16_t _after = 0; // Entries left before we freeze
+    volatile bool _frozen = false;
+
+    // Notes we've sent a note-on for, one bit each
+    uint8_t _notes[16];
+};
+
+#define MK_RECORD_EDGE(address, state) mk::Recorder::get().edge(address, state)
+#define MK_RECORD_EVENT(raw) mk::Recorder::get().event(raw)
+#define MK_RECORD_USB(status, data1, data2) \
+    mk::Recorder::get().usb(status, data1, data2)
+#define MK_RECORD_TRIGGER(...) mk::Recorder::get().trigger(__VA_ARGS__)
+
+#else
+
+#define MK_RECORD_EDGE(address, state) do {} while (0)
+#define MK_RECORD_EVENT(event) do {} while (0)
+#define MK_RECORD_USB(status, data1, data2) do {} while (0)
+#define MK_RECORD_TRIGGER(...) do {} while (0)
+
+#endif
+
+} // namespace mk
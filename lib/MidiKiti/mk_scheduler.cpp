@@ -0,0 +1,168 @@
+#include "mk_scheduler.h"
+
+#include "lutil.h"
+#include "lu_state/state.h"
+
+namespace mk
+{
+
+Task::Task(Run run, void *context, uint32_t period, uint8_t priority)
+    : _run_fn(run)
+    , _context(context)
+    , _period(period > 0 ? period : 1)
+    , _priority(priority)
+{}
+
+void Task::arm()
+{
+    if (!_added)
+    {
+        _added = true;
+        _release = micros();
+        Scheduler::get().add(this);
+    }
+    _armed = true;
+}
+
+bool Task::_due(unsigned long now) const
+{
+    // Wraps like micros() does
+    return _armed && long(now - _release) >= 0;
+}
+
+void Task::_run(unsigned long now)
+{
+    unsigned long late = now - _release;
+    if (late > _worst_late)
+        _worst_late = late;
+
+    _run_fn(_context);
+    _runs++;
+
+    // Done after the next period started, we've held up the
+    // next run
+    unsigned long deadline = _release + _period;
+    unsigned long done = micros();
+    _busy += done - now;
+    if (long(done - deadline) > 0 && _misses < 0xFFFF)
+        _misses++;
+
+    // Skip the periods we've lost rather than run back to back,
+    // keeping to the same phase
+    unsigned long behind = done - _release;
+    _release += (behind / _period + 1) * _period;
+}
+
+Scheduler &Scheduler::get()
+{
+    static Scheduler scheduler;
+    return scheduler;
+}
+
+Scheduler::Scheduler()
+    : _states(&Scheduler::_step_states, this, MK_STATE_PERIOD_US, Priority_Low)
+{
+    _states._added = true;
+    _states._armed = true;
+    _tasks = &_states;
+}
+
+void Scheduler::_step_states(void *context)
+{
+    Scheduler *scheduler = static_cast<Scheduler*>(context);
+
+    // Only what's still in its runtime state arms again
+    for (Task *task = scheduler->_tasks; task; task = task->_next)
+    {
+        if (task != &scheduler->_states)
+            task->_armed = false;
+    }
+
+    lutil::Processor::get().process();
+}
+
+void Scheduler::add(Task *task)
+{
+    // After everything of the same priority, so equals take turns
+    // in the order they were added
+    Task **slot = &_tasks;
+    while (*slot && (*slot)->_priority >= task->_priority)
+        slot = &(*slot)->_next;
+
+    task->_next = *slot;
+    *slot = task;
+}
+
+void Scheduler::process()
+{
+    // The first state pass arms everything that's running
+    _running = true;
+
+    // Each task at most once, picking the most important due one
+    // every time so a late low priority task waits its turn
+    for (Task *task = _tasks; task; task = task->_next)
+    {
+        unsigned long now = micros();
+
+        Task *next = nullptr;
+        for (Task *t = _tasks; t; t = t->_next)
+        {
+            if (!t->_due(now))
+                continue;
+
+            // Same priority, the one that's waited longest
+            if (!next || (t->_priority == next->_priority
+                    && long(next->_release - t->_release) > 0))
+                next = t;
+
+            if (t->_priority < next->_priority)
+                break;
+        }
+
+        if (!next)
+            return;
+
+        next->_run(now);
+    }
+}
+
+uint16_t Scheduler::misses() const
+{
+    uint32_t total = 0;
+    for (Task *task = _tasks; task; task = task->_next)
+        total += task->_misses;
+    return total > 0xFFFF ? 0xFFFF : total;
+}
+
+uint32_t Scheduler::busy(uint8_t priority) const
+{
+    uint32_t total = 0;
+    for (Task *task = _tasks; task; task = task->_next)
+    {
+        if (task->_priority == priority)
+            total += task->_busy;
+    }
+    return total;
+}
+
+uint32_t Scheduler::worst_late() const
+{
+    uint32_t worst = 0;
+    for (Task *task = _tasks; task; task = task->_next)
+    {
+        if (task->_worst_late > worst)
+            worst = task->_worst_late;
+    }
+    return worst;
+}
+
+void Scheduler::clear_stats()
+{
+    for (Task *task = _tasks; task; task = task->_next)
+    {
+        task->_busy = 0;
+        task->_worst_late = 0;
+    }
+}
+
+} // namespace mk
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "mk_config.h"
+
+/**
+ * Runs the library's work by period and priority instead of
+ * round-robin. Call it from loop() in place of lutil's Processor
+ * (which is still the one to init() in setup()):
+ *
+ *     void loop()
+ *     {
+ *         mk::Scheduler::get().process();
+ *     }
+ *
+ * lutil still moves every StateDriver between states, on a task of
+ * its own (MK_STATE_PERIOD_US, lowest priority). Anything sitting in
+ * its runtime state only arms its tasks there. The tasks themselves
+ * are run whenever they're due, most important first:
+ *
+ *  - Key scans, every MK_SCAN_PERIOD_US (high)
+ *  - The controller's event pass (I2C polls up to MK_I2C_BUDGET_US,
+ *    local events, USB), every MK_EVENT_PERIOD_US (high)
+ *  - Pots (and interfaces that don't say), every MK_POT_PERIOD_US
+ *    (normal)
+ *  - Serial, preference and snapshot upkeep, every
+ *    MK_SERIAL_PERIOD_US (low)
+ *
+ * Tasks aren't preempted, a task that's running holds up everything
+ * else until it returns. The longest one is the host task writing a
+ * snapshot byte to an AVR's EEPROM (~3.3 ms, see MK_SNAPSHOT_CHUNK),
+ * which costs the key scans a few dozen periods while a save is going
+ * on.
+ *
+ * A task that hasn't finished by the time its next period starts has
+ * missed its deadline. Each task counts its misses and the total goes
+ * out with the telemetry frames, along with the time spent in tasks of
+ * each priority and the latest any task started.
+ *
+ * Sketches that keep calling lutil::Processor::get().process() run
+ * everything each pass, like before.
+ */
+
+namespace mk
+{
+
+enum TaskPriority : uint8_t
+{
+    Priority_Low = 0,
+    Priority_Normal,
+    Priority_High
+};
+
+class Task
+{
+public:
+    using Run = void (*)(void *context);
+
+    Task(Run run, void *context, uint32_t period, uint8_t priority);
+
+    // Ready to run until the next state pass. Called by the owner
+    // from its runtime state, the first call adds us to the
+    // scheduler.
+    void arm();
+
+    uint32_t period() const { return _period; }
+    uint8_t priority() const { return _priority; }
+
+    uint32_t runs() const { return _runs; }
+    uint16_t misses() const { return _misses; }
+
+    // us, since the scheduler's last clear_stats()
+    uint32_t busy() const { return _busy; }
+    uint32_t worst_late() const { return _worst_late; }
+
+private:
+    friend class Scheduler;
+
+    bool _due(unsigned long now) const;
+    void _run(unsigned long now);
+
+    Run _run_fn;
+    void *_context;
+    uint32_t _period;
+    uint8_t _priority;
+
+    bool _added = false;
+    bool _armed = false;
+    unsigned long _release = 0; // us, when we're next due
+
+    uint32_t _runs = 0;
+    uint16_t _misses = 0;
+    uint32_t _busy = 0;
+    uint32_t _worst_late = 0;
+
+    // Next in the scheduler's list, highest priority first
+    Task *_next = nullptr;
+};
+
+class Scheduler
+{
+public:
+    static Scheduler &get();
+
+    // Run everything that's due, most important first
+    void process();
+
+    // True once process() has been called, StateDrivers leave
+    // their work to their tasks from then on
+    bool running() const { return _running; }
+
+    void add(Task *task);
+
+    // Deadline misses across every task
+    uint16_t misses() const;
+
+    // us spent running tasks of a priority, and the latest any task
+    // started, since the last clear_stats()
+    uint32_t busy(uint8_t priority) const;
+    uint32_t worst_late() const;
+    void clear_stats();
+
+private:
+    Scheduler();
+
+    // lutil's Processor, for state changes
+    static void _step_states(void *context);
+
+    Task _states;
+    Task *_tasks = nullptr;
+    bool _running = false;
+};
+
+} // namespace mk
@@ -2,6 +2,8 @@
 
 #include "Arduino.h"
 
+#include "mk_trace.h"
+
 namespace mk
 {
 /* Values from an 8 bit shift register (74HC165). */
@@ -79,6 +81,9 @@ public:
 			digitalWrite(clockPin, LOW);
 		}
 		currentState = result;
+
+		if (result != lastState)
+			MK_TRACE(Trace_Shift, ploadPin, &result, (dataWidth + 7) / 8);
 		return result;
 	}
 	
@@ -0,0 +1,381 @@
+#include "mk_store.h"
+#include "mk_protocol.h"
+#include "mk_log.h"
+
+#if !defined(MK_SNAPSHOT_SD)
+#  if defined(ARDUINO) && !defined(__AVR__)
+#    define MK_SNAPSHOT_SD 1
+#  else
+#    define MK_SNAPSHOT_SD 0
+#  endif
+#endif
+
+#if defined(ARDUINO)
+#  include <EEPROM.h>
+#else
+#  include <stdio.h>
+#endif
+
+#if MK_SNAPSHOT_SD
+#  include <SD.h>
+#endif
+
+#define SnapshotMagic 0x4B4D // "MK"
+#define SnapshotVersion 1
+#define SnapshotFile "midikiti.bin"
+
+namespace mk
+{
+
+// --------------------------------------------------------------------
+// -- LayoutHash
+// --------------------------------------------------------------------
+
+size_t LayoutHash::write(uint8_t b)
+{
+    // Same steps as mk::hash, one byte at a time
+    _seed += b;
+    _seed += _seed << 10;
+    _seed ^= _seed >> 6;
+    return 1;
+}
+
+uint32_t LayoutHash::value() const
+{
+    uint32_t seed = _seed;
+    seed += seed << 3;
+    seed ^= seed >> 11;
+    seed += seed << 15;
+    return seed;
+}
+
+// --------------------------------------------------------------------
+// -- Backends
+// --------------------------------------------------------------------
+
+#if defined(ARDUINO)
+
+class EepromBackend : public SnapshotBackend
+{
+public:
+    size_t capacity() const override
+    {
+        return EEPROM.length();
+    }
+
+    bool read(size_t offset, uint8_t *data, size_t size) override
+    {
+        for (size_t i = 0; i < size; i++)
+            data[i] = EEPROM.read(offset + i);
+        return true;
+    }
+
+    bool write(size_t offset, const uint8_t *data, size_t size) override
+    {
+        // update() skips bytes that haven't changed, which is
+        // most of them from one snapshot to the next
+        for (size_t i = 0; i < size; i++)
+            EEPROM.update(offset + i, data[i]);
+        return true;
+    }
+};
+
+#else
+
+class FileBackend : public SnapshotBackend
+{
+public:
+    FileBackend()
+    {
+        _file = fopen(SnapshotFile, "r+b");
+        if (!_file)
+            _file = fopen(SnapshotFile, "w+b");
+    }
+
+    size_t capacity() const override
+    {
+        return _file ? MK_SNAPSHOT_SLOT * MK_SNAPSHOT_SD_SLOTS : 0;
+    }
+
+    bool read(size_t offset, uint8_t *data, size_t size) override
+    {
+        if (!_file || fseek(_file, offset, SEEK_SET) != 0)
+            return false;
+        return fread(data, 1, size, _file) == size;
+    }
+
+    bool write(size_t offset, const uint8_t *data, size_t size) override
+    {
+        if (!_file || fseek(_file, offset, SEEK_SET) != 0)
+            return false;
+        return fwrite(data, 1, size, _file) == size;
+    }
+
+    void commit() override
+    {
+        if (_file)
+            fflush(_file);
+    }
+
+private:
+    FILE *_file = nullptr;
+};
+
+#endif
+
+#if MK_SNAPSHOT_SD
+
+class SdBackend : public SnapshotBackend
+{
+public:
+    bool begin(int sdPin)
+    {
+        if (!SD.begin(sdPin))
+            return false;
+
+        _file = SD.open(SnapshotFile, FILE_WRITE);
+        if (!_file)
+            return false;
+
+        // Make sure every slot exists so we can seek into them
+        uint8_t zero = 0;
+        while (_file.size() < capacity())
+            _file.write(&zero, 1);
+        _file.flush();
+        return true;
+    }
+
+    size_t capacity() const override
+    {
+        return MK_SNAPSHOT_SLOT * MK_SNAPSHOT_SD_SLOTS;
+    }
+
+    bool read(size_t offset, uint8_t *data, size_t size) override
+    {
+        if (!_file.seek(offset))
+            return false;
+        return _file.read(data, size) == int(size);
+    }
+
+    bool write(size_t offset, const uint8_t *data, size_t size) override
+    {
+        if (!_file.seek(offset))
+            return false;
+        return _file.write(data, size) == size;
+    }
+
+    void commit() override
+    {
+        _file.flush();
+    }
+
+private:
+    File _file;
+};
+
+#endif
+
+SnapshotBackend *SnapshotBackend::create(int sdPin)
+{
+#if MK_SNAPSHOT_SD
+    if (sdPin >= 0)
+    {
+        static SdBackend sd;
+        if (sd.begin(sdPin))
+            return &sd;
+
+        MK_LOG(Log_NoSdCard);
+    }
+#else
+    (void)sdPin;
+#endif
+
+#if defined(ARDUINO)
+    static EepromBackend eeprom;
+    return &eeprom;
+#else
+    static FileBackend file;
+    return &file;
+#endif
+}
+
+// --------------------------------------------------------------------
+// -- SnapshotStore
+// --------------------------------------------------------------------
+
+void SnapshotStore::begin(SnapshotBackend *backend)
+{
+    _backend = backend;
+    _slot = _slot_count() - 1;
+    _generation = 0;
+
+    // Find the newest slot so the next save lands after it
+    for (size_t slot = 0; slot < _slot_count(); slot++)
+    {
+        SnapshotHeader header;
+        if (!_backend->read(_slot_offset(slot), (uint8_t*)&header, sizeof(header)))
+            continue;
+
+        if (header.magic != SnapshotMagic || header.version != SnapshotVersion)
+            continue;
+
+        if (header.generation >= _generation)
+        {
+            _generation = header.generation;
+            _slot = slot;
+        }
+    }
+}
+
+size_t SnapshotStore::_slot_count() const
+{
+    if (!_backend)
+        return 1;
+
+    size_t count = _backend->capacity() / MK_SNAPSHOT_SLOT;
+    return count > 0 ? count : 1;
+}
+
+size_t SnapshotStore::_slot_offset(size_t slot) const
+{
+    return slot * MK_SNAPSHOT_SLOT;
+}
+
+uint8_t *SnapshotStore::buffer()
+{
+    return _buffer;
+}
+
+size_t SnapshotStore::capacity() const
+{
+    return sizeof(_buffer);
+}
+
+uint16_t SnapshotStore::load(uint32_t layout)
+{
+    if (!_backend || _backend->capacity() < MK_SNAPSHOT_SLOT)
+        return 0;
+
+    // Newest snapshot for this layout. Older layouts keep their
+    // own slots until they're written over.
+    bool found = false;
+    size_t best = 0;
+    SnapshotHeader best_header;
+
+    for (size_t slot = 0; slot < _slot_count(); slot++)
+    {
+        SnapshotHeader header;
+        if (!_backend->read(_slot_offset(slot), (uint8_t*)&header, sizeof(header)))
+            continue;
+
+        if (header.magic != SnapshotMagic
+            || header.version != SnapshotVersion
+            || header.layout != layout
+            || header.size > sizeof(_buffer))
+            continue;
+
+        if (!found || header.generation > best_header.generation)
+        {
+            found = true;
+            best = slot;
+            best_header = header;
+        }
+    }
+
+    if (!found)
+        return 0;
+
+    size_t offset = _slot_offset(best) + sizeof(SnapshotHeader);
+    if (!_backend->read(offset, _buffer, best_header.size))
+        return 0;
+
+    if (crc16(_buffer, best_header.size) != best_header.crc)
+    {
+        MK_LOG(Log_SnapshotCorrupt);
+        return 0;
+    }
+
+    return best_header.size;
+}
+
+void SnapshotStore::touch()
+{
+    _dirty = true;
+    _changed = millis();
+}
+
+bool SnapshotStore::due() const
+{
+    return _backend
+        && _dirty
+        && !_writing
+        && (millis() - _changed) >= MK_SNAPSHOT_DEBOUNCE_MS;
+}
+
+void SnapshotStore::save(uint32_t layout, uint16_t size)
+{
+    _dirty = false;
+
+    if (!_backend || _backend->capacity() < MK_SNAPSHOT_SLOT)
+        return;
+
+    _header.magic = SnapshotMagic;
+    _header.version = SnapshotVersion;
+    _header.generation = _generation + 1;
+    _header.layout = layout;
+    _header.size = size;
+    _header.crc = crc16(_buffer, size);
+
+    _slot = (_slot + 1) % _slot_count();
+    _written = 0;
+    _writing = true;
+}
+
+void SnapshotStore::update()
+{
+    if (!_writing)
+        return;
+
+    // The magic goes first, so a half written snapshot is never
+    // mistaken for a good one, and comes back last to make it real.
+    // Nothing goes down in one piece, not even the header: on AVR
+    // every EEPROM byte that changes holds everything up for ~3.3 ms.
+    static const uint8_t blank[sizeof(_header.magic)] = {0xFF, 0xFF};
+    const uint16_t magic = sizeof(_header.magic);
+    const uint8_t *header = (const uint8_t*)&_header;
+    size_t slot = _slot_offset(_slot);
+
+    struct Part
+    {
+        size_t offset;
+        const uint8_t *data;
+        uint16_t size;
+    };
+    const Part parts[] = {
+        { slot, blank, magic },
+        { slot + sizeof(SnapshotHeader), _buffer, _header.size },
+        { slot + magic, header + magic, uint16_t(sizeof(SnapshotHeader) - magic) },
+        { slot, header, magic },
+    };
+
+    uint16_t start = 0;
+    for (const Part &part : parts)
+    {
+        if (_written < start + part.size)
+        {
+            uint16_t done = _written - start;
+            uint16_t n = min(uint16_t(MK_SNAPSHOT_CHUNK), uint16_t(part.size - done));
+            _backend->write(part.offset + done, part.data + done, n);
+            _written += n;
+            return;
+        }
+        start += part.size;
+    }
+
+    _backend->commit();
+
+    _generation = _header.generation;
+    _writing = false;
+}
+
+} // namespace mk
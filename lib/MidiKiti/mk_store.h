@@ -0,0 +1,122 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "mk_common.h"
+
+namespace mk
+{
+
+/**
+ * Streaming version of mk::hash. Anything that can write to a Print
+ * (e.g. MidiCommander::push_layout) can be hashed without a buffer.
+ */
+class LayoutHash : public Print
+{
+public:
+    size_t write(uint8_t b) override;
+    using Print::write;
+
+    uint32_t value() const;
+
+private:
+    uint32_t _seed = 0;
+};
+
+/**
+ * Where snapshots live. Offsets are relative to the start of the
+ * space we've been given.
+ */
+class SnapshotBackend
+{
+public:
+    // An SD card file when sdPin is set, otherwise the (emulated)
+    // EEPROM. Host builds use a file in the working directory.
+    static SnapshotBackend *create(int sdPin);
+
+    virtual size_t capacity() const = 0;
+    virtual bool read(size_t offset, uint8_t *data, size_t size) = 0;
+    virtual bool write(size_t offset, const uint8_t *data, size_t size) = 0;
+
+    // Called once a snapshot is completely written
+    virtual void commit() {}
+};
+
+#pragma pack(push, 1)
+
+struct SnapshotHeader
+{
+    uint16_t magic;      // SnapshotMagic
+    uint8_t version;     // SnapshotVersion
+    uint32_t generation; // The newest snapshot wins
+    uint32_t layout;     // LayoutHash of the rig it was taken from
+    uint16_t size;       // Bytes of records that follow
+    uint16_t crc;        // crc16 of the records
+};
+
+#pragma pack(pop)
+
+/**
+ * Persistent preference snapshots.
+ *
+ * A snapshot is the same run of records Command_SetAll takes
+ * (commander | index | size | parameters...) stamped with the layout
+ * hash of the rig it came from, so loading one is just applying it.
+ *
+ * The backend is split into slots and every save goes to the slot
+ * after the newest one, which spreads the wear around. Saves are
+ * debounced (the Manager tends to send a flurry of changes) and then
+ * written MK_SNAPSHOT_CHUNK bytes per runtime pass. The slot's magic
+ * is wiped first and put back last, so a power cut mid-write leaves
+ * the previous snapshot intact.
+ */
+class SnapshotStore
+{
+public:
+    void begin(SnapshotBackend *backend);
+
+    // Load the newest snapshot for layout into buffer(). Returns the
+    // size of the records, or 0 if there isn't one.
+    uint16_t load(uint32_t layout);
+
+    // Something has changed. We'll ask for a snapshot once things
+    // have been quiet for MK_SNAPSHOT_DEBOUNCE_MS.
+    void touch();
+
+    // True when the caller should fill buffer() and save()
+    bool due() const;
+
+    // Write size bytes of buffer() as the snapshot for layout. It
+    // goes down over the update() calls that follow.
+    void save(uint32_t layout, uint16_t size);
+
+    // Push MK_SNAPSHOT_CHUNK bytes of any pending write to the
+    // backend
+    void update();
+
+    uint8_t *buffer();
+    size_t capacity() const;
+
+private:
+    size_t _slot_count() const;
+    size_t _slot_offset(size_t slot) const;
+
+    SnapshotBackend *_backend = nullptr;
+
+    uint8_t _buffer[MK_SNAPSHOT_SLOT - sizeof(SnapshotHeader)];
+
+    // Newest slot on the backend
+    size_t _slot = 0;
+    uint32_t _generation = 0;
+
+    bool _dirty = false;
+    unsigned long _changed = 0;
+
+    // The write in progress. _written counts the magic, records and
+    // header in the order they go down.
+    bool _writing = false;
+    uint16_t _written = 0;
+    SnapshotHeader _header;
+};
+
+} // namespace mk
@@ -0,0 +1,105 @@
+#include "mk_telemetry.h"
+
+namespace mk
+{
+
+void Telemetry::set_interval(uint16_t ms)
+{
+    if (ms > 0 && ms < MK_TELEMETRY_MIN_MS)
+        ms = MK_TELEMETRY_MIN_MS;
+
+    _interval = ms;
+    _passed = false;
+    _reset(millis());
+}
+
+void Telemetry::_reset(unsigned long now)
+{
+    memset(&_frame, 0, sizeof(_frame));
+    _started = now;
+}
+
+void Telemetry::begin_pass()
+{
+    if (!enabled())
+        return;
+
+    unsigned long now = micros();
+    if (_passed)
+    {
+        // Everything since the last pass ended belongs to
+        // the interfaces
+        _frame.scan += now - _pass_end;
+
+        unsigned long period = now - _pass_start;
+        if (period > _frame.loop_max)
+            _frame.loop_max = min(period, 0xFFFFUL);
+    }
+
+    _pass_start = now;
+    _frame.loops++;
+}
+
+void Telemetry::end_pass()
+{
+    if (!enabled())
+        return;
+
+    _pass_end = micros();
+    _passed = true;
+}
+
+void Telemetry::add(Stage stage, uint32_t us)
+{
+    switch (stage)
+    {
+    case Poll:
+        _frame.poll += us;
+        if (us > _frame.poll_max)
+            _frame.poll_max = min(us, uint32_t(0xFFFF));
+        break;
+    case Usb:
+        _frame.usb += us;
+        break;
+    case Serial:
+        _frame.serial += us;
+        break;
+    }
+}
+
+void Telemetry::add_events(size_t count)
+{
+    if (!enabled())
+        return;
+
+    _frame.events += count;
+    if (count > _frame.events_high)
+        _frame.events_high = min(count, size_t(0xFF));
+}
+
+void Telemetry::note_pool(size_t count)
+{
+    if (!enabled())
+        return;
+
+    if (count > _frame.pool_high)
+        _frame.pool_high = min(count, size_t(0xFF));
+}
+
+bool Telemetry::take(TelemetryFrame &frame)
+{
+    if (!enabled())
+        return false;
+
+    unsigned long now = millis();
+    if (now - _started < _interval)
+        return false;
+
+    _frame.interval = now - _started;
+    frame = _frame;
+
+    _reset(now);
+    return true;
+}
+
+} // namespace mk
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "mk_common.h"
+
+namespace mk
+{
+
+#pragma pack(push, 1)
+
+// Pushed to the host as Command_Telemetry every interval. Times are
+// in microseconds and cover the interval unless noted.
+struct TelemetryFrame
+{
+    uint16_t interval;    // ms this frame covers
+    uint16_t loops;       // Controller event passes
+    uint16_t loop_max;    // Longest time between two event passes
+    uint32_t scan;        // Outside the controller (interfaces, lutil)
+    uint32_t poll;        // Polling I2C modules
+    uint32_t usb;         // Sending and reading USB MIDI
+    uint32_t serial;      // scan_input
+    uint16_t poll_max;    // Longest single poll
+    uint16_t events;      // Events sent on
+    uint8_t events_high;  // Most events in a single pass
+    uint8_t pool_high;    // Fullest a local commander's pool got
+    uint16_t dropped;     // Events dropped, local or I2C (total)
+    uint16_t rx_errors;   // Serial frames thrown away (total)
+    uint8_t modules;      // I2C modules online
+    uint8_t connections;  // I2C modules we know of
+    uint16_t missed;      // Scheduler deadlines missed (total)
+    uint32_t busy_high;   // Running high priority tasks
+    uint32_t busy_normal; // Running normal priority tasks
+    uint32_t busy_low;    // Running low priority tasks
+    uint16_t late_max;    // Latest any task started past its release
+};
+
+#pragma pack(pop)
+
+/**
+ * Collects what goes into a TelemetryFrame. Everything is a no-op
+ * until the host asks for frames, so there's nothing to pay for when
+ * nobody is watching.
+ */
+class Telemetry
+{
+public:
+    enum Stage : uint8_t
+    {
+        Poll,
+        Usb,
+        Serial
+    };
+
+    // ms between frames, 0 turns them off
+    void set_interval(uint16_t ms);
+    bool enabled() const { return _interval > 0; }
+
+    // Bracket a controller event pass. Without the scheduler the
+    // host's share of the runtime is in there too, so whatever falls
+    // between two passes is the interfaces'.
+    void begin_pass();
+    void end_pass();
+
+    void add(Stage stage, uint32_t us);
+    void add_events(size_t count);
+    void note_pool(size_t count);
+
+    // When a frame is due, fill in the timing parts of frame and
+    // start the next interval
+    bool take(TelemetryFrame &frame);
+
+private:
+    void _reset(unsigned long now);
+
+    uint16_t _interval = 0;
+    unsigned long _started = 0; // ms
+
+    unsigned long _pass_start = 0; // us
+    unsigned long _pass_end = 0;   // us
+    bool _passed = false;
+
+    TelemetryFrame _frame;
+};
+
+/* Times a scope into a Telemetry stage */
+class TelemetryTimer
+{
+public:
+    TelemetryTimer(Telemetry &telemetry, Telemetry::Stage stage)
+        : _telemetry(telemetry)
+        , _stage(stage)
+        , _start(telemetry.enabled() ? micros() : 0)
+    {}
+
+    ~TelemetryTimer()
+    {
+        if (_telemetry.enabled())
+            _telemetry.add(_stage, micros() - _start);
+    }
+
+private:
+    Telemetry &_telemetry;
+    Telemetry::Stage _stage;
+    unsigned long _start;
+};
+
+} // namespace mk
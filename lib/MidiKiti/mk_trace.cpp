@@ -0,0 +1,87 @@
+#include "mk_trace.h"
+#include "mk_log.h"
+#include "mk_protocol.h"
+
+#if MK_TRACING
+
+namespace mk
+{
+
+Tracer &Tracer::get()
+{
+    static Tracer tracer;
+    return tracer;
+}
+
+void Tracer::start()
+{
+    InterruptGuard guard;
+
+    _used = 0;
+    _lost = 0;
+    _total_lost = 0;
+    _enabled = true;
+
+    MK_LOG(Log_TraceStarted);
+}
+
+void Tracer::stop()
+{
+    drain();
+    _enabled = false;
+
+    MK_LOG(Log_TraceStopped, _total_lost);
+}
+
+void Tracer::add(uint8_t kind, uint8_t source, const void *data, uint8_t size)
+{
+    TraceRecord record{ uint32_t(micros()), kind, source, size };
+
+    InterruptGuard guard;
+
+    if (_used + sizeof(TraceRecord) + size > sizeof(_buffer))
+    {
+        if (_lost < 0xFFFF)
+            _lost++;
+        if (_total_lost < 0xFFFF)
+            _total_lost++;
+        return;
+    }
+
+    memcpy(_buffer + _used, &record, sizeof(TraceRecord));
+    memcpy(_buffer + _used + sizeof(TraceRecord), data, size);
+    _used += sizeof(TraceRecord) + size;
+}
+
+void Tracer::drain()
+{
+    if (!_enabled)
+        return;
+
+    uint8_t buffer[MK_TRACE_BUFFER];
+    uint16_t used;
+    uint16_t lost;
+
+    {
+        InterruptGuard guard;
+
+        used = _used;
+        lost = _lost;
+        memcpy(buffer, _buffer, used);
+        _used = 0;
+        _lost = 0;
+    }
+
+    if (!used && !lost)
+        return;
+
+    SerialLink &link = SerialLink::get();
+    link.begin(Command_Trace, sizeof(lost) + used);
+    link.write(reinterpret_cast<uint8_t*>(&lost), sizeof(lost));
+    link.write(buffer, used);
+    link.end();
+}
+
+} // namespace mk
+
+#endif
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "mk_common.h"
+
+/**
+ * Input traces. Everything the library reads from the outside world
+ * that decides what it sends, recorded with a timestamp so a host
+ * build can play it back (see lib/MidiKitiHost and src/host).
+ *
+ *  - Shift register words, when they change
+ *  - analogRead values for pots, when they change
+ *  - Polls that brought back events (or nothing at all) and frames
+ *    written to the controller, like announcements
+ *
+ * On the device the records go out in Command_Trace frames
+ * (lost (16) | records...) while the host has tracing on. A trace
+ * file is TraceMagic | TraceVersion followed by the records.
+ *
+ * Built with MK_TRACING=0 (the default) MK_TRACE is nothing at all.
+ */
+
+#define TraceMagic "MKTR"
+#define TraceVersion 2
+
+namespace mk
+{
+
+enum TraceKind : uint8_t
+{
+    Trace_Shift = 1,  // source: load pin, data: the register word,
+                      //   little endian, a byte per chip
+    Trace_Analog,     // source: pin, data: the value (16)
+    Trace_I2CReply,   // source: address, data: what a poll read back,
+                      //   nothing when the module didn't answer
+    Trace_I2CReceive  // source: our address, data: the frame
+};
+
+#pragma pack(push, 1)
+
+struct TraceRecord
+{
+    uint32_t time;  // us
+    uint8_t kind;   // TraceKind
+    uint8_t source;
+    uint8_t size;   // Bytes of data that follow
+};
+
+#pragma pack(pop)
+
+#if MK_TRACING
+
+class Tracer
+{
+public:
+    static Tracer &get();
+
+    void start();
+    void stop();
+    bool enabled() const { return _enabled; }
+
+    void add(uint8_t kind, uint8_t source, const void *data, uint8_t size);
+
+    // Send what we have to the host
+    void drain();
+
+private:
+    Tracer() {}
+
+    uint8_t _buffer[MK_TRACE_BUFFER];
+    uint16_t _used = 0;
+    uint16_t _lost = 0;  // Since the last frame
+    uint16_t _total_lost = 0;
+    volatile bool _enabled = false;
+};
+
+#define MK_TRACE(kind, source, data, size)                       \
+    do {                                                         \
+        if (mk::Tracer::get().enabled())                         \
+            mk::Tracer::get().add(kind, source, data, size);     \
+    } while (0)
+
+#else
+
+#define MK_TRACE(kind, source, data, size) do {} while (0)
+
+#endif
+
+} // namespace mk
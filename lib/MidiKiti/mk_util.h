@@ -28,4 +28,38 @@ public:
 	ElapsedMicros operator + (unsigned long val) const { ElapsedMicros r(*this); r.us -= val; return r; }
 };
 
-}
\ No newline at end of file
+// Keeps interrupts off for a scope and puts them back the way they
+// were, so it's safe to use inside a handler as well
+class InterruptGuard
+{
+public:
+    InterruptGuard()
+    {
+#if defined(__AVR__)
+        _state = SREG;
+        cli();
+#elif defined(__arm__)
+        __asm__ volatile("mrs %0, primask" : "=r"(_state));
+        __disable_irq();
+#endif
+    }
+
+    ~InterruptGuard()
+    {
+#if defined(__AVR__)
+        SREG = _state;
+#elif defined(__arm__)
+        if (!(_state & 1))
+            __enable_irq();
+#endif
+    }
+
+private:
+#if defined(__AVR__)
+    uint8_t _state;
+#elif defined(__arm__)
+    uint32_t _state;
+#endif
+};
+
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <Arduino.h>
+
+namespace mk
+{
+
+/**
+ * Fixed-capacity vector. Storage lives inline with the owner so the
+ * memory footprint is known at compile time and nothing is ever
+ * reallocated once we're running.
+ *
+ * The interface mirrors the parts of lutil::Vec that we use so the
+ * two are interchangeable at the call sites. The only real difference
+ * is that push() can fail when we're full, which the caller needs to
+ * handle (usually by dropping and counting the item).
+ */
+template<typename T, size_t N>
+class StaticVec
+{
+    static_assert(N > 0, "StaticVec requires a capacity");
+    static_assert(N <= 0xFFFF, "StaticVec capacity is too large");
+
+public:
+    using iterator = T*;
+    using const_iterator = const T*;
+
+    StaticVec()
+        : _count(0)
+    {}
+
+    static constexpr size_t capacity() { return N; }
+
+    size_t count() const { return _count; }
+    bool empty() const { return _count == 0; }
+    bool full() const { return _count >= N; }
+
+    // Returns false (and leaves us unchanged) if we're at capacity
+    bool push(const T &value)
+    {
+        if (full())
+            return false;
+
+        _data[_count++] = value;
+        return true;
+    }
+
+    // Remove the item at index and return it. Items after it are
+    // shifted down to keep ordering.
+    T pop(size_t index)
+    {
+        T value = _data[index];
+        erase(index);
+        return value;
+    }
+
+    // Remove n items starting at index
+    void erase(size_t index, size_t n = 1)
+    {
+        if (index >= _count)
+            return;
+
+        if (n > _count - index)
+            n = _count - index;
+
+        for (size_t i = index; i + n < _count; i++)
+            _data[i] = _data[i + n];
+
+        _count -= n;
+    }
+
+    void clear() { _count = 0; }
+
+    T &operator[](size_t index) { return _data[index]; }
+    const T &operator[](size_t index) const { return _data[index]; }
+
+    iterator begin() { return _data; }
+    iterator end() { return _data + _count; }
+    const_iterator begin() const { return _data; }
+    const_iterator end() const { return _data + _count; }
+
+private:
+    T _data[N];
+    uint16_t _count;
+};
+
+} // namespace mk
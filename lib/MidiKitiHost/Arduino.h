@@ -0,0 +1,162 @@
+#pragma once
+
+/**
+ * Just enough of the Arduino core to build lib/MidiKiti on a desktop.
+ *
+ * Time, pins, the serial port, Wire and usbMIDI are all backed by
+ * mk::host::Host (mk_host.h) so a harness can drive the library
+ * deterministically. ARDUINO is left undefined, the library takes
+ * its host paths where it has them.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <type_traits>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 1
+#define LOW 0
+
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+
+#define bitRead(value, bit) (((value) >> (bit)) & 0x01)
+#define bitSet(value, bit) ((value) |= (1UL << (bit)))
+#define bitClear(value, bit) ((value) &= ~(1UL << (bit)))
+#define bitWrite(value, bit, on) ((on) ? bitSet(value, bit) : bitClear(value, bit))
+
+// Compared as the type they'd both promote to, the same as the
+// Arduino macros do, without mixing signedness
+template<typename A, typename B>
+inline typename std::common_type<A, B>::type min(A a, B b)
+{
+    using T = typename std::common_type<A, B>::type;
+    return T(a) < T(b) ? T(a) : T(b);
+}
+
+template<typename A, typename B>
+inline typename std::common_type<A, B>::type max(A a, B b)
+{
+    using T = typename std::common_type<A, B>::type;
+    return T(a) > T(b) ? T(a) : T(b);
+}
+
+template<typename T, typename L, typename H>
+inline T constrain(T value, L low, H high)
+{
+    return value < low ? low : (value > high ? high : value);
+}
+
+// -- Time (virtual, see mk::host::Host)
+
+unsigned long micros();
+unsigned long millis();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+
+// -- Pins
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+
+long map(long value, long in_low, long in_high, long out_low, long out_high);
+
+long random(long high);
+long random(long low, long high);
+void randomSeed(unsigned long seed);
+
+// Single threaded, nothing to hold off
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+// -- Streams
+
+class Print
+{
+public:
+    virtual ~Print() {}
+
+    virtual size_t write(uint8_t b) = 0;
+    virtual size_t write(const uint8_t *data, size_t size)
+    {
+        size_t n = 0;
+        while (size--)
+            n += write(*data++);
+        return n;
+    }
+
+    size_t write(const char *text)
+    {
+        return write(reinterpret_cast<const uint8_t*>(text), strlen(text));
+    }
+
+    virtual int availableForWrite() { return 0; }
+    virtual void flush() {}
+};
+
+class Stream : public Print
+{
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+
+    size_t readBytes(uint8_t *buffer, size_t size)
+    {
+        size_t n = 0;
+        while (n < size && available() > 0)
+            buffer[n++] = uint8_t(read());
+        return n;
+    }
+
+    size_t readBytes(char *buffer, size_t size)
+    {
+        return readBytes(reinterpret_cast<uint8_t*>(buffer), size);
+    }
+
+    void setTimeout(unsigned long) {}
+};
+
+// The USB serial, bytes come from and go to mk::host::Host
+class HostSerial : public Stream
+{
+public:
+    void begin(unsigned long) {}
+    void end() {}
+    operator bool() const { return true; }
+
+    size_t write(uint8_t b) override;
+    size_t write(const uint8_t *data, size_t size) override;
+    using Print::write;
+
+    int availableForWrite() override { return 4096; }
+
+    int available() override;
+    int read() override;
+    int peek() override;
+};
+
+extern HostSerial Serial;
+
+// Teensy's usbMIDI, what's sent lands in mk::host::Host::midi()
+class HostUsbMidi
+{
+public:
+    void sendNoteOn(uint8_t note, uint8_t velocity, uint8_t channel, uint8_t cable = 0);
+    void sendNoteOff(uint8_t note, uint8_t velocity, uint8_t channel, uint8_t cable = 0);
+    void sendControlChange(uint8_t control, uint8_t value, uint8_t channel, uint8_t cable = 0);
+    bool read(uint8_t /*channel*/ = 0) { return false; }
+    void send_now() {}
+};
+
+extern HostUsbMidi usbMIDI;
@@ -0,0 +1,10 @@
+#pragma once
+
+#include "Arduino.h"
+
+// Nothing in the library uses it on the host, it's only included
+class SoftwareSerial
+{
+public:
+    SoftwareSerial(uint8_t /*rx*/, uint8_t /*tx*/) {}
+};
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "Arduino.h"
+
+#define WIRE_BUFFER_SIZE 32
+
+/**
+ * The Wire library on top of mk::host::WireBus. Whatever bus the
+ * harness installed with Host::set_bus() decides who answers.
+ */
+class TwoWire : public Stream
+{
+public:
+    void begin();
+    void begin(uint8_t address);
+    void begin(int address) { begin(uint8_t(address)); }
+    void end();
+    void setClock(uint32_t hz);
+
+    // -- Controller side
+
+    void beginTransmission(uint8_t address);
+    void beginTransmission(int address) { beginTransmission(uint8_t(address)); }
+    uint8_t endTransmission(bool stop = true);
+
+    uint8_t requestFrom(uint8_t address, uint8_t size, bool stop = true);
+    uint8_t requestFrom(int address, int size)
+    {
+        return requestFrom(uint8_t(address), uint8_t(size));
+    }
+
+    size_t write(uint8_t b) override;
+    size_t write(const uint8_t *data, size_t size) override;
+    using Print::write;
+
+    int available() override;
+    int read() override;
+    int peek() override;
+
+    // -- Target side
+
+    void onReceive(void (*handler)(int));
+    void onRequest(void (*handler)());
+
+    // -- Host side, for mk::host::WireBus implementations
+
+    uint8_t address() const { return _address; }
+    uint32_t clock() const { return _clock; }
+
+    // A frame written to us, runs the receive handler
+    void deliver(const uint8_t *data, size_t size);
+
+    // Run the request handler and take what it wrote
+    size_t answer(uint8_t *data, size_t size);
+
+private:
+    uint8_t _address = 0;
+    uint32_t _clock = 100000;
+
+    uint8_t _target = 0;
+    bool _transmitting = false;
+    bool _answering = false;
+
+    uint8_t _tx[WIRE_BUFFER_SIZE];
+    size_t _tx_count = 0;
+
+    uint8_t _rx[WIRE_BUFFER_SIZE];
+    size_t _rx_count = 0;
+    size_t _rx_read = 0;
+
+    void (*_on_receive)(int) = nullptr;
+    void (*_on_request)() = nullptr;
+};
+
+extern TwoWire Wire;
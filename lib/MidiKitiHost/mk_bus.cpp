@@ -0,0 +1,260 @@
+#include "mk_bus.h"
+
+#include <Wire.h>
+
+namespace mk
+{
+namespace host
+{
+
+SimBus::SimBus(const Config &config)
+    : _config(config)
+    , _random(config.seed)
+{}
+
+void SimBus::add_module(uint32_t uid, double rate)
+{
+    Module module;
+    module.uid = uid;
+    module.rate = rate;
+
+    // Everyone powers up at once and goes for the bus on the first pass
+    module.announced = Host::get().now() - MK_ENUMERATE_RETRY_MS * 1000ULL;
+    _modules.push_back(module);
+}
+
+size_t SimBus::engaged() const
+{
+    size_t count = 0;
+    for (const Module &module : _modules)
+        count += module.engaged ? 1 : 0;
+    return count;
+}
+
+void SimBus::clear()
+{
+    _pressed.clear();
+    _overflowed = 0;
+    _busy = 0;
+}
+
+uint64_t SimBus::_next_interval(double rate)
+{
+    std::exponential_distribution<double> interval(rate);
+    return max(uint64_t(1), uint64_t(interval(_random) * 1e6));
+}
+
+void SimBus::_announce(Module &module)
+{
+    uint64_t now = Host::get().now();
+
+    uint16_t uuid = 1 | uint16_t(OCTAVE_ID) << 8;
+    Announcement announcement{ I2C_Announce, module.uid, uuid };
+
+    // Nobody listening yet is the same as losing arbitration, we
+    // go again after the retry time
+    if (Wire.address() == MK_I2C_CONTROLLER)
+        Wire.deliver(reinterpret_cast<uint8_t*>(&announcement), sizeof(Announcement));
+    module.announced = now;
+}
+
+void SimBus::update()
+{
+    uint64_t now = Host::get().now();
+
+    for (Module &module : _modules)
+    {
+        if (!module.connected)
+        {
+            if (now - module.announced >= MK_ENUMERATE_RETRY_MS * 1000ULL)
+                _announce(module);
+        }
+        else if (now - module.polled >= MK_MODULE_ORPHAN_MS * 1000ULL)
+        {
+            // Back to the shared address, the controller has lost us
+            module.connected = false;
+            module.address = MK_I2C_ENUMERATE;
+            _announce(module);
+        }
+
+        if (!module.engaged || module.rate <= 0)
+            continue;
+
+        for (; module.next_event <= now; module.next_event += _next_interval(module.rate))
+        {
+            // Tags run 1-127, velocity 0 would be a note off
+            _tag = _tag % 127 + 1;
+            module.down = !module.down;
+            _pressed.push_back(Pressed{ module.next_event, _tag, module.down });
+
+            KeyEvent key{ KEY_EVENT_ID, module.address, 0, _tag, module.down };
+            RawEvent event = {0};
+            memcpy(&event, &key, sizeof(KeyEvent));
+
+            if (!module.pool.push(event))
+            {
+                _overflowed++;
+                if (module.unreported_drops < 0xFF)
+                    module.unreported_drops++;
+            }
+        }
+    }
+}
+
+void SimBus::_receive(Module &module, const uint8_t *data, size_t size)
+{
+    uint64_t now = Host::get().now();
+
+    if (!module.connected)
+    {
+        if (size != sizeof(Assignment) || data[0] != I2C_Assign)
+            return;
+
+        Assignment assignment;
+        memcpy(&assignment, data, sizeof(Assignment));
+
+        if (assignment.uid == module.uid)
+        {
+            module.address = assignment.address;
+            module.connected = true;
+            module.polled = now;
+        }
+        return;
+    }
+
+    if (size == 3 && memcmp(data, ENGAGE_COMMAND, 3) == 0)
+    {
+        if (!module.engaged && module.rate > 0)
+            module.next_event = now + _next_interval(module.rate);
+        module.engaged = true;
+        return;
+    }
+
+    if (size < sizeof(TunnelHeader))
+        return;
+
+    TunnelHeader header;
+    memcpy(&header, data, sizeof(TunnelHeader));
+
+    // Preferences aren't part of what we're measuring
+    if (header.tag == I2C_ReadDescriptor)
+    {
+        module.reply_offset = header.offset;
+        module.descriptor_armed = true;
+    }
+}
+
+size_t SimBus::_answer(Module &module, uint8_t *data, size_t size)
+{
+    uint64_t now = Host::get().now();
+    module.polled = now;
+
+    uint8_t buffer[MK_I2C_BUFFER];
+    size_t n = 0;
+
+    if (module.descriptor_armed)
+    {
+        module.descriptor_armed = false;
+
+        // A single octave, like src/Octave.cpp
+        uint8_t descriptor[sizeof(DescriptorHeader) + sizeof(DescriptorEntry)];
+        DescriptorHeader header{ MK_DESCRIPTOR_VERSION, 1, module.uid };
+        DescriptorEntry entry{ OCTAVE_ID, 0, 0, KEY_EVENT_ID };
+        memcpy(descriptor, &header, sizeof(DescriptorHeader));
+        memcpy(descriptor + sizeof(DescriptorHeader), &entry, sizeof(DescriptorEntry));
+
+        buffer[n++] = 1;
+        buffer[n++] = sizeof(descriptor);
+        for (uint8_t i = module.reply_offset; i < sizeof(descriptor) && n < sizeof(buffer); i++)
+            buffer[n++] = descriptor[i];
+    }
+    else if (module.poll_promised > 0
+        && now - module.poll_header_at < MK_I2C_POLL_GAP_US)
+    {
+        // The second read of a poll
+        uint8_t count = module.poll_promised;
+        module.poll_promised = 0;
+
+        for (uint8_t i = 0; i < count; i++)
+        {
+            memcpy(buffer + n, &module.pool[i], WireEventSize);
+            n += WireEventSize;
+        }
+        module.pool.erase(0, count);
+    }
+    else
+    {
+        uint8_t count = min(module.pool.count(), size_t(EventsPerPoll));
+        buffer[n++] = count;
+        buffer[n++] = module.unreported_drops;
+        module.unreported_drops = 0;
+
+        module.poll_promised = count;
+        module.poll_header_at = now;
+    }
+
+    // The controller clocks out as much as it asked for, the
+    // released bus reads as ones past what we wrote
+    memset(data, 0xFF, size);
+    memcpy(data, buffer, min(n, size));
+    return size;
+}
+
+void SimBus::_transfer(size_t size, uint32_t stretch)
+{
+    // 9 clocks a byte (8 and the ack) plus the start and stop
+    uint64_t bits = (1 + size) * 9 + 2;
+    uint64_t us = (bits * 1000000 + _config.clock / 2) / _config.clock
+        + size * _config.byte_gap
+        + stretch;
+
+    _busy += us;
+    Host::get().advance(us);
+}
+
+uint8_t SimBus::transmit(uint8_t address, const uint8_t *data, size_t size)
+{
+    bool acked = false;
+    for (Module &module : _modules)
+    {
+        if (module.address != address)
+            continue;
+
+        _receive(module, data, size);
+        acked = true;
+    }
+
+    // A NACK stops after the address
+    _transfer(acked ? size : 0, 0);
+    return acked ? 0 : 2;
+}
+
+size_t SimBus::request(uint8_t address, uint8_t *data, size_t size)
+{
+    bool acked = false;
+    uint8_t answer[WIRE_BUFFER_SIZE];
+    size = min(size, sizeof(answer));
+
+    for (Module &module : _modules)
+    {
+        if (!module.connected || module.address != address)
+            continue;
+
+        // Open drain, anyone sending a zero wins the bit
+        _answer(module, answer, size);
+        if (!acked)
+            memcpy(data, answer, size);
+        else
+        {
+            for (size_t i = 0; i < size; i++)
+                data[i] &= answer[i];
+        }
+        acked = true;
+    }
+
+    _transfer(acked ? size : 0, acked ? _config.stretch : 0);
+    return acked ? size : 0;
+}
+
+} // namespace host
+} // namespace mk
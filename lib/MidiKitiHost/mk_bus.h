@@ -0,0 +1,122 @@
+#pragma once
+
+#include "mk_host.h"
+#include "mk_common.h"
+
+#include <random>
+#include <vector>
+
+namespace mk
+{
+namespace host
+{
+
+/**
+ * An I2C bus full of modules for the controller to talk to. Every
+ * transfer the controller makes costs virtual time (Host::advance)
+ * at the bus clock, so a pass over N modules takes as long as it
+ * would on the wire and key-to-MIDI latency comes out of that.
+ *
+ * The modules speak the module side of the protocol the way
+ * MidiCommander does (announce, take an address, hand over the
+ * descriptor, answer polls from a pool of MK_MAX_POOLED_EVENTS)
+ * and press keys at random at the rate they're given. They're
+ * models rather than MidiCommanders, a commander owns the Wire
+ * handlers and there's only one Wire in a process.
+ *
+ * Modules given the same uid end up on the same address. Both
+ * answer every read and the bus ANDs what they send, as it would.
+ */
+class SimBus : public WireBus
+{
+public:
+    struct Config
+    {
+        uint32_t clock = MK_I2C_CLOCK; // Hz
+        uint32_t byte_gap = 0;   // us between bytes, the controller's Wire overhead
+        uint32_t stretch = 0;    // us a module holds the clock before it answers a read
+        uint32_t seed = 0;
+    };
+
+    // A key event a module pooled, velocity tags it through to the MIDI
+    struct Pressed
+    {
+        uint64_t time; // us
+        uint8_t velocity;
+        bool pressed;
+    };
+
+    explicit SimBus(const Config &config);
+
+    // rate is events a second, 0 for a module that only sits there
+    void add_module(uint32_t uid, double rate);
+
+    // Announce, give up on the controller and press keys up to now.
+    // Call before every pass.
+    void update();
+
+    size_t modules() const { return _modules.size(); }
+    size_t engaged() const;
+
+    const std::vector<Pressed> &pressed() const { return _pressed; }
+
+    // Events that didn't fit a module's pool
+    size_t overflowed() const { return _overflowed; }
+
+    // us the controller has held the bus for
+    uint64_t busy() const { return _busy; }
+
+    // Forget what's been pressed so far, for after enumeration
+    void clear();
+
+    uint8_t transmit(uint8_t address, const uint8_t *data, size_t size) override;
+    size_t request(uint8_t address, uint8_t *data, size_t size) override;
+
+private:
+    struct Module
+    {
+        uint32_t uid;
+        double rate;
+
+        uint8_t address = MK_I2C_ENUMERATE;
+        bool connected = false;
+        bool engaged = false;
+
+        uint64_t announced = 0;
+        uint64_t polled = 0;
+        uint64_t next_event = 0;
+        bool down = false;
+
+        bool descriptor_armed = false;
+        uint8_t reply_offset = 0;
+
+        // Events the last poll header counted
+        uint8_t poll_promised = 0;
+        uint64_t poll_header_at = 0;
+
+        EventBuffer pool;
+        uint8_t unreported_drops = 0;
+    };
+
+    void _announce(Module &module);
+    void _receive(Module &module, const uint8_t *data, size_t size);
+    size_t _answer(Module &module, uint8_t *data, size_t size);
+
+    uint64_t _next_interval(double rate);
+
+    // Start, the address byte, size bytes and a stop
+    void _transfer(size_t size, uint32_t stretch);
+
+    Config _config;
+    std::mt19937 _random;
+
+    std::vector<Module> _modules;
+    std::vector<Pressed> _pressed;
+
+    uint8_t _tag = 0;
+    size_t _overflowed = 0;
+    uint64_t _busy = 0;
+};
+
+} // namespace host
+} // namespace mk
@@ -0,0 +1,370 @@
+#include "mk_host.h"
+
+#include <Wire.h>
+
+#include <random>
+
+HostSerial Serial;
+HostUsbMidi usbMIDI;
+TwoWire Wire;
+
+namespace
+{
+
+std::mt19937 &generator()
+{
+    static std::mt19937 gen;
+    return gen;
+}
+
+} // namespace
+
+namespace mk
+{
+namespace host
+{
+
+Host &Host::get()
+{
+    static Host host;
+    return host;
+}
+
+void Host::reset()
+{
+    _now = 0;
+    _digital.clear();
+    _analog.clear();
+    _shift.clear();
+    _latched = nullptr;
+    _next_bit = -1;
+    _bus = nullptr;
+    _serial_in.clear();
+    _midi.clear();
+    generator().seed(0);
+}
+
+void Host::pin_mode(uint8_t pin, uint8_t mode)
+{
+    if (mode == INPUT_PULLUP && !_digital.count(pin))
+        _digital[pin] = HIGH;
+}
+
+void Host::write_pin(uint8_t pin, uint8_t value)
+{
+    _digital[pin] = value;
+
+    // Load low latches the register, the bits come out from the top
+    if (value == LOW)
+    {
+        auto it = _shift.find(pin);
+        if (it != _shift.end())
+        {
+            _latched = &it->second;
+            _next_bit = _latched->width - 1;
+        }
+    }
+}
+
+int Host::read_pin(uint8_t pin)
+{
+    if (_latched && (_latched->data_pin < 0 || _latched->data_pin == pin))
+    {
+        _latched->data_pin = pin;
+        if (_next_bit < 0)
+            return LOW;
+        return (_latched->word >> _next_bit--) & 1;
+    }
+
+    auto it = _digital.find(pin);
+    return it == _digital.end() ? LOW : it->second;
+}
+
+void Host::set_digital(uint8_t pin, int value)
+{
+    _digital[pin] = value;
+}
+
+void Host::set_analog(uint8_t pin, int value)
+{
+    _analog[pin] = value;
+}
+
+int Host::analog(uint8_t pin) const
+{
+    auto it = _analog.find(pin);
+    return it == _analog.end() ? 0 : it->second;
+}
+
+void Host::set_shift(uint8_t load, uint64_t word, uint8_t width)
+{
+    ShiftRegister &reg = _shift[load];
+    reg.word = word;
+    reg.width = width;
+}
+
+void Host::serial_input(const uint8_t *data, size_t size)
+{
+    _serial_in.insert(_serial_in.end(), data, data + size);
+}
+
+void Host::set_serial_output(std::function<void(const uint8_t*, size_t)> output)
+{
+    _serial_out = output;
+}
+
+void Host::serial_output(const uint8_t *data, size_t size)
+{
+    if (_serial_out)
+        _serial_out(data, size);
+}
+
+void Host::midi(uint8_t status, uint8_t data1, uint8_t data2)
+{
+    _midi.push_back(MidiMessage{ _now, status, data1, data2 });
+}
+
+} // namespace host
+} // namespace mk
+
+using mk::host::Host;
+
+// --------------------------------------------------------------------
+// -- Arduino
+// --------------------------------------------------------------------
+
+unsigned long micros()
+{
+    return (unsigned long)Host::get().now();
+}
+
+unsigned long millis()
+{
+    return (unsigned long)(Host::get().now() / 1000);
+}
+
+void delay(unsigned long ms)
+{
+    Host::get().advance(uint64_t(ms) * 1000);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+    Host::get().advance(us);
+}
+
+void yield() {}
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+    Host::get().pin_mode(pin, mode);
+}
+
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+    Host::get().write_pin(pin, value);
+}
+
+int digitalRead(uint8_t pin)
+{
+    return Host::get().read_pin(pin);
+}
+
+int analogRead(uint8_t pin)
+{
+    return Host::get().analog(pin);
+}
+
+long map(long value, long in_low, long in_high, long out_low, long out_high)
+{
+    return (value - in_low) * (out_high - out_low) / (in_high - in_low) + out_low;
+}
+
+long random(long high)
+{
+    return high > 0 ? long(generator()() % (unsigned long)high) : 0;
+}
+
+long random(long low, long high)
+{
+    return high > low ? low + random(high - low) : low;
+}
+
+void randomSeed(unsigned long seed)
+{
+    generator().seed(seed);
+}
+
+// --------------------------------------------------------------------
+// -- Serial
+// --------------------------------------------------------------------
+
+size_t HostSerial::write(uint8_t b)
+{
+    Host::get().serial_output(&b, 1);
+    return 1;
+}
+
+size_t HostSerial::write(const uint8_t *data, size_t size)
+{
+    Host::get().serial_output(data, size);
+    return size;
+}
+
+int HostSerial::available()
+{
+    return int(Host::get().serial_in().size());
+}
+
+int HostSerial::read()
+{
+    auto &in = Host::get().serial_in();
+    if (in.empty())
+        return -1;
+
+    uint8_t b = in.front();
+    in.pop_front();
+    return b;
+}
+
+int HostSerial::peek()
+{
+    auto &in = Host::get().serial_in();
+    return in.empty() ? -1 : in.front();
+}
+
+// --------------------------------------------------------------------
+// -- usbMIDI
+// --------------------------------------------------------------------
+
+void HostUsbMidi::sendNoteOn(uint8_t note, uint8_t velocity, uint8_t channel, uint8_t)
+{
+    Host::get().midi(0x90 | ((channel - 1) & 0x0F), note, velocity);
+}
+
+void HostUsbMidi::sendNoteOff(uint8_t note, uint8_t velocity, uint8_t channel, uint8_t)
+{
+    Host::get().midi(0x80 | ((channel - 1) & 0x0F), note, velocity);
+}
+
+void HostUsbMidi::sendControlChange(uint8_t control, uint8_t value, uint8_t channel, uint8_t)
+{
+    Host::get().midi(0xB0 | ((channel - 1) & 0x0F), control, value);
+}
+
+// --------------------------------------------------------------------
+// -- Wire
+// --------------------------------------------------------------------
+
+void TwoWire::begin()
+{
+    _address = 0;
+}
+
+void TwoWire::begin(uint8_t address)
+{
+    _address = address;
+}
+
+void TwoWire::end() {}
+
+void TwoWire::setClock(uint32_t hz)
+{
+    _clock = hz;
+}
+
+void TwoWire::beginTransmission(uint8_t address)
+{
+    _target = address;
+    _transmitting = true;
+    _tx_count = 0;
+}
+
+uint8_t TwoWire::endTransmission(bool)
+{
+    _transmitting = false;
+
+    mk::host::WireBus *bus = Host::get().bus();
+    if (!bus)
+        return 2;
+    return bus->transmit(_target, _tx, _tx_count);
+}
+
+uint8_t TwoWire::requestFrom(uint8_t address, uint8_t size, bool)
+{
+    _rx_read = 0;
+    _rx_count = 0;
+
+    mk::host::WireBus *bus = Host::get().bus();
+    if (bus)
+        _rx_count = bus->request(address, _rx, min(size_t(size), sizeof(_rx)));
+    return uint8_t(_rx_count);
+}
+
+size_t TwoWire::write(uint8_t b)
+{
+    if (!(_transmitting || _answering) || _tx_count >= sizeof(_tx))
+        return 0;
+
+    _tx[_tx_count++] = b;
+    return 1;
+}
+
+size_t TwoWire::write(const uint8_t *data, size_t size)
+{
+    size_t n = 0;
+    while (n < size && write(data[n]))
+        n++;
+    return n;
+}
+
+int TwoWire::available()
+{
+    return int(_rx_count - _rx_read);
+}
+
+int TwoWire::read()
+{
+    return _rx_read < _rx_count ? _rx[_rx_read++] : -1;
+}
+
+int TwoWire::peek()
+{
+    return _rx_read < _rx_count ? _rx[_rx_read] : -1;
+}
+
+void TwoWire::onReceive(void (*handler)(int))
+{
+    _on_receive = handler;
+}
+
+void TwoWire::onRequest(void (*handler)())
+{
+    _on_request = handler;
+}
+
+void TwoWire::deliver(const uint8_t *data, size_t size)
+{
+    size = min(size, sizeof(_rx));
+    memcpy(_rx, data, size);
+    _rx_count = size;
+    _rx_read = 0;
+
+    if (_on_receive)
+        _on_receive(int(size));
+}
+
+size_t TwoWire::answer(uint8_t *data, size_t size)
+{
+    if (!_on_request)
+        return 0;
+
+    _answering = true;
+    _tx_count = 0;
+    _on_request();
+    _answering = false;
+
+    size = min(size, _tx_count);
+    memcpy(data, _tx, size);
+    return size;
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include <deque>
+#include <functional>
+#include <map>
+#include <vector>
+
+namespace mk
+{
+namespace host
+{
+
+// Something usbMIDI sent
+struct MidiMessage
+{
+    uint64_t time; // us
+    uint8_t status;
+    uint8_t data1;
+    uint8_t data2;
+};
+
+/**
+ * Who's on the other end of Wire. The trace player answers with what
+ * a real bus did, the simulator (mk_bus.h) with modules of its own.
+ */
+class WireBus
+{
+public:
+    virtual ~WireBus() {}
+
+    // We wrote a frame to address. 0 when it was acknowledged, 2
+    // when nobody answered (same as Wire.endTransmission()).
+    virtual uint8_t transmit(uint8_t address, const uint8_t *data, size_t size) = 0;
+
+    // We read up to size bytes from address. How many came back,
+    // 0 when nobody answered.
+    virtual size_t request(uint8_t address, uint8_t *data, size_t size) = 0;
+};
+
+/**
+ * The world outside the library on a host build. Time only moves
+ * when the harness (or a delay) moves it, so the same inputs always
+ * give the same outputs.
+ */
+class Host
+{
+public:
+    static Host &get();
+
+    // Back to time 0 with nothing connected
+    void reset();
+
+    // -- Time
+
+    uint64_t now() const { return _now; } // us
+    void advance(uint64_t us) { _now += us; }
+
+    // -- Pins
+
+    void pin_mode(uint8_t pin, uint8_t mode);
+    void write_pin(uint8_t pin, uint8_t value);
+    int read_pin(uint8_t pin);
+
+    void set_digital(uint8_t pin, int value);
+    void set_analog(uint8_t pin, int value);
+    int analog(uint8_t pin) const;
+
+    // A 74HC165 chain latched when its load pin goes low. The first
+    // pin read after that is its data pin, bits come out MSB first.
+    void set_shift(uint8_t load, uint64_t word, uint8_t width);
+
+    // -- Wire
+
+    void set_bus(WireBus *bus) { _bus = bus; }
+    WireBus *bus() const { return _bus; }
+
+    // -- Serial
+
+    void serial_input(const uint8_t *data, size_t size);
+    std::deque<uint8_t> &serial_in() { return _serial_in; }
+
+    // Everything the library writes to Serial, dropped when unset
+    void set_serial_output(std::function<void(const uint8_t*, size_t)> output);
+    void serial_output(const uint8_t *data, size_t size);
+
+    // -- MIDI
+
+    void midi(uint8_t status, uint8_t data1, uint8_t data2);
+    const std::vector<MidiMessage> &midi_out() const { return _midi; }
+    void clear_midi() { _midi.clear(); }
+
+private:
+    Host() {}
+
+    struct ShiftRegister
+    {
+        uint64_t word = 0;
+        uint8_t width = 0;
+        int data_pin = -1;
+    };
+
+    uint64_t _now = 0;
+
+    std::map<uint8_t, int> _digital;
+    std::map<uint8_t, int> _analog;
+
+    std::map<uint8_t, ShiftRegister> _shift; // By load pin
+    ShiftRegister *_latched = nullptr;
+    int _next_bit = -1;
+
+    WireBus *_bus = nullptr;
+
+    std::deque<uint8_t> _serial_in;
+    std::function<void(const uint8_t*, size_t)> _serial_out;
+
+    std::vector<MidiMessage> _midi;
+};
+
+} // namespace host
+} // namespace mk
@@ -0,0 +1,158 @@
+#include "mk_trace_player.h"
+
+#include <Wire.h>
+
+#include <fstream>
+#include <iterator>
+
+namespace mk
+{
+namespace host
+{
+
+bool TracePlayer::load(const std::string &path, std::string &error)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        error = "Can't open " + path;
+        return false;
+    }
+
+    std::vector<uint8_t> bytes(
+        (std::istreambuf_iterator<char>(file)),
+        std::istreambuf_iterator<char>()
+    );
+
+    size_t header = strlen(TraceMagic) + 1;
+    if (bytes.size() < header
+        || memcmp(bytes.data(), TraceMagic, strlen(TraceMagic)) != 0)
+    {
+        error = path + " isn't a trace";
+        return false;
+    }
+
+    if (bytes[header - 1] != TraceVersion)
+    {
+        error = path + " is trace version " + std::to_string(bytes[header - 1]);
+        return false;
+    }
+
+    _records.clear();
+
+    uint32_t first = 0;
+    size_t offset = header;
+    while (offset + sizeof(TraceRecord) <= bytes.size())
+    {
+        TraceRecord record;
+        memcpy(&record, bytes.data() + offset, sizeof(TraceRecord));
+        offset += sizeof(TraceRecord);
+
+        if (offset + record.size > bytes.size())
+        {
+            error = path + " is cut short";
+            return false;
+        }
+
+        if (_records.empty())
+            first = record.time;
+
+        _records.push_back(Record{
+            record.time - first,
+            record.kind,
+            record.source,
+            std::vector<uint8_t>(
+                bytes.begin() + offset,
+                bytes.begin() + offset + record.size
+            )
+        });
+        offset += record.size;
+    }
+
+    return true;
+}
+
+uint32_t TracePlayer::duration() const
+{
+    return _records.empty() ? 0 : _records.back().time;
+}
+
+void TracePlayer::start()
+{
+    _next = 0;
+    _started = Host::get().now();
+    _replies.clear();
+    _silent.clear();
+}
+
+void TracePlayer::update()
+{
+    Host &host = Host::get();
+    uint64_t now = host.now() - _started;
+
+    for (; _next < _records.size() && _records[_next].time <= now; _next++)
+    {
+        const Record &record = _records[_next];
+
+        switch (record.kind)
+        {
+        case Trace_Shift:
+        {
+            uint64_t word = 0;
+            memcpy(&word, record.data.data(), min(record.data.size(), sizeof(word)));
+            host.set_shift(record.source, word, uint8_t(record.data.size() * 8));
+            break;
+        }
+        case Trace_Analog:
+        {
+            uint16_t value = 0;
+            memcpy(&value, record.data.data(), min(record.data.size(), sizeof(value)));
+            host.set_analog(record.source, value);
+            break;
+        }
+        case Trace_I2CReply:
+            _replies[record.source].push_back(record.data);
+            break;
+        case Trace_I2CReceive:
+            Wire.deliver(record.data.data(), record.data.size());
+            break;
+        }
+    }
+}
+
+uint8_t TracePlayer::transmit(uint8_t, const uint8_t *, size_t)
+{
+    // The modules heard whatever the controller said at the time
+    return 0;
+}
+
+size_t TracePlayer::request(uint8_t address, uint8_t *data, size_t size)
+{
+    auto &replies = _replies[address];
+    if (replies.empty())
+    {
+        if (_silent[address] || size < sizeof(PollHeader))
+            return 0;
+
+        // Nothing to report
+        PollHeader header{ 0, 0 };
+        memcpy(data, &header, sizeof(PollHeader));
+        return sizeof(PollHeader);
+    }
+
+    // A poll reply was traced as one, the controller reads it as
+    // the header and then the events
+    std::vector<uint8_t> &reply = replies.front();
+    _silent[address] = reply.empty();
+
+    size = min(size, reply.size());
+    memcpy(data, reply.data(), size);
+
+    reply.erase(reply.begin(), reply.begin() + size);
+    if (reply.empty())
+        replies.pop_front();
+    return size;
+}
+
+} // namespace host
+} // namespace mk
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "mk_host.h"
+#include "mk_trace.h"
+
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace mk
+{
+namespace host
+{
+
+/**
+ * Plays a trace (mk_trace.h) into the Host. Shift register words and
+ * analog values are set as their time comes, frames written to the
+ * controller are delivered to Wire's receive handler, and polls are
+ * answered with the replies the real modules gave.
+ *
+ * Polls between recorded replies get an empty one (count 0), that's
+ * what wasn't recorded. A recorded miss makes the module go quiet
+ * until it's heard from again.
+ */
+class TracePlayer : public WireBus
+{
+public:
+    bool load(const std::string &path, std::string &error);
+
+    size_t count() const { return _records.size(); }
+
+    // us from the first record to the last
+    uint32_t duration() const;
+
+    // Trace time 0 is now
+    void start();
+
+    // Apply everything up to now
+    void update();
+
+    bool done() const { return _next >= _records.size(); }
+
+    uint8_t transmit(uint8_t address, const uint8_t *data, size_t size) override;
+    size_t request(uint8_t address, uint8_t *data, size_t size) override;
+
+private:
+    struct Record
+    {
+        uint32_t time; // From the first record
+        uint8_t kind;
+        uint8_t source;
+        std::vector<uint8_t> data;
+    };
+
+    std::vector<Record> _records;
+    size_t _next = 0;
+    uint64_t _started = 0;
+
+    // Replies waiting for the next poll of each address
+    std::map<uint8_t, std::deque<std::vector<uint8_t>>> _replies;
+    std::map<uint8_t, bool> _silent;
+};
+
+} // namespace host
+} // namespace mk
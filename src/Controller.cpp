@@ -15,5 +15,5 @@ void setup()
 
 void loop()
 {
-  lutil::Processor::get().process();
+  mk::Scheduler::get().process();
 }
\ No newline at end of file
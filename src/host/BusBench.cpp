@@ -0,0 +1,286 @@
+/**
+ * Runs the controller against a simulated I2C bus (mk_bus.h) with
+ * more and more modules pressing keys faster and faster, and prints
+ * a CSV row for each combination: key-to-MIDI latency and how many
+ * events never made it out. Built by the native_bus env:
+ *
+ *     pio run -e native_bus
+ *     .pio/build/native_bus/program --modules 1,2,4,8,16 --rate 10,100,1000
+ *
+ * Latency runs from the module pooling the event to the controller
+ * sending the MIDI, so it's the polling design and the bus, not the
+ * key scan. Each combination runs in a process of its own, the
+ * library is all singletons.
+ *
+ * With --scheduler 1 the controller runs under mk::Scheduler, as the
+ * firmware does, next to an empty key scan task. late_us is the
+ * longest that scan waited past its release, what the event pass
+ * (and the rest of the controller) holds the keys up by.
+ */
+#include <Arduino.h>
+
+#include "MidiKiti.h"
+#include "mk_controller.h"
+#include "mk_scheduler.h"
+
+#include "mk_host.h"
+#include "mk_bus.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <deque>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+using mk::host::Host;
+using mk::host::SimBus;
+
+namespace
+{
+
+struct Options
+{
+    std::vector<int> modules = { 1, 2, 4, 8, 16 };
+    std::vector<double> rates = { 10, 50, 200, 1000 }; // Events a second, each module
+    SimBus::Config bus;
+    int conflicts = 0;        // Modules sharing a uid with another
+    uint32_t tick = 100;      // us between passes when the bus is idle
+    uint32_t duration = 2000; // ms of playing
+    uint32_t tail = 200;      // ms to let the pools drain
+    bool scheduler = false;   // Run under mk::Scheduler
+};
+
+void usage()
+{
+    fprintf(stderr,
+        "usage: busbench [--modules <n,...>] [--rate <hz,...>] [--clock <hz>]\n"
+        "                [--byte-gap <us>] [--stretch <us>] [--conflicts <n>]\n"
+        "                [--tick <us>] [--duration <ms>] [--tail <ms>] [--seed <n>]\n"
+        "                [--scheduler <0|1>]\n"
+    );
+}
+
+template<typename T>
+bool parse_list(const std::string &text, std::vector<T> &values)
+{
+    values.clear();
+
+    std::stringstream stream(text);
+    for (std::string item; std::getline(stream, item, ',');)
+        values.push_back(T(atof(item.c_str())));
+
+    return !values.empty();
+}
+
+bool parse(int argc, char **argv, Options &options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (i + 1 >= argc)
+            return false;
+
+        std::string value = argv[++i];
+
+        if (arg == "--modules")
+        {
+            if (!parse_list(value, options.modules))
+                return false;
+        }
+        else if (arg == "--rate")
+        {
+            if (!parse_list(value, options.rates))
+                return false;
+        }
+        else if (arg == "--clock")
+            options.bus.clock = max(1, atoi(value.c_str()));
+        else if (arg == "--byte-gap")
+            options.bus.byte_gap = atoi(value.c_str());
+        else if (arg == "--stretch")
+            options.bus.stretch = atoi(value.c_str());
+        else if (arg == "--conflicts")
+            options.conflicts = atoi(value.c_str());
+        else if (arg == "--tick")
+            options.tick = max(1, atoi(value.c_str()));
+        else if (arg == "--duration")
+            options.duration = atoi(value.c_str());
+        else if (arg == "--tail")
+            options.tail = atoi(value.c_str());
+        else if (arg == "--seed")
+            options.bus.seed = atoi(value.c_str());
+        else if (arg == "--scheduler")
+            options.scheduler = atoi(value.c_str()) != 0;
+        else
+            return false;
+    }
+
+    return true;
+}
+
+struct Result
+{
+    size_t joined = 0;
+    size_t pressed = 0;
+    size_t delivered = 0;
+    size_t overflowed = 0;
+    double p50 = 0;
+    double p99 = 0;
+    double worst = 0;
+    double bus = 0; // Of the time, held by the controller
+    uint32_t late = 0; // us, under the scheduler
+};
+
+// Stands in for an octave's scan, it only has to be on time
+void scan(void *) {}
+
+mk::Task scan_task(&scan, nullptr, MK_SCAN_PERIOD_US, mk::Priority_High);
+
+void step(const Options &options)
+{
+    if (options.scheduler)
+    {
+        scan_task.arm();
+        mk::Scheduler::get().process();
+    }
+    else
+        lutil::Processor::get().process();
+}
+
+double percentile(const std::vector<uint64_t> &sorted, double fraction)
+{
+    if (sorted.empty())
+        return 0;
+    return double(sorted[size_t(fraction * (sorted.size() - 1))]);
+}
+
+Result run(const Options &options, int modules, double rate)
+{
+    Host &host = Host::get();
+    host.reset();
+
+    SimBus bus(options.bus);
+    host.set_bus(&bus);
+
+    for (int i = 0; i < modules; i++)
+    {
+        // The last few clone an earlier module's uid
+        uint32_t uid = 0x1000 + i;
+        if (i >= modules - options.conflicts)
+            uid = 0x1000 + i % max(1, modules - options.conflicts);
+        bus.add_module(uid, rate);
+    }
+
+    mk::MidiController::Config config;
+    config.midi_channel = 1;
+    config.expected_modules = modules - options.conflicts;
+    new mk::MidiController(config);
+
+    lutil::Processor::get().init();
+
+    // Enumeration, as long as it takes (up to the controller's limit)
+    uint64_t give_up = host.now() + (MK_ENUMERATE_MAX_MS + 500) * 1000ULL;
+    while (bus.engaged() < size_t(modules) && host.now() < give_up)
+    {
+        bus.update();
+        step(options);
+        host.advance(options.tick);
+    }
+
+    Result result;
+    result.joined = bus.engaged();
+
+    // Let whatever enumeration held up catch up before we count
+    step(options);
+
+    bus.clear();
+    host.clear_midi();
+    mk::Scheduler::get().clear_stats();
+
+    uint64_t start = host.now();
+    uint64_t stop = start + options.duration * 1000ULL;
+    uint64_t end = stop + options.tail * 1000ULL;
+
+    while (host.now() < end)
+    {
+        // Keys stop at the end of the run, the tail is for draining
+        if (host.now() < stop)
+            bus.update();
+        step(options);
+        host.advance(options.tick);
+    }
+
+    // Velocity tags the event, note on or off which way it went
+    std::map<std::pair<uint8_t, bool>, std::deque<uint64_t>> waiting;
+    for (const SimBus::Pressed &pressed : bus.pressed())
+        waiting[{ pressed.velocity, pressed.pressed }].push_back(pressed.time);
+
+    std::vector<uint64_t> latencies;
+    for (const mk::host::MidiMessage &message : host.midi_out())
+    {
+        bool on = (message.status & 0xF0) == 0x90;
+        auto &queue = waiting[{ message.data2, on }];
+        if (queue.empty() || queue.front() > message.time)
+            continue; // Garbled on the way
+
+        latencies.push_back(message.time - queue.front());
+        queue.pop_front();
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+
+    result.pressed = bus.pressed().size();
+    result.delivered = latencies.size();
+    result.overflowed = bus.overflowed();
+    result.p50 = percentile(latencies, 0.5);
+    result.p99 = percentile(latencies, 0.99);
+    result.worst = latencies.empty() ? 0 : double(latencies.back());
+    result.bus = double(bus.busy()) / double(host.now() - start);
+    result.late = scan_task.worst_late();
+    return result;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    Options options;
+    if (!parse(argc, argv, options))
+    {
+        usage();
+        return 2;
+    }
+
+    printf("modules,rate,clock,joined,pressed,delivered,dropped,overflowed,"
+        "p50_us,p99_us,max_us,bus_load,late_us\n");
+    fflush(stdout);
+
+    for (int modules : options.modules)
+    {
+        for (double rate : options.rates)
+        {
+            pid_t child = fork();
+            if (child == 0)
+            {
+                Result r = run(options, modules, rate);
+                printf("%d,%g,%u,%zu,%zu,%zu,%zu,%zu,%.0f,%.0f,%.0f,%.3f,%u\n",
+                    modules, rate, options.bus.clock, r.joined,
+                    r.pressed, r.delivered, r.pressed - r.delivered, r.overflowed,
+                    r.p50, r.p99, r.worst, r.bus, r.late);
+                fflush(stdout);
+                _exit(0);
+            }
+
+            int status = 0;
+            waitpid(child, &status, 0);
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+                fprintf(stderr, "%d modules at %g Hz didn't finish\n", modules, rate);
+        }
+    }
+
+    return 0;
+}
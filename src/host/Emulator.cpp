@@ -0,0 +1,295 @@
+/**
+ * A controller on a pseudo-terminal, for running the Manager (or
+ * cli.py) against without hardware. The library itself answers, so
+ * GetLayout, DumpAll, Get/SetPreferences, logs and both protocol
+ * versions are exactly what a board would send. Built by the
+ * native_emu env:
+ *
+ *     pio run -e native_emu
+ *     .pio/build/native_emu/program --commanders 8 --pots 32 --delay 5 --loss 0.001
+ *
+ * It prints the pty to open. The topology is local commanders with
+ * the same interfaces each. Replies can be held back (--delay,
+ * --jitter) and bytes dropped going either way (--loss) to see how
+ * the host copes. Time follows the wall clock.
+ */
+#include <Arduino.h>
+
+#include "MidiKiti.h"
+#include "mk_octave.h"
+#include "mk_pot.h"
+#include "mk_controller.h"
+#include "mk_command.h"
+
+#include "mk_host.h"
+
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <random>
+#include <string>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/select.h>
+#include <termios.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+using Clock = std::chrono::steady_clock;
+using mk::host::Host;
+
+namespace
+{
+
+struct Options
+{
+    int commanders = 1;
+    int pots = 4;       // Each commander
+    int octaves = 0;
+    double delay = 0;   // ms before a reply goes out
+    double jitter = 0;  // ms, added to the delay at random
+    double loss = 0;    // Chance of any byte going missing
+    uint32_t seed = 0;
+};
+
+void usage()
+{
+    fprintf(stderr,
+        "usage: emulator [--commanders <n>] [--pots <n>] [--octaves <n>]\n"
+        "                [--delay <ms>] [--jitter <ms>] [--loss <p>] [--seed <n>]\n"
+    );
+}
+
+bool parse(int argc, char **argv, Options &options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (i + 1 >= argc)
+            return false;
+
+        const char *value = argv[++i];
+
+        if (arg == "--commanders")
+            options.commanders = atoi(value);
+        else if (arg == "--pots")
+            options.pots = atoi(value);
+        else if (arg == "--octaves")
+            options.octaves = atoi(value);
+        else if (arg == "--delay")
+            options.delay = atof(value);
+        else if (arg == "--jitter")
+            options.jitter = atof(value);
+        else if (arg == "--loss")
+            options.loss = atof(value);
+        else if (arg == "--seed")
+            options.seed = atoi(value);
+        else
+            return false;
+    }
+
+    int interfaces = options.pots + options.octaves;
+    if (options.commanders < 1 || options.commanders > MK_MAX_LOCAL_COMMANDERS)
+    {
+        fprintf(stderr, "--commanders is 1 to %d in this build\n", MK_MAX_LOCAL_COMMANDERS);
+        return false;
+    }
+    if (interfaces < 1 || interfaces > MK_MAX_INTERFACES)
+    {
+        fprintf(stderr, "1 to %d interfaces a commander in this build\n", MK_MAX_INTERFACES);
+        return false;
+    }
+
+    return true;
+}
+
+void build_rig(const Options &options)
+{
+    mk::MidiController::Config controller_config;
+    controller_config.midi_channel = 1;
+    controller_config.expected_modules = 0;
+    mk::MidiController *controller = new mk::MidiController(controller_config);
+
+    // Nothing is read from the pins, they only need to be different
+    int pin = 2;
+    uint8_t control = 1;
+
+    for (int c = 0; c < options.commanders; c++)
+    {
+        mk::MidiCommander *command = new mk::MidiCommander();
+
+        for (int i = 0; i < options.octaves; i++)
+        {
+            mk::MidiOctave::Config config;
+            config.loadPin = pin++;
+            config.clockEnablePin = pin++;
+            config.dataPin = pin++;
+            config.clickPin = pin++;
+            new mk::MidiOctave(config, command);
+        }
+
+        for (int i = 0; i < options.pots; i++)
+        {
+            mk::MidiPot::Config config;
+            config.pin = pin++;
+            config.control = control++;
+            new mk::MidiPot(config, command);
+        }
+
+        controller->add_local(command);
+    }
+}
+
+// The master side of a new pty, raw both ways
+int open_pty(std::string &name, int &slave)
+{
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0)
+        return -1;
+
+    name = ptsname(master);
+
+    // Holding the slave open keeps the master readable between
+    // clients (no EIO when the Manager closes the port)
+    slave = open(name.c_str(), O_RDWR | O_NOCTTY);
+    if (slave < 0)
+        return -1;
+
+    termios tio;
+    tcgetattr(slave, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(slave, TCSANOW, &tio);
+
+    fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+    return master;
+}
+
+struct Pending
+{
+    uint64_t due; // us, host time
+    uint8_t byte;
+};
+
+volatile sig_atomic_t running = 1;
+
+void stop(int)
+{
+    running = 0;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    Options options;
+    if (!parse(argc, argv, options))
+    {
+        usage();
+        return 2;
+    }
+
+    std::string name;
+    int slave = -1;
+    int master = open_pty(name, slave);
+    if (master < 0)
+    {
+        perror("pty");
+        return 1;
+    }
+
+    // Snapshots land in the working directory, start from none
+    fs::path work = fs::temp_directory_path()
+        / ("midikiti-emulator-" + std::to_string(getpid()));
+    fs::create_directories(work);
+    fs::path origin = fs::current_path();
+    fs::current_path(work);
+
+    std::mt19937 random(options.seed);
+    std::uniform_real_distribution<double> chance(0.0, 1.0);
+
+    Host &host = Host::get();
+    host.reset();
+
+    // Everything the controller writes waits out the delay
+    std::deque<Pending> outgoing;
+    host.set_serial_output([&](const uint8_t *data, size_t size) {
+        uint64_t due = host.now() + uint64_t(
+            (options.delay + options.jitter * chance(random)) * 1000
+        );
+
+        // In order, whatever the jitter
+        if (!outgoing.empty())
+            due = max(due, outgoing.back().due);
+
+        for (size_t i = 0; i < size; i++)
+        {
+            if (options.loss > 0 && chance(random) < options.loss)
+                continue;
+            outgoing.push_back(Pending{ due, data[i] });
+        }
+    });
+
+    build_rig(options);
+    lutil::Processor::get().init();
+
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+
+    int interfaces = options.commanders
+        * (options.pots + options.octaves);
+    printf("%s: %d commanders, %d interfaces\n", name.c_str(), options.commanders, interfaces);
+    fflush(stdout);
+
+    Clock::time_point began = Clock::now();
+    uint8_t buffer[4096];
+
+    while (running)
+    {
+        // Wait for the host, or the next reply to fall due
+        timeval timeout{ 0, 1000 };
+        fd_set readable;
+        FD_ZERO(&readable);
+        FD_SET(master, &readable);
+        select(master + 1, &readable, nullptr, nullptr, &timeout);
+
+        uint64_t now = std::chrono::duration_cast<std::chrono::microseconds>(
+            Clock::now() - began
+        ).count();
+        if (now > host.now())
+            host.advance(now - host.now());
+
+        ssize_t n = read(master, buffer, sizeof(buffer));
+        for (ssize_t i = 0; i < n; i++)
+        {
+            if (options.loss > 0 && chance(random) < options.loss)
+                continue;
+            host.serial_input(&buffer[i], 1);
+        }
+
+        lutil::Processor::get().process();
+
+        size_t ready = 0;
+        while (ready < outgoing.size() && ready < sizeof(buffer)
+            && outgoing[ready].due <= host.now())
+        {
+            buffer[ready] = outgoing[ready].byte;
+            ready++;
+        }
+
+        if (ready > 0)
+        {
+            ssize_t written = write(master, buffer, ready);
+            if (written > 0)
+                outgoing.erase(outgoing.begin(), outgoing.begin() + written);
+        }
+    }
+
+    close(master);
+    close(slave);
+
+    fs::current_path(origin);
+    fs::remove_all(work);
+    return 0;
+}
@@ -0,0 +1,336 @@
+/**
+ * Plays an input trace (lib/MidiKiti/mk_trace.h) through the library
+ * on the host and checks the MIDI that comes out against a golden
+ * file. Built by the native env:
+ *
+ *     pio run -e native
+ *     .pio/build/native/program trills.mktr --golden trills.golden
+ *
+ * Time is virtual. Passes run every --tick us of it, as fast as the
+ * host can manage unless --speed asks for real time (1) or a
+ * multiple of it. The report at the end is the time the host spent
+ * on the passes, with the probes when the build has them.
+ */
+#include <Arduino.h>
+
+#include "MidiKiti.h"
+#include "mk_octave.h"
+#include "mk_pot.h"
+#include "mk_controller.h"
+#include "mk_command.h"
+
+#include "mk_host.h"
+#include "mk_trace_player.h"
+
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+using Clock = std::chrono::steady_clock;
+using mk::host::Host;
+
+namespace
+{
+
+struct Options
+{
+    std::string trace;
+    std::string golden;
+    bool update = false;     // Write the golden file instead
+    bool timing = true;      // Compare when messages went out too
+    double speed = 0;        // 0 is as fast as we can
+    uint32_t tick = 100;     // us between passes
+    uint32_t warmup = 1000;  // ms to get through boot before the trace
+    uint32_t tail = 100;     // ms to keep going after the trace
+};
+
+void usage()
+{
+    fprintf(stderr,
+        "usage: replay <trace> [--golden <file>] [--update] [--no-timing]\n"
+        "              [--speed <x>] [--tick <us>] [--warmup <ms>] [--tail <ms>]\n"
+    );
+}
+
+bool parse(int argc, char **argv, Options &options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool more = i + 1 < argc;
+
+        if (arg == "--golden" && more)
+            options.golden = argv[++i];
+        else if (arg == "--update")
+            options.update = true;
+        else if (arg == "--no-timing")
+            options.timing = false;
+        else if (arg == "--speed" && more)
+            options.speed = atof(argv[++i]);
+        else if (arg == "--tick" && more)
+            options.tick = max(1, atoi(argv[++i]));
+        else if (arg == "--warmup" && more)
+            options.warmup = atoi(argv[++i]);
+        else if (arg == "--tail" && more)
+            options.tail = atoi(argv[++i]);
+        else if (arg[0] != '-' && options.trace.empty())
+            options.trace = arg;
+        else
+            return false;
+    }
+
+    return !options.trace.empty() && !(options.update && options.golden.empty());
+}
+
+// The rig in src/Octave.cpp. Traces are recorded on that firmware so
+// keep the two in step.
+mk::MidiKey first_key(0, 1, 2);
+
+void build_rig()
+{
+    mk::MidiCommander *command = new mk::MidiCommander();
+
+    mk::MidiOctave::Config octave_config;
+    octave_config.loadPin = 14;
+    octave_config.clockEnablePin = 4;
+    octave_config.dataPin = 16;
+    octave_config.clickPin = 15;
+    mk::MidiOctave *octave = new mk::MidiOctave(octave_config, command);
+    octave->add_key(&first_key);
+
+    mk::MidiPot::Config pot_config;
+    pot_config.pin = 19;
+    pot_config.control = 1;
+    pot_config.low = 15;
+    new mk::MidiPot(pot_config, command);
+
+    mk::MidiController::Config controller_config;
+    controller_config.midi_channel = 1;
+    mk::MidiController *controller = new mk::MidiController(controller_config);
+    controller->add_local(command);
+}
+
+// time (us from the start of the trace) | status | data1 | data2
+std::string format(const mk::host::MidiMessage &message, uint64_t start, bool timing)
+{
+    char line[64];
+    if (timing)
+    {
+        snprintf(line, sizeof(line), "%llu %02x %02x %02x",
+            (unsigned long long)(message.time - start),
+            message.status, message.data1, message.data2);
+    }
+    else
+    {
+        snprintf(line, sizeof(line), "%02x %02x %02x",
+            message.status, message.data1, message.data2);
+    }
+    return line;
+}
+
+bool compare(const std::vector<std::string> &output, const std::string &path, bool timing)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        fprintf(stderr, "Can't open golden file %s\n", path.c_str());
+        return false;
+    }
+
+    std::vector<std::string> golden;
+    for (std::string line; std::getline(file, line);)
+    {
+        if (line.empty())
+            continue;
+
+        // Golden files always have the time, drop it when we don't
+        if (!timing)
+            line = line.substr(line.find(' ') + 1);
+        golden.push_back(line);
+    }
+
+    size_t count = min(golden.size(), output.size());
+    for (size_t i = 0; i < count; i++)
+    {
+        if (golden[i] != output[i])
+        {
+            printf("golden: differs at message %zu\n", i);
+            printf("  expected: %s\n", golden[i].c_str());
+            printf("  got:      %s\n", output[i].c_str());
+            return false;
+        }
+    }
+
+    if (golden.size() != output.size())
+    {
+        printf("golden: expected %zu messages, got %zu\n",
+            golden.size(), output.size());
+        return false;
+    }
+
+    printf("golden: %zu messages match\n", output.size());
+    return true;
+}
+
+void report_probes()
+{
+#if MK_PROBES
+    static const char *names[] = {
+        "loop", "shift_in", "keys", "pot", "poll", "serial", "usb_out",
+        "usb_in"
+    };
+
+    mk::Probes &probes = mk::Probes::get();
+    double tpu = mk::Clock::ticks_per_us();
+
+    printf("%-10s %10s %10s %10s %10s\n", "probe", "count", "p50 us", "p99 us", "max us");
+    for (uint8_t id = 0; id < mk::Probe_Count; id++)
+    {
+        const mk::ProbeStats &stats = probes.stats(id);
+        if (!stats.count)
+            continue;
+
+        // Upper bound of the bucket holding each percentile
+        double p[2] = { 0, 0 };
+        const double fractions[2] = { 0.5, 0.99 };
+        for (int f = 0; f < 2; f++)
+        {
+            uint32_t total = 0;
+            for (uint16_t count : stats.buckets)
+                total += count;
+
+            uint32_t seen = 0;
+            for (int b = 0; b < MK_PROBE_BUCKETS; b++)
+            {
+                seen += stats.buckets[b];
+                if (seen >= total * fractions[f])
+                {
+                    p[f] = double(2ULL << b) / tpu;
+                    break;
+                }
+            }
+        }
+
+        printf("%-10s %10u %10.2f %10.2f %10.2f\n",
+            id < sizeof(names) / sizeof(names[0]) ? names[id] : "?",
+            stats.count, p[0], p[1], stats.max / tpu);
+    }
+#endif
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    Options options;
+    if (!parse(argc, argv, options))
+    {
+        usage();
+        return 2;
+    }
+
+    mk::host::TracePlayer player;
+    std::string error;
+    if (!player.load(options.trace, error))
+    {
+        fprintf(stderr, "%s\n", error.c_str());
+        return 2;
+    }
+
+    // Snapshots land in the working directory, start from none
+    fs::path work = fs::temp_directory_path()
+        / ("midikiti-replay-" + std::to_string(std::random_device()()));
+    fs::create_directories(work);
+    fs::path origin = fs::current_path();
+    fs::current_path(work);
+
+    Host &host = Host::get();
+    host.reset();
+    host.set_bus(&player);
+
+    build_rig();
+    lutil::Processor::get().init();
+
+    // Boot and enumeration
+    while (host.now() < uint64_t(options.warmup) * 1000)
+    {
+        lutil::Processor::get().process();
+        host.advance(options.tick);
+    }
+
+#if MK_PROBES
+    mk::Probes::get().reset();
+#endif
+    host.clear_midi();
+
+    uint64_t start = host.now();
+    uint64_t end = start + player.duration() + uint64_t(options.tail) * 1000;
+    player.start();
+
+    uint64_t passes = 0;
+    Clock::time_point began = Clock::now();
+    Clock::duration busy(0);
+
+    while (host.now() < end)
+    {
+        Clock::time_point pass = Clock::now();
+        player.update();
+        lutil::Processor::get().process();
+        busy += Clock::now() - pass;
+        passes++;
+
+        host.advance(options.tick);
+
+        if (options.speed > 0)
+        {
+            // Keep pace with the trace
+            auto due = began + std::chrono::microseconds(
+                uint64_t((host.now() - start) / options.speed)
+            );
+            std::this_thread::sleep_until(due);
+        }
+    }
+
+    fs::current_path(origin);
+    fs::remove_all(work);
+
+    std::vector<std::string> output;
+    for (const mk::host::MidiMessage &message : host.midi_out())
+        output.push_back(format(message, start, options.timing || options.update));
+
+    double virtual_ms = (host.now() - start) / 1000.0;
+    double busy_ms = std::chrono::duration<double, std::milli>(busy).count();
+
+    printf("trace: %s, %zu records over %.1f ms\n",
+        options.trace.c_str(), player.count(), player.duration() / 1000.0);
+    printf("replay: %llu passes, %zu MIDI messages\n",
+        (unsigned long long)passes, output.size());
+    printf("processing: %.3f ms (%.3f us a pass, %.0fx real time)\n",
+        busy_ms, busy_ms * 1000.0 / max(passes, uint64_t(1)),
+        busy_ms > 0 ? virtual_ms / busy_ms : 0.0);
+    report_probes();
+
+    if (options.update)
+    {
+        std::ofstream file(options.golden);
+        for (const std::string &line : output)
+            file << line << "\n";
+        printf("golden: wrote %zu messages to %s\n", output.size(), options.golden.c_str());
+        return 0;
+    }
+
+    if (options.golden.empty())
+    {
+        for (const std::string &line : output)
+            printf("%s\n", line.c_str());
+        return 0;
+    }
+
+    return compare(output, options.golden, options.timing) ? 0 : 1;
+}
@@ -0,0 +1,167 @@
+"""
+The Manager's side of the serial protocol (extra/Manager/mk.py). Only
+needs the standard library:
+
+    python -m unittest discover -s test/manager
+"""
+import os
+import sys
+import unittest
+
+sys.path.insert(
+    0, os.path.join(os.path.dirname(__file__), '..', '..', 'extra', 'Manager')
+)
+
+import mk
+
+
+def pattern(size, zero_every=0):
+    """
+    Long runs of non-zero bytes, to cross the 254 byte COBS block
+    boundary every which way
+    """
+    return bytes(
+        0 if zero_every and i % zero_every == zero_every - 1 else 1 + i % 251
+        for i in range(size)
+    )
+
+
+def negotiated(version=2):
+    """
+    :return: ``FrameDecoder`` that's seen the controller's Hello
+    """
+    decoder = mk.FrameDecoder()
+    decoder.feed(mk.encode_frame(mk.Hello, version))
+    return decoder
+
+
+class TestCrc(unittest.TestCase):
+
+    def test_check_value(self):
+        # CRC-16/CCITT-FALSE, same as mk::crc16
+        self.assertEqual(mk.crc16(b'123456789'), 0x29B1)
+        self.assertEqual(mk.crc16(b'56789', mk.crc16(b'1234')), 0x29B1)
+
+
+class TestCobs(unittest.TestCase):
+
+    def test_round_trip(self):
+        for size in (0, 1, 253, 254, 255, 508, 509, 600):
+            for every in (0, 1, 7, 254):
+                data = pattern(size, every)
+                encoded = mk.cobs_encode(data)
+
+                self.assertNotIn(0, encoded)
+                self.assertEqual(mk.cobs_decode(encoded), data, (size, every))
+
+    def test_full_block(self):
+        # 254 non-zero bytes make a full block, no implied zero
+        encoded = mk.cobs_encode(pattern(254))
+        self.assertEqual(encoded[0], 0xFF)
+        self.assertEqual(len(encoded), 256)
+
+    def test_malformed(self):
+        self.assertIsNone(mk.cobs_decode(b'\x03\x11\x00\x22'))
+        self.assertIsNone(mk.cobs_decode(b'\x05\x11\x22'))
+
+
+class TestFrameDecoder(unittest.TestCase):
+
+    def test_v1(self):
+        decoder = mk.FrameDecoder()
+        commands = decoder.feed(
+            b'\x12' + mk.encode_frame(mk.GetPreferences, b'\x01\x02')
+        )
+
+        self.assertEqual(len(commands), 1)
+        self.assertEqual(commands[0].id, mk.GetPreferences)
+        self.assertEqual(commands[0].payload, b'\x01\x02')
+
+    def test_v1_layout(self):
+        # The count of commanders where the size would be, then each
+        # commander's size and interfaces
+        layout = bytes([mk.StartFlag, mk.GetLayout, 2, 1, 0xF2, 2, 0xF2, 0xF1])
+
+        decoder = mk.FrameDecoder()
+        self.assertEqual(decoder.feed(layout[:-1]), [])
+
+        commands = decoder.feed(layout[-1:])
+        self.assertEqual(commands[0].payload, b'\x02\x01\xf2\x02\xf2\xf1')
+
+    def test_hello(self):
+        decoder = mk.FrameDecoder()
+        commands = decoder.feed(mk.encode_frame(mk.Hello, 2))
+
+        self.assertEqual(commands[0].id, mk.Hello)
+        self.assertEqual(decoder.version, 2)
+
+    def test_hello_stays_v1(self):
+        decoder = negotiated(1)
+        self.assertEqual(decoder.version, 1)
+
+    def test_v2_round_trip(self):
+        decoder = negotiated()
+
+        for seq, size in enumerate((0, 1, 248, 249, 254, 255, 600), 1):
+            payload = pattern(size, 97 if size == 600 else 0)
+            frame = mk.encode_frame(mk.Message, payload, 2, seq, ack=3)
+
+            commands = decoder.feed(frame)
+            self.assertEqual(len(commands), 1)
+            self.assertEqual(commands[0].id, mk.Message)
+            self.assertEqual(commands[0].payload, payload)
+            self.assertEqual((commands[0].seq, commands[0].ack), (seq, 3))
+
+        self.assertEqual(decoder.errors, 0)
+
+    def test_v2_byte_at_a_time(self):
+        decoder = negotiated()
+        frame = mk.encode_frame(mk.Message, pattern(300), 2, 1)
+
+        commands = []
+        for i in range(len(frame)):
+            commands += decoder.feed(frame[i:i + 1])
+
+        self.assertEqual(len(commands), 1)
+        self.assertEqual(commands[0].payload, pattern(300))
+
+    def test_v2_resync(self):
+        decoder = negotiated()
+
+        bad = bytearray(mk.encode_frame(mk.Message, b'bad', 2, 1))
+        bad[3] ^= 0x10
+
+        commands = decoder.feed(
+            bytes(bad)
+            + b'\x5a' * 40 + b'\x00'
+            + mk.encode_frame(mk.Message, b'good', 2, 2)
+        )
+
+        self.assertEqual([c.payload for c in commands], [b'good'])
+        self.assertEqual(decoder.errors, 2) # The crc, then the noise
+
+    def test_v2_missed_seq(self):
+        decoder = negotiated()
+        decoder.feed(mk.encode_frame(mk.Message, b'a', 2, 1))
+        decoder.feed(mk.encode_frame(mk.Message, b'c', 2, 3))
+        self.assertEqual(decoder.errors, 1)
+
+        # 255 wraps to 1, the firmware never sends 0
+        decoder = negotiated()
+        decoder.feed(mk.encode_frame(mk.Message, b'a', 2, 255))
+        decoder.feed(mk.encode_frame(mk.Message, b'b', 2, 1))
+        self.assertEqual(decoder.errors, 0)
+
+    def test_v1_hello_in_v2(self):
+        decoder = negotiated()
+        commands = decoder.feed(
+            mk.encode_frame(mk.Message, b'x', 2, 1)
+            + mk.encode_frame(mk.Hello, 1) + b'\x00'
+        )
+
+        self.assertEqual([c.id for c in commands], [mk.Message, mk.Hello])
+        self.assertEqual(decoder.version, 1)
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,136 @@
+/**
+ * What the Manager's LayoutDiscovery sees with an I2C module in
+ * front of the local commanders: the layout, then a GetPreferences
+ * for every local interface answered under the same commander number
+ * it was asked for.
+ *
+ *     pio test -e native -f test_discovery
+ */
+#include <Arduino.h>
+#include <unity.h>
+
+#include "mk_controller.h"
+#include "mk_command.h"
+#include "mk_pot.h"
+#include "mk_host.h"
+#include "mk_bus.h"
+
+#include <vector>
+
+using mk::host::Host;
+using mk::host::SimBus;
+using Bytes = std::vector<uint8_t>;
+
+namespace
+{
+
+SimBus *bus = nullptr;
+Bytes written;
+
+const uint8_t LocalPots = 2;
+
+void feed(const Bytes &data)
+{
+    Host::get().serial_input(data.data(), data.size());
+}
+
+void run(uint32_t ms)
+{
+    Host &host = Host::get();
+    uint64_t stop = host.now() + ms * 1000ULL;
+    while (host.now() < stop)
+    {
+        bus->update();
+        lutil::Processor::get().process();
+        host.advance(100);
+    }
+}
+
+// The v1 reply to a request: id | size | payload
+Bytes request(uint8_t id, const Bytes &payload)
+{
+    Bytes frame = { Command_StartFlag, id, uint8_t(payload.size()) };
+    frame.insert(frame.end(), payload.begin(), payload.end());
+
+    written.clear();
+    feed(frame);
+    run(20);
+
+    if (written.size() < 3 || written[0] != Command_StartFlag || written[1] != id)
+        return Bytes();
+    return Bytes(written.begin() + 3, written.end());
+}
+
+} // namespace
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+void test_layout_counts_the_module_first()
+{
+    Bytes layout = request(Command_GetLayout, {});
+
+    // The module, then the local commander
+    TEST_ASSERT_EQUAL(2, written.size() > 2 ? written[2] : 0);
+    TEST_ASSERT_FALSE(layout.empty());
+
+    size_t local = 1 + layout[0];
+    TEST_ASSERT_TRUE(local < layout.size());
+    TEST_ASSERT_EQUAL(LocalPots, layout[local]);
+}
+
+void test_local_preferences_keep_their_number()
+{
+    for (uint8_t index = 0; index < LocalPots; index++)
+    {
+        Bytes reply = request(Command_GetPreferences, { 1, index });
+
+        // LayoutDiscovery matches on these two bytes
+        TEST_ASSERT_TRUE(reply.size() > 2);
+        TEST_ASSERT_EQUAL(1, reply[0]);
+        TEST_ASSERT_EQUAL(index, reply[1]);
+    }
+}
+
+int main(int, char **)
+{
+    Host &host = Host::get();
+    host.reset();
+    host.set_serial_output([](const uint8_t *data, size_t size) {
+        written.insert(written.end(), data, data + size);
+    });
+
+    bus = new SimBus(SimBus::Config());
+    bus->add_module(0x1000, 0);
+    host.set_bus(bus);
+
+    mk::MidiController::Config config;
+    config.midi_channel = 1;
+    config.expected_modules = 1;
+    mk::MidiController *controller = new mk::MidiController(config);
+
+    mk::MidiCommander *command = new mk::MidiCommander();
+    for (uint8_t i = 0; i < LocalPots; i++)
+    {
+        mk::MidiPot::Config pot;
+        pot.pin = 14 + i;
+        pot.control = 1 + i;
+        new mk::MidiPot(pot, command);
+    }
+    controller->add_local(command);
+
+    lutil::Processor::get().init();
+
+    // Enumeration, then into the runtime
+    run(MK_ENUMERATE_MAX_MS + 500);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_layout_counts_the_module_first);
+    RUN_TEST(test_local_preferences_keep_their_number);
+    return UNITY_END();
+}
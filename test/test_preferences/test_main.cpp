@@ -0,0 +1,118 @@
+/**
+ * Parameters are checked as a whole before any of a set is applied
+ * (MidiCommander::check_preferences / patch_preferences).
+ *
+ *     pio test -e native -f test_preferences
+ */
+#include <Arduino.h>
+#include <unity.h>
+
+#include "mk_command.h"
+#include "mk_pot.h"
+#include "mk_button.h"
+#include "mk_host.h"
+
+using mk::host::Host;
+
+namespace
+{
+
+mk::MidiCommander *command = nullptr;
+
+// Index 0
+mk::MidiPot *pot = nullptr;
+
+uint8_t buffer[MK_MAX_PARAMETERS];
+
+// Of PotParameters::low, after parameter_type, control and high
+const uint8_t LowOffset = 5;
+
+mk::PotParameters current()
+{
+    pot->parameters(buffer, sizeof(buffer));
+    return mk::parameters_from<mk::PotParameters>(buffer);
+}
+
+bool check(const mk::PotParameters &parms)
+{
+    memcpy(buffer, &parms, sizeof(parms));
+    return command->check_preferences(0, sizeof(parms), buffer);
+}
+
+} // namespace
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+void test_check_accepts_defaults()
+{
+    TEST_ASSERT_TRUE(check(current()));
+}
+
+void test_check_rejects_out_of_range()
+{
+    mk::PotParameters parms = current();
+    parms.control = 128;
+    TEST_ASSERT_FALSE(check(parms));
+
+    parms = current();
+    parms.midi_high = 200;
+    TEST_ASSERT_FALSE(check(parms));
+
+    parms = current();
+    parms.low = parms.high;
+    TEST_ASSERT_FALSE(check(parms));
+}
+
+void test_check_rejects_wrong_type()
+{
+    mk::ButtonParameters parms;
+    memcpy(buffer, &parms, sizeof(parms));
+    TEST_ASSERT_FALSE(command->check_preferences(0, sizeof(mk::PotParameters), buffer));
+}
+
+void test_patch_checks_the_result()
+{
+    uint16_t high = current().high;
+
+    // low past high, not applied
+    uint16_t low = high + 1;
+    TEST_ASSERT_FALSE(command->patch_preferences(
+        0, LowOffset, sizeof(low), (uint8_t*)&low, false
+    ));
+
+    low = 10;
+    TEST_ASSERT_TRUE(command->patch_preferences(
+        0, LowOffset, sizeof(low), (uint8_t*)&low, false
+    ));
+    TEST_ASSERT_EQUAL(0, current().low);
+
+    TEST_ASSERT_TRUE(command->patch_preferences(
+        0, LowOffset, sizeof(low), (uint8_t*)&low, true
+    ));
+    TEST_ASSERT_EQUAL(10, current().low);
+}
+
+int main(int, char **)
+{
+    Host::get().reset();
+
+    command = new mk::MidiCommander();
+
+    mk::MidiPot::Config config;
+    config.pin = 14;
+    config.control = 1;
+    pot = new mk::MidiPot(config, command);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_check_accepts_defaults);
+    RUN_TEST(test_check_rejects_out_of_range);
+    RUN_TEST(test_check_rejects_wrong_type);
+    RUN_TEST(test_patch_checks_the_result);
+    return UNITY_END();
+}
@@ -0,0 +1,331 @@
+/**
+ * mk::SerialLink against the host Serial (lib/MidiKitiHost). The
+ * link is a singleton, so the tests run in order: v1 first, then the
+ * handshake, then everything framed as v2.
+ *
+ *     pio test -e native -f test_protocol
+ */
+#include <Arduino.h>
+#include <unity.h>
+
+#include "mk_protocol.h"
+#include "mk_host.h"
+
+#include <vector>
+
+using mk::host::Host;
+using Bytes = std::vector<uint8_t>;
+
+namespace
+{
+
+Bytes written;
+
+// version | seq | ack | id | size (16)
+const size_t HeaderSize = 6;
+
+void capture()
+{
+    written.clear();
+    Host::get().set_serial_output([](const uint8_t *data, size_t size) {
+        written.insert(written.end(), data, data + size);
+    });
+}
+
+Bytes cobs_encode(const Bytes &data)
+{
+    Bytes out;
+    size_t code = out.size();
+    out.push_back(0);
+
+    for (uint8_t b : data)
+    {
+        if (b == 0)
+        {
+            out[code] = out.size() - code;
+            code = out.size();
+            out.push_back(0);
+            continue;
+        }
+
+        out.push_back(b);
+        if (out.size() - code == 0xFF)
+        {
+            out[code] = 0xFF;
+            code = out.size();
+            out.push_back(0);
+        }
+    }
+
+    out[code] = out.size() - code;
+    return out;
+}
+
+// A v2 frame the way the Manager writes one
+Bytes frame(uint8_t id, const Bytes &payload, uint8_t seq)
+{
+    Bytes body = {
+        MK_PROTOCOL_VERSION, seq, 0, id,
+        uint8_t(payload.size() & 0xFF), uint8_t(payload.size() >> 8)
+    };
+    body.insert(body.end(), payload.begin(), payload.end());
+
+    uint16_t crc = mk::crc16(body.data(), body.size());
+    body.push_back(crc & 0xFF);
+    body.push_back(crc >> 8);
+
+    Bytes out = cobs_encode(body);
+    out.push_back(0);
+    return out;
+}
+
+void feed(const Bytes &data)
+{
+    Host::get().serial_input(data.data(), data.size());
+}
+
+// Read the way MidiController::scan_input does, filling whenever
+// the link runs dry
+bool receive(mk::Command &command)
+{
+    mk::SerialLink &link = mk::SerialLink::get();
+    while (true)
+    {
+        if (link.next(command))
+            return true;
+        if (link.fill() == 0)
+            return false;
+    }
+}
+
+// Payloads with long runs of non-zero bytes, to cross the 254 byte
+// COBS block boundary every which way
+Bytes pattern(size_t size, size_t zero_every)
+{
+    Bytes out(size);
+    for (size_t i = 0; i < size; i++)
+        out[i] = (zero_every && i % zero_every == zero_every - 1) ? 0 : uint8_t(1 + i % 251);
+    return out;
+}
+
+} // namespace
+
+void setUp()
+{
+    capture();
+}
+
+void tearDown()
+{
+}
+
+void test_crc16_check_value()
+{
+    const char *check = "123456789";
+    TEST_ASSERT_EQUAL_HEX16(0x29B1, mk::crc16((const uint8_t*)check, 9));
+
+    // Carried across calls, as the link does a byte at a time
+    uint16_t crc = mk::crc16((const uint8_t*)check, 4);
+    TEST_ASSERT_EQUAL_HEX16(0x29B1, mk::crc16((const uint8_t*)check + 4, 5, crc));
+}
+
+void test_cobs_decode_round_trip()
+{
+    const size_t sizes[] = { 0, 1, 253, 254, 255, 508, 509, 600 };
+    const size_t zeros[] = { 0, 1, 7, 254 };
+
+    for (size_t size : sizes)
+    {
+        for (size_t every : zeros)
+        {
+            Bytes data = pattern(size, every);
+            Bytes encoded = cobs_encode(data);
+            TEST_ASSERT_NULL(memchr(encoded.data(), 0, encoded.size()));
+
+            size_t length = mk::cobs_decode(encoded.data(), encoded.size());
+            TEST_ASSERT_EQUAL(data.size(), length);
+            TEST_ASSERT_EQUAL_MEMORY(data.data(), encoded.data(), length);
+        }
+    }
+}
+
+void test_cobs_decode_rejects_malformed()
+{
+    // A zero inside the block, and a code that runs off the end
+    Bytes zero = { 0x03, 0x11, 0x00, 0x22 };
+    TEST_ASSERT_EQUAL(0, mk::cobs_decode(zero.data(), zero.size()));
+
+    Bytes short_block = { 0x05, 0x11, 0x22 };
+    TEST_ASSERT_EQUAL(0, mk::cobs_decode(short_block.data(), short_block.size()));
+}
+
+void test_v1_command()
+{
+    mk::SerialLink &link = mk::SerialLink::get();
+    TEST_ASSERT_EQUAL(1, link.version());
+
+    feed({ Command_StartFlag, Command_GetPreferences, 2, 0x01, 0x02 });
+
+    mk::Command command;
+    TEST_ASSERT_TRUE(receive(command));
+    TEST_ASSERT_EQUAL(Command_GetPreferences, command.id);
+    TEST_ASSERT_EQUAL(2, command.size);
+    TEST_ASSERT_EQUAL(0x02, command.payload[1]);
+    TEST_ASSERT_FALSE(receive(command));
+}
+
+void test_hello_negotiates_v2()
+{
+    mk::SerialLink &link = mk::SerialLink::get();
+
+    // Asking for more than we have settles on ours
+    feed({ Command_StartFlag, Command_Hello, 1, 9 });
+
+    mk::Command command;
+    TEST_ASSERT_FALSE(receive(command));
+    TEST_ASSERT_EQUAL(MK_PROTOCOL_VERSION, link.version());
+
+    // Answered in v1 so the host can read it either way
+    Bytes reply = { Command_StartFlag, Command_Hello, 1, MK_PROTOCOL_VERSION };
+    TEST_ASSERT_EQUAL(reply.size(), written.size());
+    TEST_ASSERT_EQUAL_MEMORY(reply.data(), written.data(), reply.size());
+}
+
+void test_v2_send_round_trip()
+{
+    mk::SerialLink &link = mk::SerialLink::get();
+
+    const size_t sizes[] = { 0, 1, 247, 248, 249, 254, 255, 600 };
+    for (size_t size : sizes)
+    {
+        Bytes payload = pattern(size, size == 600 ? 97 : 0);
+
+        written.clear();
+        link.send(Command_Message, payload.data(), payload.size());
+
+        // One frame, one delimiter at the end
+        TEST_ASSERT_FALSE(written.empty());
+        TEST_ASSERT_EQUAL(0, written.back());
+        TEST_ASSERT_NULL(memchr(written.data(), 0, written.size() - 1));
+
+        size_t length = mk::cobs_decode(written.data(), written.size() - 1);
+        TEST_ASSERT_EQUAL(HeaderSize + size + 2, length);
+
+        uint16_t crc = written[length - 2] | (uint16_t(written[length - 1]) << 8);
+        TEST_ASSERT_EQUAL_HEX16(mk::crc16(written.data(), length - 2), crc);
+
+        TEST_ASSERT_EQUAL(MK_PROTOCOL_VERSION, written[0]);
+        TEST_ASSERT_EQUAL(Command_Message, written[3]);
+        TEST_ASSERT_EQUAL(size, written[4] | (written[5] << 8));
+        TEST_ASSERT_EQUAL_MEMORY(payload.data(), written.data() + HeaderSize, size);
+    }
+}
+
+void test_v2_receive()
+{
+    // Across the 254 byte block boundary, as big as the buffer takes
+    Bytes payload = pattern(MK_SERIAL_BUFFER - 16, 0);
+    feed(frame(Command_SetAll, payload, 1));
+
+    mk::Command command;
+    TEST_ASSERT_TRUE(receive(command));
+    TEST_ASSERT_EQUAL(Command_SetAll, command.id);
+    TEST_ASSERT_EQUAL(1, command.seq);
+    TEST_ASSERT_EQUAL(payload.size(), command.size);
+    TEST_ASSERT_EQUAL_MEMORY(payload.data(), command.payload, payload.size());
+    TEST_ASSERT_FALSE(receive(command));
+}
+
+void test_v2_resyncs_after_corrupt_frame()
+{
+    mk::SerialLink &link = mk::SerialLink::get();
+    uint16_t errors = link.rx_errors();
+
+    // A flipped bit fails the crc, the frame after it still reads
+    Bytes bad = frame(Command_GetPreferences, { 0, 1 }, 2);
+    bad[3] ^= 0x10;
+    feed(bad);
+    feed(frame(Command_GetPreferences, { 0, 2 }, 3));
+
+    mk::Command command;
+    TEST_ASSERT_TRUE(receive(command));
+    TEST_ASSERT_EQUAL(3, command.seq);
+    TEST_ASSERT_EQUAL(2, command.payload[1]);
+    // Once for the crc, once for the gap it leaves in seq
+    TEST_ASSERT_EQUAL(errors + 2, link.rx_errors());
+
+    // Noise with no delimiter, longer than the buffer, is thrown
+    // out up to the next delimiter
+    Bytes noise(MK_SERIAL_BUFFER, 0x5A);
+    feed(noise);
+    TEST_ASSERT_FALSE(receive(command));
+
+    feed(Bytes(40, 0x5A));
+    feed({ 0 });
+    feed(frame(Command_GetPreferences, { 0, 3 }, 4));
+    TEST_ASSERT_TRUE(receive(command));
+    TEST_ASSERT_EQUAL(4, command.seq);
+    TEST_ASSERT_EQUAL(3, command.payload[1]);
+}
+
+void test_v2_seq_wraps_past_zero()
+{
+    mk::SerialLink &link = mk::SerialLink::get();
+    mk::Command command;
+
+    // Up to where the last test left seq, then on round the wrap
+    for (unsigned seq = 5; seq <= 255; seq++)
+    {
+        feed(frame(Command_GetPreferences, { 0, 0 }, uint8_t(seq)));
+        TEST_ASSERT_TRUE(receive(command));
+    }
+    uint16_t errors = link.rx_errors();
+
+    // 255 -> 1, like the Manager sends
+    feed(frame(Command_GetPreferences, { 0, 1 }, 1));
+    feed(frame(Command_GetPreferences, { 0, 2 }, 2));
+    TEST_ASSERT_TRUE(receive(command));
+    TEST_ASSERT_EQUAL(1, command.seq);
+    TEST_ASSERT_TRUE(receive(command));
+    TEST_ASSERT_EQUAL(errors, link.rx_errors());
+
+    // And a real gap is still counted
+    feed(frame(Command_GetPreferences, { 0, 4 }, 4));
+    TEST_ASSERT_TRUE(receive(command));
+    TEST_ASSERT_EQUAL(errors + 1, link.rx_errors());
+}
+
+void test_v1_hello_from_v2()
+{
+    mk::SerialLink &link = mk::SerialLink::get();
+
+    // Half a frame, then a host that starts over
+    Bytes partial = frame(Command_GetPreferences, { 0, 1 }, 5);
+    partial.resize(partial.size() / 2);
+    partial.push_back(0);
+    feed(partial);
+
+    feed({ Command_StartFlag, Command_Hello, 1, 1 });
+
+    mk::Command command;
+    TEST_ASSERT_FALSE(receive(command));
+    TEST_ASSERT_EQUAL(1, link.version());
+}
+
+int main(int, char **)
+{
+    Host::get().reset();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_crc16_check_value);
+    RUN_TEST(test_cobs_decode_round_trip);
+    RUN_TEST(test_cobs_decode_rejects_malformed);
+    RUN_TEST(test_v1_command);
+    RUN_TEST(test_hello_negotiates_v2);
+    RUN_TEST(test_v2_send_round_trip);
+    RUN_TEST(test_v2_receive);
+    RUN_TEST(test_v2_resyncs_after_corrupt_frame);
+    RUN_TEST(test_v2_seq_wraps_past_zero);
+    RUN_TEST(test_v1_hello_from_v2);
+    return UNITY_END();
+}
@@ -0,0 +1,108 @@
+/**
+ * What the scheduler reports for telemetry: time spent in tasks of
+ * each priority, the latest start and deadline misses.
+ *
+ *     pio test -e native -f test_scheduler
+ */
+#include <Arduino.h>
+#include <unity.h>
+
+#include "mk_scheduler.h"
+#include "mk_host.h"
+
+using mk::host::Host;
+using mk::Scheduler;
+using mk::Task;
+
+namespace
+{
+
+// Each run takes as many microseconds as its context says
+void work(void *context)
+{
+    Host::get().advance(*static_cast<uint32_t*>(context));
+}
+
+uint32_t short_work = 30;
+uint32_t long_work = 50;
+uint32_t overrun = 300;
+
+/*
+ * Run the state pass on its release, it disarms whatever the last
+ * test left behind. Nothing else is due for a state period after,
+ * so each test adds tasks of its own that start out due.
+ */
+void settle()
+{
+    Host &host = Host::get();
+    host.advance(MK_STATE_PERIOD_US - host.now() % MK_STATE_PERIOD_US);
+    Scheduler::get().process();
+    Scheduler::get().clear_stats();
+}
+
+} // namespace
+
+void setUp()
+{
+    settle();
+}
+
+void tearDown()
+{
+}
+
+void test_busy_by_priority()
+{
+    static Task high(&work, &short_work, 100, mk::Priority_High);
+    static Task low(&work, &long_work, 5000, mk::Priority_Low);
+
+    high.arm();
+    low.arm();
+    Scheduler::get().process();
+
+    TEST_ASSERT_EQUAL_UINT32(short_work, high.busy());
+    TEST_ASSERT_EQUAL_UINT32(short_work, Scheduler::get().busy(mk::Priority_High));
+    TEST_ASSERT_EQUAL_UINT32(0, Scheduler::get().busy(mk::Priority_Normal));
+    TEST_ASSERT_EQUAL_UINT32(long_work, Scheduler::get().busy(mk::Priority_Low));
+}
+
+void test_worst_late()
+{
+    static Task high(&work, &short_work, 100, mk::Priority_High);
+    static Task low(&work, &long_work, 5000, mk::Priority_Low);
+
+    high.arm();
+    low.arm();
+    Scheduler::get().process();
+
+    // Low waited for the high priority run
+    TEST_ASSERT_EQUAL_UINT32(short_work, low.worst_late());
+    TEST_ASSERT_EQUAL_UINT32(short_work, Scheduler::get().worst_late());
+
+    Scheduler::get().clear_stats();
+    TEST_ASSERT_EQUAL_UINT32(0, Scheduler::get().worst_late());
+    TEST_ASSERT_EQUAL_UINT32(0, Scheduler::get().busy(mk::Priority_Low));
+}
+
+void test_overrun_misses()
+{
+    static Task slow(&work, &overrun, 200, mk::Priority_Normal);
+    uint16_t misses = Scheduler::get().misses();
+
+    slow.arm();
+    Scheduler::get().process();
+
+    TEST_ASSERT_EQUAL_UINT16(misses + 1, Scheduler::get().misses());
+    TEST_ASSERT_EQUAL_UINT32(overrun, Scheduler::get().busy(mk::Priority_Normal));
+}
+
+int main(int, char **)
+{
+    Host::get().reset();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_busy_by_priority);
+    RUN_TEST(test_worst_late);
+    RUN_TEST(test_overrun_misses);
+    return UNITY_END();
+}